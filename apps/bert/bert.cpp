@@ -0,0 +1,535 @@
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "prbs.hpp"
+#include "profile.hpp"
+
+// Bit error rate tester.
+// Generates a PRBS pattern to a file/pipe/socket, checks a pattern read
+// from one, or runs generator -> checker in process (loop) to self-test
+// and measure throughput.  Pattern work and I/O run on separate threads
+// with a ring of large buffers between them.
+
+void printHelp() {
+    std::cout << "BERT Application\n\n";
+    std::cout << "Generate or check PRBS test patterns at line rate.\n\n";
+    std::cout << "Program Options:\n";
+    std::cout << "   -m -- mode: gen, check or loop (gen -> check in process)\n";
+    std::cout << "   -p -- pattern: pn9, pn11, pn15, pn23, zeros, ones, alt (default pn23)\n";
+    std::cout << "   -i -- input for check mode\n";
+    std::cout << "   -o -- output for gen mode\n";
+    std::cout << "         endpoints: <file>, - (stdin/stdout), tcp:<host>:<port> (connect),\n";
+    std::cout << "         tcp:<port> (listen), udp:<host>:<port> (send), udp:<port> (receive)\n";
+    std::cout << "   -e -- inject bit errors at this rate (e.g. 1e-6) in gen/loop modes\n";
+    std::cout << "   -b -- buffer size in KB (default 1024)\n";
+    std::cout << "   -k -- buffers in flight between threads (default 8)\n";
+    std::cout << "   -r -- report window in seconds (default 1)\n";
+    std::cout << "   -F -- report lines as json or csv stats instead of the table\n";
+    std::cout << "   -T -- stop after this many seconds (default: end of input, gen/loop run until killed)\n";
+    std::cout << "   -h -- help message\n";
+    std::cout << std::endl;
+}
+
+enum bert_mode_t {
+    mode_gen,
+    mode_check,
+    mode_loop
+};
+
+// command line settings
+struct BertOptions {
+    bert_mode_t mode = mode_loop;
+    prbs_pattern_t pattern = ITU_PN23;
+    std::string input;
+    std::string output;
+    double error_rate = 0;
+    int buffer_kb = 1024;
+    int buffers = 8;
+    double report_secs = 1;
+    double run_secs = 0;
+    bool stats = false;                 // -F
+    stats_format_t stats_format = stats_json;
+};
+
+// returns 0 if parse completes, -1 if parse is incomplete.
+int getOptions( int argc, char **argv, BertOptions &opt ) {
+    const char *patterns[] = { "", "zeros", "ones", "alt", "pn9", "pn11", "pn15", "pn23" };
+    int c;
+    while (( c = getopt( argc, argv, "m:p:i:o:e:b:k:r:T:F:h") ) != -1 ) {
+        switch (c) {
+            case 'h':
+                printHelp();
+                return -1;
+            case 'm':
+                if ( strcmp( optarg, "gen" ) == 0 ) {
+                    opt.mode = mode_gen;
+                } else if ( strcmp( optarg, "check" ) == 0 ) {
+                    opt.mode = mode_check;
+                } else if ( strcmp( optarg, "loop" ) == 0 ) {
+                    opt.mode = mode_loop;
+                } else {
+                    std::cout << "Unknown mode: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'p': {
+                int found = 0;
+                for ( int p = ALL_ZEROS; p <= ITU_PN23; ++p ) {
+                    if ( strcmp( optarg, patterns[p] ) == 0 ) {
+                        opt.pattern = (prbs_pattern_t)p;
+                        found = 1;
+                    }
+                }
+                if ( !found ) {
+                    std::cout << "Unknown pattern: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            }
+            case 'i':
+                opt.input = optarg;
+                break;
+            case 'o':
+                opt.output = optarg;
+                break;
+            case 'e':
+                opt.error_rate = atof(optarg);
+                break;
+            case 'b':
+                opt.buffer_kb = atoi(optarg);
+                break;
+            case 'k':
+                opt.buffers = atoi(optarg);
+                break;
+            case 'r':
+                opt.report_secs = atof(optarg);
+                break;
+            case 'T':
+                opt.run_secs = atof(optarg);
+                break;
+            case 'F':
+                opt.stats = true;
+                if ( strcmp( optarg, "csv" ) == 0 ) {
+                    opt.stats_format = stats_csv;
+                } else if ( strcmp( optarg, "json" ) != 0 ) {
+                    std::cout << "Unknown stats format: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            default:
+                std::cout << "Unknown input option provided, try -h for options list.." << std::endl;
+                return -1;
+        }
+    }
+    if ( opt.mode == mode_gen && opt.output.length() == 0 ) {
+        std::cout << "gen mode needs an output (-o)\n";
+        return -1;
+    }
+    if ( opt.mode == mode_check && opt.input.length() == 0 ) {
+        std::cout << "check mode needs an input (-i)\n";
+        return -1;
+    }
+    if ( opt.buffer_kb < 1 || opt.buffer_kb > 1024*1024 || opt.buffers < 2 ) {
+        std::cout << "Buffer size must be 1KB to 1GB (-b), with at least 2 buffers (-k)\n";
+        return -1;
+    }
+    if ( opt.error_rate < 0 || opt.error_rate >= 1 ) {
+        std::cout << "Error rate (-e) must be 0 to 1\n";
+        return -1;
+    }
+    return 0;
+}
+
+// open a socket endpoint, "tcp:host:port", "tcp:port", "udp:host:port"
+// or "udp:port".  Returns a file descriptor or -1.
+int openSocket( const std::string &spec ) {
+    bool tcp = spec.compare( 0, 4, "tcp:" ) == 0;
+    std::string rest = spec.substr(4);
+    std::string host;
+    std::string port = rest;
+    size_t colon = rest.rfind(':');
+    if ( colon != std::string::npos ) {
+        host = rest.substr( 0, colon );
+        port = rest.substr( colon+1 );
+    }
+    struct addrinfo hints;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = host.length() ? 0 : AI_PASSIVE;
+    struct addrinfo *ai;
+    if ( getaddrinfo( host.length() ? host.c_str() : nullptr, port.c_str(), &hints, &ai ) != 0 ) {
+        std::cout << "Can't resolve " << spec << std::endl;
+        return -1;
+    }
+    int fd = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+    if ( fd < 0 ) {
+        freeaddrinfo(ai);
+        return -1;
+    }
+    int rc;
+    if ( host.length() ) {
+        // sender / client
+        rc = connect( fd, ai->ai_addr, ai->ai_addrlen );
+    } else {
+        int on = 1;
+        setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+        rc = bind( fd, ai->ai_addr, ai->ai_addrlen );
+        if ( rc == 0 && tcp ) {
+            // wait for one connection
+            listen( fd, 1 );
+            std::cout << "Waiting for connection on port " << port << "..\n";
+            int conn = accept( fd, nullptr, nullptr );
+            close(fd);
+            fd = conn;
+            rc = ( conn < 0 ) ? -1 : 0;
+        }
+    }
+    freeaddrinfo(ai);
+    if ( rc < 0 ) {
+        std::cout << "Socket setup failed for " << spec << std::endl;
+        if ( fd >= 0 ) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// open a file, pipe or socket endpoint for reading or writing.
+int openEndpoint( const std::string &spec, bool for_write ) {
+    if ( spec == "-" ) {
+        return for_write ? STDOUT_FILENO : STDIN_FILENO;
+    }
+    if ( spec.compare( 0, 4, "tcp:" ) == 0 || spec.compare( 0, 4, "udp:" ) == 0 ) {
+        return openSocket( spec );
+    }
+    if ( for_write ) {
+        return open( spec.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    }
+    return open( spec.c_str(), O_RDONLY );
+}
+
+// Queue of buffer indexes handed between the pattern thread and the I/O
+// thread, bounded by the ring size.  -1 marks end of stream.
+struct BufferQueue {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<int> items;
+    void push( int idx ) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            items.push_back(idx);
+        }
+        ready.notify_one();
+    }
+    int depth() {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+    int pop() {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait( guard, [this] { return !items.empty(); } );
+        int idx = items.front();
+        items.pop_front();
+        return idx;
+    }
+};
+
+// ring of buffers, free ones wait in empty, filled ones in full.
+struct BufferRing {
+    std::vector< std::vector<uint8_t> > buffers;
+    std::vector<int> lengths;
+    BufferQueue empty;
+    BufferQueue full;
+    BufferRing( int count, size_t size ) : buffers( count, std::vector<uint8_t>(size) ), lengths(count, 0) {
+        for ( int idx=0; idx < count; ++idx ) {
+            empty.push(idx);
+        }
+    }
+};
+
+// counters published by the worker threads for the reporter
+struct BertCounters {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> bits_rx_locked{0};
+    std::atomic<uint64_t> bit_errors{0};
+    std::atomic<uint64_t> sync_slips{0};
+    std::atomic<uint64_t> errors_injected{0};
+    std::atomic<int> locked{0};
+    std::atomic<bool> done{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};    // output write error, the run ended early
+};
+
+// flip bits at random positions, exponential spacing gives the wanted rate.
+struct ErrorInjector {
+    double rate;
+    std::mt19937_64 rng;
+    double next_bit;    // bits until the next error
+    ErrorInjector( double _rate ) : rate(_rate), rng(12345), next_bit(0) { schedule(); }
+    void schedule() {
+        if ( rate > 0 ) {
+            std::exponential_distribution<double> gap(rate);
+            next_bit += gap(rng);
+        }
+    }
+    uint64_t inject( uint8_t *buffer, int len ) {
+        uint64_t count = 0;
+        double bits = (double)len * 8;
+        while ( rate > 0 && next_bit < bits ) {
+            uint64_t b = (uint64_t)next_bit;
+            buffer[ b/8 ] ^= 0x80 >> ( b % 8 );
+            count++;
+            schedule();
+        }
+        if ( rate > 0 ) {
+            next_bit -= bits;
+        }
+        return count;
+    }
+};
+
+// pattern generator thread: fill free buffers and queue them
+void generatorThread( BertOptions opt, BufferRing *ring, BertCounters *cnt ) {
+    PRBSGEN gen( opt.pattern );
+    ErrorInjector errs( opt.error_rate );
+    while ( !cnt->stop ) {
+        int idx = ring->empty.pop();
+        if ( idx < 0 ) {
+            break;
+        }
+        std::vector<uint8_t> &buf = ring->buffers[idx];
+        gen.generate( buf.data(), (int)buf.size() );
+        cnt->errors_injected += errs.inject( buf.data(), (int)buf.size() );
+        ring->lengths[idx] = buf.size();
+        ring->full.push(idx);
+    }
+    ring->full.push(-1);
+}
+
+// pattern checker thread: check filled buffers and hand them back
+void checkerThread( BertOptions opt, BufferRing *ring, BertCounters *cnt ) {
+    PRBSCHK chk( opt.pattern );
+    while (1) {
+        int idx = ring->full.pop();
+        if ( idx < 0 ) {
+            break;
+        }
+        chk.check( ring->buffers[idx].data(), ring->lengths[idx] );
+        cnt->bytes += ring->lengths[idx];
+        cnt->bits_rx_locked = chk.bits_rx_locked;
+        cnt->bit_errors = chk.bit_errors_detected;
+        cnt->sync_slips = chk.sync_slips;
+        cnt->locked = chk.isLocked;
+        ring->empty.push(idx);
+    }
+    cnt->done = true;
+}
+
+// I/O thread, write filled buffers to the output
+void writerThread( int fd, BufferRing *ring, BertCounters *cnt ) {
+    while (1) {
+        int idx = ring->full.pop();
+        if ( idx < 0 ) {
+            break;
+        }
+        uint8_t *p = ring->buffers[idx].data();
+        int left = ring->lengths[idx];
+        while ( left > 0 ) {
+            // keep datagrams under the UDP size limit, streams don't care
+            ssize_t n = write( fd, p, left > 32768 ? 32768 : left );
+            if ( n <= 0 ) {
+                std::cout << "Output write failed, stopping\n";
+                cnt->failed = true;
+                cnt->stop = true;
+                ring->empty.push(idx);
+                // drain so the generator can finish
+                while ( ring->full.pop() >= 0 ) { }
+                cnt->done = true;
+                return;
+            }
+            p += n;
+            left -= n;
+        }
+        cnt->bytes += ring->lengths[idx];
+        ring->empty.push(idx);
+    }
+    cnt->done = true;
+}
+
+// I/O thread, fill free buffers from the input
+void readerThread( int fd, BufferRing *ring, BertCounters *cnt ) {
+    while ( !cnt->stop ) {
+        int idx = ring->empty.pop();
+        if ( idx < 0 ) {
+            break;
+        }
+        std::vector<uint8_t> &buf = ring->buffers[idx];
+        size_t have = 0;
+        while ( have < buf.size() ) {
+            ssize_t n = read( fd, buf.data()+have, buf.size()-have );
+            if ( n <= 0 ) {
+                break;
+            }
+            have += n;
+        }
+        if ( have == 0 ) {
+            ring->empty.push(idx);
+            break;
+        }
+        ring->lengths[idx] = have;
+        ring->full.push(idx);
+        if ( have < buf.size() ) {
+            break; // end of input
+        }
+    }
+    ring->full.push(-1);
+}
+
+int main( int argc, char **argv ) {
+    BertOptions opt;
+    if ( getOptions( argc, argv, opt ) < 0 ) {
+        std::cout << "Exit..\n" << std::endl;
+        return -1;
+    }
+    int fd = -1;
+    if ( opt.mode == mode_gen ) {
+        fd = openEndpoint( opt.output, true );
+    } else if ( opt.mode == mode_check ) {
+        fd = openEndpoint( opt.input, false );
+    }
+    if ( opt.mode != mode_loop && fd < 0 ) {
+        std::cout << "Failed to open " << ( opt.mode == mode_gen ? opt.output : opt.input ) << std::endl;
+        return -1;
+    }
+    // a closed pipe or socket reader shows up as a write error (EPIPE)
+    // and ends the run, instead of killing the process with SIGPIPE
+    signal( SIGPIPE, SIG_IGN );
+    // reports go to stderr when the pattern itself is on stdout
+    FILE *report = ( opt.mode == mode_gen && fd == STDOUT_FILENO ) ? stderr : stdout;
+
+    BufferRing ring( opt.buffers, (size_t)opt.buffer_kb * 1024 );
+    BertCounters cnt;
+    std::thread producer;
+    std::thread consumer;
+    if ( opt.mode == mode_gen ) {
+        producer = std::thread( generatorThread, opt, &ring, &cnt );
+        consumer = std::thread( writerThread, fd, &ring, &cnt );
+    } else if ( opt.mode == mode_check ) {
+        producer = std::thread( readerThread, fd, &ring, &cnt );
+        consumer = std::thread( checkerThread, opt, &ring, &cnt );
+    } else {
+        producer = std::thread( generatorThread, opt, &ring, &cnt );
+        consumer = std::thread( checkerThread, opt, &ring, &cnt );
+    }
+
+    fprintf( report, "BERT %s, pattern %s, %d x %d KB buffers\n",
+             opt.mode == mode_gen ? "generate" : ( opt.mode == mode_check ? "check" : "loopback" ),
+             pattern_lookup_table[opt.pattern].name, opt.buffers, opt.buffer_kb );
+    if ( opt.stats ) {
+        if ( opt.stats_format == stats_csv ) {
+            fprintf( report, "time,metric,value\n" );
+        }
+    } else {
+        fprintf( report, "%8s %10s %12s %10s %10s %6s %7s\n",
+                 "time_s", "Mbit/s", "window_BER", "errors", "slips", "lock", "inject" );
+    }
+
+    // report over sliding windows until the workers finish
+    auto t0 = std::chrono::steady_clock::now();
+    auto last = t0;
+    uint64_t last_bytes = 0;
+    uint64_t last_locked = 0;
+    uint64_t last_errors = 0;
+    while ( !cnt.done ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> window = now - last;
+        std::chrono::duration<double> elapsed = now - t0;
+        if ( opt.run_secs > 0 && elapsed.count() >= opt.run_secs ) {
+            cnt.stop = true;
+            if ( opt.mode == mode_check ) {
+                // reader may be blocked on a socket, don't wait for it
+                shutdown( fd, SHUT_RD );
+            }
+        }
+        if ( window.count() < opt.report_secs && !cnt.done ) {
+            continue;
+        }
+        uint64_t bytes = cnt.bytes;
+        uint64_t locked = cnt.bits_rx_locked;
+        uint64_t errors = cnt.bit_errors;
+        double mbps = ( bytes - last_bytes ) * 8 / window.count() / 1e6;
+        double ber = ( locked > last_locked ) ? (double)( errors - last_errors ) / ( locked - last_locked ) : NAN;
+        if ( opt.stats ) {
+            std::vector<StatsField> fields = {
+                { "mbps", mbps },
+                { "window_ber", ber },
+                { "bits", (double)bytes*8 },
+                { "errors", (double)errors },
+                { "slips", (double)cnt.sync_slips.load() },
+                { "locked", (double)cnt.locked.load() },
+                { "injected", (double)cnt.errors_injected.load() },
+                { "queue_depth", (double)ring.full.depth() } };
+            writeStats( report, opt.stats_format, elapsed.count(), fields );
+        } else {
+            fprintf( report, "%8.2f %10.1f %12.3e %10llu %10llu %6s %7llu\n", elapsed.count(), mbps, ber,
+                     (unsigned long long)errors, (unsigned long long)cnt.sync_slips.load(),
+                     opt.mode == mode_gen ? "-" : ( cnt.locked ? "yes" : "no" ),
+                     (unsigned long long)cnt.errors_injected.load() );
+        }
+        fflush( report );
+        last = now;
+        last_bytes = bytes;
+        last_locked = locked;
+        last_errors = errors;
+    }
+    cnt.stop = true;
+    // unblock a producer waiting for a free buffer
+    ring.empty.push(-1);
+    producer.join();
+    consumer.join();
+
+    std::chrono::duration<double> total = std::chrono::steady_clock::now() - t0;
+    uint64_t bits = cnt.bytes * 8;
+    fprintf( report, "\nEnd of Run Status:\n" );
+    fprintf( report, "pattern            %s\n", pattern_lookup_table[opt.pattern].name );
+    fprintf( report, "bits               %llu\n", (unsigned long long)bits );
+    if ( opt.mode != mode_gen ) {
+        double ber = cnt.bits_rx_locked ? (double)cnt.bit_errors / cnt.bits_rx_locked : NAN;
+        fprintf( report, "bits in lock       %llu\n", (unsigned long long)cnt.bits_rx_locked.load() );
+        fprintf( report, "bit errors         %llu\n", (unsigned long long)cnt.bit_errors.load() );
+        fprintf( report, "sync slips         %llu\n", (unsigned long long)cnt.sync_slips.load() );
+        fprintf( report, "BER                %g\n", ber );
+    }
+    if ( opt.mode != mode_check ) {
+        fprintf( report, "errors injected    %llu\n", (unsigned long long)cnt.errors_injected.load() );
+    }
+    fprintf( report, "sustained rate     %.1f Mbit/s (%s)\n", bits / total.count() / 1e6,
+             pattern_lookup_table[opt.pattern].name );
+    if ( cnt.failed ) {
+        fprintf( report, "stopped early on an output write error\n" );
+    }
+    if ( fd > STDERR_FILENO ) {
+        close(fd);
+    }
+    return cnt.failed ? -1 : 0;
+}
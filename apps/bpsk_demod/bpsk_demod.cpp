@@ -1,9 +1,24 @@
 #include <iostream>
 #include <string>
 #include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <fcntl.h>
+#include <glob.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 #include "libdsp.hpp"
+#include "dspchain.hpp"
+#include "workpool.hpp"
+#include "profile.hpp"
+#include "capindex.hpp"
+#include "decimate.hpp"
+#include "arena.hpp"
 
 using namespace std;
 
@@ -15,7 +30,38 @@ void printHelp() {
     std::cout << "Program Options:\n";
     std::cout << "   -i -- (required) File of input complex double samples.\n";
     std::cout << "   -o -- (required) File of output complex double samples. \n";
-    std::cout << "   -h -- help message\n";
+    std::cout << "   -j -- split input into N segments, each demodulated on its own thread\n";
+    std::cout << "   -w -- warm-up overlap (samples) run ahead of each segment (default 16384)\n";
+    std::cout << "   -f -- single precision, input and output are complex float (c32) samples\n";
+    std::cout << "   -q -- Q15 fixed point, input and output are complex int16 (sc16) samples\n";
+    std::cout << "   -s -- print a machine readable stats line every N seconds, stdout then only\n";
+    std::cout << "         carries stats lines (status text goes to stderr)\n";
+    std::cout << "   -S -- stats format, json or csv (default json)\n";
+    std::cout << "   -T -- record a binary loop trace to this file (<file>.<segment> with -j)\n";
+    std::cout << "   -n -- samples between trace records (default 256, one per loop window)\n";
+    std::cout << "   -E -- energy squelch, open[:close] block power in dBFS (close defaults to open-3)\n";
+    std::cout << "         only active regions are demodulated, they are listed in <output>.bursts\n";
+    std::cout << "   -P -- squelch pre[:post] roll in samples (default 2048:4096)\n";
+    std::cout << "   -H -- hold the carrier loop over squelch gaps (default: reset it)\n";
+    std::cout << "   -Z -- leave idle samples out of the output (default: write zeros)\n";
+    std::cout << "   -A -- AGC ahead of the matched filter, target dBFS[:attack:decay dB/s]\n";
+    std::cout << "         (default -6:20000:2000), not for sc16 (-q)\n";
+    std::cout << "   -R -- sample rate in Hz, for the AGC rates (default 1000000)\n";
+    std::cout << "   -e -- adaptive equalizer after the matched filter, taps, not for sc16 (-q)\n";
+    std::cout << "   -d -- input is at 4*N samples/symbol, decimate by N (CIC/half-band cascade)\n";
+    std::cout << "         ahead of the demod, the output is at 4 sps.  -R is the input rate\n";
+    std::cout << "   -N -- keep threads and sample buffers on a NUMA node, node[:4k|2m|1g] (buffer\n";
+    std::cout << "         pages, default 2m hugepages, smaller pages if the pool runs out)\n";
+    std::cout << "   -I -- write a block index (level, squelch, lock, freq_est) to <output>.idx\n";
+    std::cout << "   -r -- reprocess only the active (or locked, <index>:locked) blocks of an\n";
+    std::cout << "         earlier run's index, the rest of the output is zeros\n";
+    std::cout << "   -h -- help message\n\n";
+    std::cout << "Batch Mode:\n";
+    std::cout << "   bpsk_demod -O <dir> [-b <list file>] [-t <threads>] [input files..]\n";
+    std::cout << "   -O -- output directory, each input writes <dir>/<name>.demod.c64\n";
+    std::cout << "         (.demod.c32 with -f, .demod.sc16 with -q)\n";
+    std::cout << "   -b -- file listing inputs (one path or glob pattern per line)\n";
+    std::cout << "   -t -- worker threads (default: one per cpu)\n";
     std::cout << std::endl;
 }
 
@@ -23,41 +69,316 @@ off_t tell (int filedes ) {
     return lseek(filedes, 0L, SEEK_CUR);
 }
 
+// sample file formats
+enum sample_format_t {
+    format_c64,     // complex double
+    format_c32,     // complex float (-f)
+    format_sc16     // complex int16, Q15 pipeline (-q)
+};
+
+// energy squelch settings (-E/-P/-H/-Z)
+struct GateOptions {
+    bool enabled = false;
+    double open_db = 0;
+    double close_db = 0;
+    long pre_roll = 2048;
+    long post_roll = 4096;
+    bool hold = false;          // keep loop state over gaps instead of resetting it
+    bool drop_idle = false;     // idle samples are left out of the output, not zeroed
+};
+
+// gain control settings (-A/-R)
+struct AgcOptions {
+    bool enabled = false;
+    double target_db = -6;
+    double attack = 20000;      // dB/s
+    double decay = 2000;        // dB/s
+    double sample_rate = 1e6;
+};
+
+// equalizer settings (-e)
+struct EqOptions {
+    bool enabled = false;
+    int taps = 32;
+    equalizer_method_t method = equalize_time;
+};
+
+// block size (samples) of the segment path, and of the index entries
+const int demod_block = 4096;
+// squelch block size (samples), the gate opens and closes on these
+const int gate_block = 1024;
+
+// command line settings
+struct DemodOptions {
+    std::string input_file;
+    std::string output_file;
+    int segments = 1;                      // -j
+    long overlap = 16384;                  // -w
+    std::string output_dir;                // -O (batch mode)
+    std::string batch_list;                // -b
+    std::vector<std::string> batch_inputs; // trailing arguments
+    int threads = 0;                       // -t
+    sample_format_t format = format_c64;   // -f / -q
+    double stats_interval = 0;             // -s
+    stats_format_t stats_format = stats_json; // -S
+    std::string trace_file;                // -T
+    int trace_every = 256;                 // -n
+    GateOptions gate;                      // -E/-P/-H/-Z
+    AgcOptions agc;                        // -A/-R
+    EqOptions eq;                          // -e
+    bool write_index = false;              // -I
+    std::string reprocess_index;           // -r
+    uint16_t reprocess_flags = index_active; // -r <index>:locked
+    int decimate = 1;                      // -d
+    int node = -1;                         // -N
+    arena_page_t page = arena_page_2m;     // -N <node>:<page>
+    bool batch() const { return output_dir.length() > 0; }
+};
+
 // returns 0 if parse completes, -1 if parse is incomplete.
-int getOptions( int argc, char**argv, std::string &input_file, std::string &output_file ) {
+int getOptions( int argc, char**argv, DemodOptions &opt ) {
     // get input file of samples to process
     int c;
-    while (( c = getopt( argc, argv, "i:o:h") ) != -1  ) {
+    while (( c = getopt( argc, argv, "i:o:j:w:O:b:t:fqs:S:T:n:E:P:HZIr:A:R:d:e:N:h") ) != -1  ) {
         switch (c) {
             case 'h':
                 printHelp();
                 return -1;
                 break;
             case 'i':
-                input_file = optarg;
+                opt.input_file = optarg;
                 break;
             case 'o':
-                output_file = optarg;
+                opt.output_file = optarg;
+                break;
+            case 'j':
+                opt.segments = atoi(optarg);
+                break;
+            case 'w':
+                opt.overlap = atol(optarg);
+                break;
+            case 'O':
+                opt.output_dir = optarg;
+                break;
+            case 'b':
+                opt.batch_list = optarg;
+                break;
+            case 't':
+                opt.threads = atoi(optarg);
+                break;
+            case 'f':
+                opt.format = format_c32;
+                break;
+            case 'q':
+                opt.format = format_sc16;
+                break;
+            case 's':
+                opt.stats_interval = atof(optarg);
+                break;
+            case 'T':
+                opt.trace_file = optarg;
+                break;
+            case 'n':
+                opt.trace_every = atoi(optarg);
+                break;
+            case 'E':
+                opt.gate.enabled = true;
+                if ( sscanf( optarg, "%lf:%lf", &opt.gate.open_db, &opt.gate.close_db ) < 2 ) {
+                    opt.gate.close_db = opt.gate.open_db - 3;
+                }
+                break;
+            case 'P':
+                if ( sscanf( optarg, "%ld:%ld", &opt.gate.pre_roll, &opt.gate.post_roll ) < 1 ) {
+                    std::cout << "Bad pre/post roll: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'H':
+                opt.gate.hold = true;
+                break;
+            case 'Z':
+                opt.gate.drop_idle = true;
+                break;
+            case 'I':
+                opt.write_index = true;
+                break;
+            case 'A':
+                opt.agc.enabled = true;
+                if ( sscanf( optarg, "%lf:%lf:%lf", &opt.agc.target_db, &opt.agc.attack, &opt.agc.decay ) < 1 ) {
+                    std::cout << "Bad AGC setting: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'R':
+                opt.agc.sample_rate = atof(optarg);
+                break;
+            case 'd':
+                opt.decimate = atoi(optarg);
+                break;
+            case 'e': {
+                    char method[16] = "";
+                    opt.eq.enabled = true;
+                    if ( sscanf( optarg, "%d:%15s", &opt.eq.taps, method ) < 1 ) {
+                        std::cout << "Bad equalizer setting: " << optarg << std::endl;
+                        return -1;
+                    }
+                    if ( strcmp( method, "fft" ) == 0 ) {
+                        opt.eq.method = equalize_fft;
+                    } else if ( method[0] != 0 ) {
+                        std::cout << "Unknown equalizer method: " << method << std::endl;
+                        return -1;
+                    }
+                }
+                break;
+            case 'N': {
+                    char page[8] = "";
+                    if ( sscanf( optarg, "%d:%7s", &opt.node, page ) < 1 || opt.node < 0 ) {
+                        std::cout << "Bad NUMA node: " << optarg << std::endl;
+                        return -1;
+                    }
+                    if ( strcmp( page, "4k" ) == 0 ) {
+                        opt.page = arena_page_4k;
+                    } else if ( strcmp( page, "1g" ) == 0 ) {
+                        opt.page = arena_page_1g;
+                    } else if ( page[0] != 0 && strcmp( page, "2m" ) != 0 ) {
+                        std::cout << "Unknown page size: " << page << std::endl;
+                        return -1;
+                    }
+                }
+                break;
+            case 'r': {
+                    std::string arg = optarg;
+                    size_t colon = arg.rfind(':');
+                    if ( colon != std::string::npos && arg.substr( colon+1 ) == "locked" ) {
+                        opt.reprocess_flags = index_active | index_locked;
+                        arg = arg.substr( 0, colon );
+                    }
+                    opt.reprocess_index = arg;
+                }
+                break;
+            case 'S':
+                if ( strcmp( optarg, "csv" ) == 0 ) {
+                    opt.stats_format = stats_csv;
+                } else if ( strcmp( optarg, "json" ) != 0 ) {
+                    std::cout << "Unknown stats format: " << optarg << std::endl;
+                    return -1;
+                }
                 break;
             default:
                 std::cout << "Unknown input option provided, try -h for options list.." << std::endl;
                 return -1;
         }
     }
+    for ( int idx=optind; idx < argc; ++idx ) {
+        opt.batch_inputs.push_back( argv[idx] );
+    }
 
-    if ( input_file.length() == 0 ) {
+    if ( opt.trace_every < 1 ) {
+        std::cout << "Trace interval (-n) must be 1 or more\n";
+        return -1;
+    }
+    if ( opt.gate.enabled ) {
+        if ( opt.gate.close_db > opt.gate.open_db ) {
+            std::cout << "Squelch close level must not be above the open level\n";
+            return -1;
+        }
+        if ( opt.gate.pre_roll < 0 || opt.gate.post_roll < 0 ) {
+            std::cout << "Squelch pre/post roll (-P) can not be negative\n";
+            return -1;
+        }
+    }
+    if ( opt.agc.enabled ) {
+        if ( opt.format == format_sc16 ) {
+            std::cout << "AGC (-A) is not available on the sc16 (-q) pipeline\n";
+            return -1;
+        }
+        if ( opt.agc.attack <= 0 || opt.agc.decay <= 0 || opt.agc.sample_rate <= 0 ) {
+            std::cout << "AGC rates (-A) and sample rate (-R) must be above 0\n";
+            return -1;
+        }
+    }
+    if ( opt.eq.enabled ) {
+        if ( opt.format == format_sc16 ) {
+            std::cout << "Equalizer (-e) is not available on the sc16 (-q) pipeline\n";
+            return -1;
+        }
+        if ( opt.eq.taps < 2 ) {
+            std::cout << "Equalizer (-e) needs 2 or more taps\n";
+            return -1;
+        }
+        if ( opt.eq.method == equalize_fft ) {
+            // its output is a block (taps samples) late, the carrier loop
+            // can't close around that
+            std::cout << "Equalizer (-e) fft method can't run inside the carrier loop\n";
+            return -1;
+        }
+    }
+    if ( opt.node >= numaNodeCount() || ( opt.node >= 0 && nodeCpus( opt.node ).size() == 0 ) ) {
+        std::cout << "NUMA node (-N) " << opt.node << " has no cpus, this machine has "
+                  << numaNodeCount() << " nodes\n";
+        return -1;
+    }
+    if ( opt.decimate < 1 ) {
+        std::cout << "Decimation (-d) must be 1 or more\n";
+        return -1;
+    }
+    if ( opt.decimate > 1 ) {
+        if ( opt.batch() || opt.segments > 1 || opt.format == format_sc16 || opt.gate.enabled ||
+             opt.write_index || opt.reprocess_index.length() > 0 ) {
+            std::cout << "Decimation (-d) can not be combined with batch mode, -j, -q, -E, -I or -r\n";
+            return -1;
+        }
+    }
+    if ( opt.batch() ) {
+        if ( opt.trace_file.length() > 0 ) {
+            std::cout << "Loop trace (-T) is not supported in batch mode\n";
+            return -1;
+        }
+        if ( opt.reprocess_index.length() > 0 ) {
+            std::cout << "Reprocessing (-r) is not supported in batch mode\n";
+            return -1;
+        }
+        if ( opt.batch_list.length() == 0 && opt.batch_inputs.size() == 0 ) {
+            std::cout << "Batch mode needs inputs, give a list (-b) or file names\n";
+            return -1;
+        }
+        if ( opt.threads < 0 ) {
+            std::cout << "Thread count (-t) can not be negative\n";
+            return -1;
+        }
+        return 0;
+    }
+    if ( opt.input_file.length() == 0 ) {
         std::cout << "Must specify input sample source (-i)\n";
         return -1;
     }
-    if ( output_file.length() == 0 ) {
+    if ( opt.output_file.length() == 0 ) {
         std::cout << "Must specify output sample dest (-o)\n";
         return -1;
     }
+    if ( opt.segments < 1 ) {
+        std::cout << "Segment count (-j) must be 1 or more\n";
+        return -1;
+    }
+    if ( opt.overlap < 0 ) {
+        std::cout << "Warm-up overlap (-w) can not be negative\n";
+        return -1;
+    }
+    if ( opt.gate.drop_idle && opt.segments > 1 ) {
+        std::cout << "Dropping idle samples (-Z) needs a single segment\n";
+        return -1;
+    }
+    if ( opt.reprocess_index.length() > 0 ) {
+        if ( opt.write_index || opt.gate.drop_idle || opt.trace_file.length() > 0 ) {
+            std::cout << "Reprocessing (-r) can not be combined with -I, -Z or -T\n";
+            return -1;
+        }
+    }
     return 0;
 }
 
-
-void printDemodStatus(double progress, BpskDemod &demod) {
+template <typename Demod>
+void printDemodStatus(double progress, Demod &demod) {
     // assume VT100 compatible terminal (linux/bsd/etc..)
     //std::cout << "\x1b[2J"; // clear screen
     std::cout << "Demodulator Status:\n";
@@ -81,39 +402,754 @@ void printDemodStatus(double progress, BpskDemod &demod) {
     std::cout << std::endl << std::flush;
 }
 
-int main( int argc, char **argv ) {
-    std::string input_file("");
-    std::string output_file("");
-    int fhi, fho; // file handles
-    int bytes_in;
+const char *state_names[] = { "freq acq", "phase acq", "Tracking" };
 
-    if ( getOptions(argc, argv, input_file, output_file) < 0 ) {
-        std::cout << "Exit..\n" << std::endl;
+// progress shared with the stats reporter, the demod fields come from
+// whichever demod updated last (there is one per segment/file)
+struct DemodMonitor {
+    std::atomic<long long> samples{0};
+    std::atomic<int> state{-1};
+    std::atomic<double> freq_est{0};
+    std::atomic<double> phase_est{0};
+    template <typename Demod>
+    void update( const Demod &demod ) {
+        state = demod.state;
+        freq_est = demod.freq_est;
+        phase_est = demod.phase_est;
+    }
+};
+DemodMonitor monitor;
+
+// app fields for a stats line, rates are since the previous line
+static long long last_samples = 0;
+static auto last_time = std::chrono::steady_clock::now();
+void demodStatsFields( std::vector<StatsField> &fields ) {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> dt = now - last_time;
+    long long samples = monitor.samples;
+    fields.push_back( { "samples", (double)samples } );
+    fields.push_back( { "msps", dt.count() > 0 ? ( samples - last_samples ) / dt.count() / 1e6 : 0 } );
+    if ( monitor.state >= 0 ) {
+        fields.push_back( { "state", (double)monitor.state } );
+        fields.push_back( { "freq_est", monitor.freq_est } );
+        fields.push_back( { "phase_est", monitor.phase_est } );
+    }
+    last_samples = samples;
+    last_time = now;
+}
+
+// bytes per sample of a file format
+size_t sampleSize( sample_format_t format ) {
+    switch ( format ) {
+        case format_c32:
+            return sizeof( CSampleT<float> );
+        case format_sc16:
+            return sizeof( CSampleQ15 );
+        default:
+            return sizeof( CSample );
+    }
+}
+
+// file name extension of a format
+const char *sampleExtension( sample_format_t format ) {
+    switch ( format ) {
+        case format_c32:
+            return "c32";
+        case format_sc16:
+            return "sc16";
+        default:
+            return "c64";
+    }
+}
+
+// construct a demod with the application's settings (4 sps, alpha 0.35,
+// 256 sample windows), whichever pipeline it is.
+template <typename Demod>
+Demod makeDemod() {
+    return Demod( 0.35, 256 );
+}
+
+template <>
+BpskDemodQ15 makeDemod<BpskDemodQ15>() {
+    return BpskDemodQ15( 4, 0.35, 256 );
+}
+
+// a region the squelch let through
+struct Burst {
+    off_t first_sample;       // input sample
+    off_t sample_count;
+    off_t output_sample;      // where it starts in the output
+    double power_sum;         // block power * samples, for the mean level
+};
+
+// AGC ahead of a demod, built from the options.  Only complex float and
+// double samples have one, the sc16 pipeline passes samples through.
+template <typename T>
+struct DemodAgc {
+    DemodAgc( const AgcOptions * ) {}
+    const T *process( const T *in, T *, int ) { return in; }
+};
+
+template <typename R>
+struct DemodAgc< CSampleT<R> > {
+    std::unique_ptr< AGCT<R> > agc;
+    DemodAgc( const AgcOptions *opt ) {
+        if ( opt ) {
+            agc.reset( new AGCT<R>( opt->sample_rate, opt->target_db, opt->attack, opt->decay ) );
+        }
+    }
+    // returns where the samples to demodulate are, out if the AGC ran
+    const CSampleT<R> *process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+        if ( !agc ) {
+            return in;
+        }
+        agc->process( in, out, count );
+        return out;
+    }
+};
+
+// The complex pipeline with an equalizer stage in its loop (-e), a
+// separate type so the demod without one carries none of it.
+template <typename R>
+using EqChainBpskDemod = ChainBpskDemod< CSampleT<R>, 4, 64, EqStage< CSampleT<R> > >;
+
+// Equalizer in a demod's loop, sized from the options.  Only the
+// EqChainBpskDemod pipelines have one, the others are left as they are.
+template <typename Demod>
+void attachEqualizer( Demod &, const EqOptions * ) {}
+
+template <typename R>
+void attachEqualizer( EqChainBpskDemod<R> &demod, const EqOptions *opt ) {
+    if ( opt ) {
+        demod.Eq = EqStage< CSampleT<R> >( opt->taps, 4 );
+    }
+}
+
+// the node's shared arena for the sample buffers with -N, else none (heap)
+BufferArena *sampleArena( const DemodOptions &opt ) {
+    return opt.node >= 0 ? sharedArena( opt.node, opt.page ) : nullptr;
+}
+
+// Lock statistics for one segment of a parallel run.
+struct SegmentStats {
+    off_t first_sample;       // first sample of the segment (kept output)
+    off_t sample_count;       // samples written for this segment
+    off_t warmup_samples;     // overlap samples run and discarded ahead of it
+    int warmup_end_state;     // demod state when the first kept sample arrived
+    off_t state_samples[3];   // kept samples spent in each demod state
+    int lock_losses;          // times the demod fell out of track
+    int final_state;          // demod state after the last sample
+    double freq_est;          // final frequency estimate
+    int error;                // non-zero if file i/o failed
+    off_t idle_samples;       // kept samples the squelch skipped
+    off_t output_samples;     // samples written (fewer than sample_count with -Z)
+    std::vector<Burst> bursts; // regions the squelch passed, in order
+};
+
+// Demodulate samples [first,first+count) of the input, running an independent
+// demod over the preceding warm-up samples first so it has re-acquired lock
+// by the time the kept region starts.  Output lands at the same sample
+// offset in the output file, so segments stitch together in order.
+// progress (optional) is advanced by the number of samples processed.
+// trace (optional) records the loop, warm-up included.
+// gate (optional) squelches idle blocks, they are zeroed (or dropped) in
+// the output and the demod never sees them.
+// index (optional) gets an entry per block of the kept region, first must
+// then be a multiple of the block size.
+// agc (optional) levels the samples ahead of the demod, it carries on over
+// squelch gaps.
+// eq (optional) equalizes inside the demod loop, it starts over with the
+// loop when a squelch gap resets it.
+// arena (optional) holds the block buffers, else they are on the heap.
+// Demod picks the pipeline (and so the sample type of the files).
+template <typename Demod>
+void demodSegment( int fhi, int fho, off_t first, off_t count, long overlap, SegmentStats *st,
+                   std::atomic<long long> *progress=nullptr, TraceRecorder *trace=nullptr,
+                   const GateOptions *gate=nullptr, std::vector<IndexEntry> *index=nullptr,
+                   const AgcOptions *agc_opt=nullptr, const EqOptions *eq_opt=nullptr,
+                   BufferArena *arena=nullptr ) {
+    using sample_t = typename Demod::sample_t;
+    using buffer_t = std::vector< sample_t, ArenaAllocator<sample_t> >;
+    const int block = gate ? gate_block : demod_block;
+    ArenaAllocator<sample_t> alloc( arena );
+    buffer_t in( block, sample_t(), alloc );
+    buffer_t out( block, sample_t(), alloc );
+    buffer_t pre_in( alloc );
+    buffer_t zeros( alloc );
+    Demod demod = makeDemod<Demod>();
+    DemodAgc< sample_t > agc( agc_opt );
+    attachEqualizer( demod, eq_opt );
+    bool drop_idle = gate && gate->drop_idle;
+
+    off_t start = first - overlap;
+    if ( start < 0 ) {
+        start = 0;
+    }
+    if ( index ) {
+        // warm-up starts on a block boundary so blocks line up with entries
+        start -= start % block;
+        index->clear();
+    }
+    st->first_sample = first;
+    st->sample_count = count;
+    st->warmup_samples = first - start;
+    st->warmup_end_state = demod.state;
+    st->state_samples[0] = st->state_samples[1] = st->state_samples[2] = 0;
+    st->lock_losses = 0;
+    st->error = 0;
+    st->idle_samples = 0;
+    st->output_samples = 0;
+    st->bursts.clear();
+    if ( trace ) {
+        demod.trace.attach( trace );
+        demod.trace.sample = start;
+    }
+
+    // demodulate n samples of src, input sample at onwards, and write
+    // out the kept part.  power is the block power (only used with a gate).
+    auto run = [&]( const sample_t *src, off_t at, off_t n, double power ) -> int {
+        // output index of first kept sample in this block
+        off_t keep = 0;
+        demod.trace.sample = at;
+        // laps per block, the caller's laps don't include this
+        DSP_PROFILE_START(t);
+        // the demod reads src[idx] before out[idx] is written, so in place is fine
+        src = agc.process( src, out.data(), n );
+        DSP_PROFILE_LAP(t, "demod.agc", n);
+        for ( off_t idx=0; idx < n; ++idx ) {
+            if ( at+idx == first ) {
+                st->warmup_end_state = demod.state;
+            }
+            int last_state = demod.state;
+            out[idx] = demod.process( src[idx] );
+            if ( at+idx < first ) {
+                keep = idx+1;
+                continue;
+            }
+            st->state_samples[demod.state]++;
+            if ( last_state == BpskDemod::track && demod.state != BpskDemod::track ) {
+                st->lock_losses++;
+            }
+        }
+        DSP_PROFILE_LAP(t, "demod.loop", n);
+        if ( keep < n ) {
+            off_t out_pos = drop_idle ? st->output_samples : at + keep;
+            size_t len = (n-keep)*sizeof(out[0]);
+            if ( pwrite( fho, out.data()+keep, len, out_pos*sizeof(out[0]) ) != (ssize_t)len ) {
+                return -1;
+            }
+            DSP_PROFILE_LAP(t, "io.write", n-keep);
+            if ( drop_idle ) {
+                st->output_samples += n-keep;
+            }
+            if ( gate ) {
+                std::vector<Burst> &b = st->bursts;
+                if ( b.size() == 0 || b.back().first_sample + b.back().sample_count != at+keep ) {
+                    b.push_back( { at+keep, 0, out_pos, 0 } );
+                }
+                b.back().sample_count += n-keep;
+                b.back().power_sum += power*(n-keep);
+            }
+        }
+        return 0;
+    };
+
+    // kept samples of [from,to)
+    auto kept = [first]( off_t from, off_t to ) -> off_t {
+        from = std::max( from, first );
+        return to > from ? to - from : 0;
+    };
+
+    // index entry for the block at at, track is its samples in track
+    auto addEntry = [&]( off_t at, double power, uint16_t flags, off_t out_pos, off_t track ) {
+        IndexEntry e;
+        e.byte_offset = at*sizeof(sample_t);
+        e.output_sample = out_pos;
+        e.power_db = 10*std::log10( power + 1e-30 );
+        e.freq_est = demod.freq_est;
+        e.state = demod.state;
+        e.flags = flags | ( track > 0 ? index_locked : 0 );
+        e.track_samples = track;
+        index->push_back( e );
+    };
+
+    Squelch squelch = gate ? Squelch( gate->open_db, gate->close_db, gate->pre_roll, gate->post_roll )
+                           : Squelch( 0, 0, 0, 0 );
+    if ( gate ) {
+        pre_in.resize( block );
+    }
+    if ( gate && !drop_idle ) {
+        zeros.resize( block );
+    }
+    off_t done = start;         // end of the last demodulated sample
+    off_t pos = start;
+    off_t end = first + count;
+    while ( pos < end ) {
+        off_t n = end - pos;
+        if ( n > block ) {
+            n = block;
+        }
+        DSP_PROFILE_START(t);
+        ssize_t bytes = pread( fhi, in.data(), n*sizeof(in[0]), pos*sizeof(in[0]) );
+        if ( bytes < (ssize_t)(n*sizeof(in[0])) ) {
+            st->error = 1;
+            break;
+        }
+        DSP_PROFILE_LAP(t, "io.read", n);
+        off_t track = st->state_samples[BpskDemod::track];
+        off_t out_pos = drop_idle ? st->output_samples : pos;
+        if ( !gate ) {
+            if ( run( in.data(), pos, n, 0 ) < 0 ) {
+                st->error = 1;
+                break;
+            }
+            if ( index && pos >= first ) {
+                addEntry( pos, blockPower( in.data(), n ), index_active, out_pos,
+                          st->state_samples[BpskDemod::track] - track );
+            }
+        } else {
+            double power = blockPower( in.data(), n );
+            bool was_open = squelch.open;
+            bool open = squelch.update( power, n );
+            DSP_PROFILE_LAP(t, "demod.squelch", n);
+            if ( open ) {
+                if ( !was_open ) {
+                    // burst start, restart the loop and run the pre-roll
+                    // (samples already passed over as idle) ahead of it
+                    if ( !gate->hold ) {
+                        demod.reset();
+                    }
+                    off_t pre = std::max( pos - squelch.pre_roll, done );
+                    st->idle_samples -= kept( pre, pos );
+                    while ( pre < pos && !st->error ) {
+                        // up to the next block boundary, so each piece is in one index entry
+                        off_t m = std::min( pos - pre, (off_t)( block - pre % block ) );
+                        ssize_t len = m*sizeof(in[0]);
+                        if ( pread( fhi, pre_in.data(), len, pre*sizeof(in[0]) ) < len ) {
+                            st->error = 1;
+                            break;
+                        }
+                        off_t pre_track = st->state_samples[BpskDemod::track];
+                        off_t pre_out = drop_idle ? st->output_samples : pre;
+                        if ( run( pre_in.data(), pre, m, blockPower( pre_in.data(), m ) ) < 0 ) {
+                            st->error = 1;
+                        }
+                        if ( index && pre >= first ) {
+                            // the block went in as idle, it is active after all
+                            IndexEntry &e = (*index)[ (pre - first) / block ];
+                            if ( !( e.flags & index_active ) ) {
+                                e.output_sample = pre_out;
+                            }
+                            e.track_samples += st->state_samples[BpskDemod::track] - pre_track;
+                            e.flags |= index_active | ( e.track_samples > 0 ? index_locked : 0 );
+                            e.freq_est = demod.freq_est;
+                            e.state = demod.state;
+                        }
+                        pre += m;
+                    }
+                    track = st->state_samples[BpskDemod::track];
+                    out_pos = drop_idle ? st->output_samples : pos;
+                }
+                if ( st->error || run( in.data(), pos, n, power ) < 0 ) {
+                    st->error = 1;
+                    break;
+                }
+                if ( index && pos >= first ) {
+                    addEntry( pos, power, index_active, out_pos, st->state_samples[BpskDemod::track] - track );
+                }
+                done = pos + n;
+            } else {
+                off_t idle = kept( pos, pos+n );
+                st->idle_samples += idle;
+                if ( index && pos >= first ) {
+                    addEntry( pos, power, 0, out_pos, 0 );
+                }
+                if ( idle > 0 && !drop_idle ) {
+                    DSP_PROFILE_START(w);
+                    size_t len = idle*sizeof(out[0]);
+                    if ( pwrite( fho, zeros.data(), len, (pos+n-idle)*sizeof(out[0]) ) != (ssize_t)len ) {
+                        st->error = 1;
+                        break;
+                    }
+                    DSP_PROFILE_LAP(w, "io.write", idle);
+                }
+            }
+        }
+        if ( progress ) {
+            // kept samples only, the warm-up overlap is counted by the
+            // segment before
+            *progress += kept( pos, pos+n );
+        }
+        pos += n;
+        monitor.update( demod );
+    }
+    if ( !drop_idle ) {
+        st->output_samples = count;
+    }
+    st->final_state = demod.state;
+    st->freq_est = demod.freq_est;
+}
+
+// list the squelch bursts of a run as csv, returns -1 if it can't be written
+int writeBursts( const std::string &path, const std::vector<Burst> &bursts ) {
+    FILE *f = fopen( path.c_str(), "w" );
+    if ( !f ) {
+        std::cout << "Failed to open burst list : " << path << std::endl;
         return -1;
     }
+    fprintf( f, "first_sample,samples,output_sample,power_dbfs\n" );
+    for ( auto &b : bursts ) {
+        fprintf( f, "%ld,%ld,%ld,%.2f\n", (long)b.first_sample, (long)b.sample_count, (long)b.output_sample,
+                 10*std::log10( b.power_sum / b.sample_count + 1e-30 ) );
+    }
+    fclose( f );
+    return 0;
+}
 
-    // open input file
-    fhi = open( input_file.c_str(), O_RDONLY, 0666 );
-    if ( fhi < 1 ) {
-        std::cout << "Failed to open input file : " << input_file << std::endl;
+// one row per segment (or region), returns -1 if any hit an i/o error
+int printSegmentStatus( const std::vector<SegmentStats> &stats ) {
+    int rc = 0;
+    std::cout << "seg  first_sample   samples  warmup  state@seam  %track  lock_losses  freq_est\n";
+    for ( size_t s=0; s < stats.size(); ++s ) {
+        const SegmentStats &st = stats[s];
+        double track = st.sample_count ? (100.0*st.state_samples[BpskDemod::track])/st.sample_count : 0;
+        printf("%3d %13ld %9ld %7ld  %10s  %6.2f  %11d  %g%s\n", (int)s, (long)st.first_sample,
+               (long)st.sample_count, (long)st.warmup_samples, state_names[st.warmup_end_state],
+               track, st.lock_losses, st.freq_est, st.error ? "  (I/O ERROR)" : "");
+        if ( st.error ) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// Split the input into segments, demodulate each on its own thread and
+// report how every segment's demod came out of its warm-up region.
+template <typename Demod>
+int demodParallel( int fhi, int fho, off_t input_len, int segments, long overlap, const DemodOptions &opt ) {
+    off_t total = input_len / sizeof( typename Demod::sample_t );
+    if ( segments > total ) {
+        segments = total > 0 ? total : 1;
+    }
+    const GateOptions *gate = opt.gate.enabled ? &opt.gate : nullptr;
+    const AgcOptions *agc = opt.agc.enabled ? &opt.agc : nullptr;
+    const EqOptions *eq = opt.eq.enabled ? &opt.eq : nullptr;
+    BufferArena *arena = sampleArena( opt );
+    std::vector<int> cpus = opt.node >= 0 ? nodeCpus( opt.node ) : std::vector<int>();
+    off_t seg_len = total / segments;
+    if ( opt.write_index ) {
+        // segments start on index block boundaries
+        off_t block = gate ? gate_block : demod_block;
+        seg_len = ( ( total + segments - 1 ) / segments + block - 1 ) / block * block;
+        segments = seg_len ? ( total + seg_len - 1 ) / seg_len : 1;
+    }
+    std::vector<SegmentStats> stats(segments);
+    std::vector< std::vector<IndexEntry> > index( opt.write_index ? segments : 0 );
+    std::vector<std::thread> workers;
+    // one trace file per segment, each demod thread feeds its own ring
+    std::vector<TraceRecorder> traces( opt.trace_file.length() ? segments : 0 );
+    for ( int s=0; s < (int)traces.size(); ++s ) {
+        std::string name = opt.trace_file;
+        if ( segments > 1 ) {
+            name += "." + std::to_string(s);
+        }
+        if ( traces[s].open( name, opt.trace_every ) < 0 ) {
+            return -1;
+        }
+    }
+    for ( int s=0; s < segments; ++s ) {
+        off_t first = s*seg_len;
+        off_t count = ( s == segments-1 ) ? total-first : seg_len;
+        workers.push_back( std::thread( demodSegment<Demod>, fhi, fho, first, count, overlap, &stats[s],
+                                        &monitor.samples, traces.size() ? &traces[s] : nullptr, gate,
+                                        index.size() ? &index[s] : nullptr, agc, eq, arena ) );
+        if ( cpus.size() ) {
+            // a core each, round robin over the node
+            pinThread( workers.back(), { cpus[ s % cpus.size() ] } );
+        }
+    }
+    for ( auto &w : workers ) {
+        w.join();
+    }
+    for ( auto &t : traces ) {
+        t.close();
+        if ( t.dropped ) {
+            std::cout << "Trace ring overflowed, " << t.dropped << " records dropped\n";
+        }
+    }
+
+    std::cout << "Segment Status:\n";
+    int rc = printSegmentStatus( stats );
+    if ( index.size() ) {
+        std::vector<IndexEntry> entries;
+        for ( auto &seg : index ) {
+            entries.insert( entries.end(), seg.begin(), seg.end() );
+        }
+        if ( writeCaptureIndex( opt.output_file + ".idx", gate ? gate_block : demod_block,
+                                sizeof( typename Demod::sample_t ), entries ) < 0 ) {
+            rc = -1;
+        }
+    }
+    if ( gate ) {
+        // segments are in order, join bursts that run across a seam
+        std::vector<Burst> bursts;
+        off_t idle = 0;
+        for ( auto &st : stats ) {
+            idle += st.idle_samples;
+            for ( auto &b : st.bursts ) {
+                if ( bursts.size() && bursts.back().first_sample + bursts.back().sample_count == b.first_sample ) {
+                    bursts.back().sample_count += b.sample_count;
+                    bursts.back().power_sum += b.power_sum;
+                } else {
+                    bursts.push_back( b );
+                }
+            }
+        }
+        printf("Squelch: %d bursts, %.2f%% of the input idle\n", (int)bursts.size(), total ? (100.0*idle)/total : 0);
+        if ( opt.gate.drop_idle && ftruncate( fho, stats[0].output_samples*sizeof( typename Demod::sample_t ) ) < 0 ) {
+            rc = -1;
+        }
+        if ( writeBursts( opt.output_file + ".bursts", bursts ) < 0 ) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// Demodulate only the regions an earlier run's index flagged (active, or
+// active and locked), each with the usual warm-up ahead of it, on a work
+// pool.  Output keeps input sample offsets, everything else is zeros.
+template <typename Demod>
+int demodRegions( int fhi, int fho, off_t input_len, const DemodOptions &opt ) {
+    using sample_t = typename Demod::sample_t;
+    CaptureIndex idx;
+    if ( idx.open( opt.reprocess_index ) < 0 ) {
+        return -1;
+    }
+    if ( idx.header->sample_size != sizeof(sample_t) ) {
+        std::cout << "Index was made from " << idx.header->sample_size << " byte samples, input has "
+                  << sizeof(sample_t) << " byte samples\n";
+        return -1;
+    }
+    off_t total = input_len / sizeof(sample_t);
+    std::vector<SampleRegion> regions = idx.regions( opt.reprocess_flags, total );
+    off_t selected = 0;
+    for ( auto &r : regions ) {
+        selected += r.count;
+    }
+    printf("Reprocessing %d regions, %ld of %ld samples\n", (int)regions.size(), (long)selected, (long)total);
+    if ( ftruncate( fho, 0 ) < 0 || ftruncate( fho, total*sizeof(sample_t) ) < 0 ) {
+        std::cout << "Failed to size output file\n";
         return -1;
     }
+    const GateOptions *gate = opt.gate.enabled ? &opt.gate : nullptr;
+    const AgcOptions *agc = opt.agc.enabled ? &opt.agc : nullptr;
+    const EqOptions *eq = opt.eq.enabled ? &opt.eq : nullptr;
+    BufferArena *arena = sampleArena( opt );
+    std::vector<SegmentStats> stats( regions.size() );
+    WorkPool pool( opt.threads, opt.node );
+    for ( size_t r=0; r < regions.size(); ++r ) {
+        SegmentStats *st = &stats[r];
+        off_t first = regions[r].first;
+        off_t count = regions[r].count;
+        long overlap = opt.overlap;
+        pool.submit( [=] {
+            demodSegment<Demod>( fhi, fho, first, count, overlap, st, &monitor.samples, nullptr, gate, nullptr, agc, eq, arena );
+        } );
+    }
+    pool.wait();
+    std::cout << "Region Status:\n";
+    return printSegmentStatus( stats );
+}
+
+// one file of a batch run
+struct BatchJob {
+    std::string input;
+    std::string output;
+    off_t samples;
+    double seconds;
+    std::string error;
+    SegmentStats st;
+};
+
+// collect batch inputs from the list file and the command line,
+// expanding any glob patterns.  returns -1 if the list file can't be read.
+int expandInputs( const DemodOptions &opt, std::vector<std::string> *files ) {
+    std::vector<std::string> patterns = opt.batch_inputs;
+    if ( opt.batch_list.length() > 0 ) {
+        std::ifstream list( opt.batch_list );
+        if ( !list ) {
+            std::cout << "Failed to open batch list : " << opt.batch_list << std::endl;
+            return -1;
+        }
+        std::string line;
+        while ( std::getline( list, line ) ) {
+            if ( line.length() > 0 && line[0] != '#' ) {
+                patterns.push_back( line );
+            }
+        }
+        if ( list.bad() ) {
+            std::cout << "Failed to read batch list : " << opt.batch_list << std::endl;
+            return -1;
+        }
+    }
+    files->clear();
+    for ( auto &p : patterns ) {
+        glob_t g;
+        if ( glob( p.c_str(), GLOB_NOCHECK, nullptr, &g ) == 0 ) {
+            for ( size_t idx=0; idx < g.gl_pathc; ++idx ) {
+                files->push_back( g.gl_pathv[idx] );
+            }
+        }
+        globfree(&g);
+    }
+    return 0;
+}
 
-    // open output file
-    fho = open( output_file.c_str(), O_WRONLY | O_CREAT, 0666 );
-    if ( fho < 1 ) {
-        std::cout << "Failed to open output file : " << output_file << std::endl;
+// demodulate one whole file, memory per job is the fixed block buffers
+// inside demodSegment.
+template <typename Demod>
+void runBatchJob( BatchJob *job, std::atomic<long long> *progress, const GateOptions *gate, bool write_index,
+                  const AgcOptions *agc, const EqOptions *eq, BufferArena *arena ) {
+    auto t0 = std::chrono::steady_clock::now();
+    int fhi = open( job->input.c_str(), O_RDONLY );
+    if ( fhi < 0 ) {
+        job->error = "open input failed";
+        return;
+    }
+    int fho = open( job->output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fho < 0 ) {
+        job->error = "open output failed";
+        close(fhi);
+        return;
+    }
+    std::vector<IndexEntry> index;
+    demodSegment<Demod>( fhi, fho, 0, job->samples, 0, &job->st, progress, nullptr, gate,
+                         write_index ? &index : nullptr, agc, eq, arena );
+    if ( job->st.error ) {
+        job->error = "i/o error";
+    }
+    if ( write_index && writeCaptureIndex( job->output + ".idx", gate ? gate_block : demod_block,
+                                           sizeof( typename Demod::sample_t ), index ) < 0 ) {
+        job->error = "index write failed";
+    }
+    if ( gate && writeBursts( job->output + ".bursts", job->st.bursts ) < 0 ) {
+        job->error = "burst list write failed";
+    }
+    close(fhi);
+    close(fho);
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    job->seconds = dt.count();
+}
+
+// Demodulate every batch input on a work stealing pool, one demod per file.
+int demodBatch( const DemodOptions &opt ) {
+    std::vector<std::string> files;
+    if ( expandInputs( opt, &files ) < 0 ) {
         return -1;
     }
+    if ( files.size() == 0 ) {
+        std::cout << "No batch inputs found\n";
+        return -1;
+    }
+    std::vector<BatchJob> jobs( files.size() );
+    long long total_samples = 0;
+    for ( size_t idx=0; idx < files.size(); ++idx ) {
+        BatchJob &job = jobs[idx];
+        job.input = files[idx];
+        std::string name = job.input.substr( job.input.find_last_of('/')+1 );
+        job.output = opt.output_dir + "/" + name + ".demod." + sampleExtension( opt.format );
+        job.samples = 0;
+        job.seconds = 0;
+        job.st = SegmentStats();
+        struct stat sb;
+        if ( stat( job.input.c_str(), &sb ) == 0 ) {
+            job.samples = sb.st_size / sampleSize( opt.format );
+        }
+        total_samples += job.samples;
+    }
 
-    std::cout << "Input/Output files have been openned succesfully\n";
+    WorkPool pool( opt.threads, opt.node );
+    BufferArena *arena = sampleArena( opt );
+    std::cout << "Batch demod of " << jobs.size() << " files on " << pool.size() << " threads..\n";
+    std::atomic<long long> &progress = monitor.samples;
+    std::atomic<int> files_done(0);
+    auto t0 = std::chrono::steady_clock::now();
+    for ( auto &job : jobs ) {
+        BatchJob *j = &job;
+        sample_format_t format = opt.format;
+        const GateOptions *gate = opt.gate.enabled ? &opt.gate : nullptr;
+        bool write_index = opt.write_index;
+        const AgcOptions *agc = opt.agc.enabled ? &opt.agc : nullptr;
+        const EqOptions *eq = opt.eq.enabled ? &opt.eq : nullptr;
+        pool.submit( [j, format, gate, write_index, agc, eq, arena, &progress, &files_done] {
+            if ( format == format_sc16 ) {
+                runBatchJob<BpskDemodQ15>( j, &progress, gate, write_index, agc, eq, arena );
+            } else if ( format == format_c32 && eq ) {
+                runBatchJob< EqChainBpskDemod<float> >( j, &progress, gate, write_index, agc, eq, arena );
+            } else if ( format == format_c32 ) {
+                runBatchJob< ChainBpskDemod< CSampleT<float> > >( j, &progress, gate, write_index, agc, eq, arena );
+            } else if ( eq ) {
+                runBatchJob< EqChainBpskDemod<double> >( j, &progress, gate, write_index, agc, eq, arena );
+            } else {
+                runBatchJob< ChainBpskDemod<> >( j, &progress, gate, write_index, agc, eq, arena );
+            }
+            files_done++;
+        } );
+    }
+    // aggregate progress display
+    while ( files_done < (int)jobs.size() ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds(500) );
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+        double pct = total_samples ? (100.0*progress)/total_samples : 100.0;
+        if ( opt.stats_interval == 0 ) {
+            printf("\rprogress: %6.2f%%  files %d/%d  %.2f Msps ", pct, (int)files_done,
+                   (int)jobs.size(), progress/dt.count()/1e6);
+            fflush(stdout);
+        }
+    }
+    pool.wait();
+    std::cout << "\n\nBatch Summary:\n";
+    printf("%-40s %10s %8s %12s %9s  %s\n", "file", "samples", "%track", "freq_est", "Msps", "final state");
+    int rc = 0;
+    for ( auto &job : jobs ) {
+        if ( job.error.length() > 0 ) {
+            printf("%-40s  ERROR: %s\n", job.input.c_str(), job.error.c_str());
+            rc = -1;
+            continue;
+        }
+        double track = job.samples ? (100.0*job.st.state_samples[BpskDemod::track])/job.samples : 0;
+        double msps = job.seconds > 0 ? job.samples/job.seconds/1e6 : 0;
+        printf("%-40s %10ld %8.2f %12g %9.2f  %s\n", job.input.c_str(), (long)job.samples, track,
+               job.st.freq_est, msps, state_names[job.st.final_state]);
+    }
+    return rc;
+}
+
+// where the -N sample buffers ended up
+void reportArena( const DemodOptions &opt ) {
+    if ( opt.node >= 0 ) {
+        std::cout << "Sample buffers: " << sampleArena( opt )->describe() << std::endl;
+    }
+}
+
+// demodulate the whole input one sample at a time with BpskDemod
+template <typename R>
+int demodSerial( int fhi, int fho, bool print_status, const std::string &trace_file, int trace_every ) {
     std::cout << "Starting BPSK Carrier wipeoff..\n";
 
-    bytes_in = 1;
+    ssize_t bytes_in = 1;
 
-    BpskDemod demod(4,0.35,256);
-    CSample input;
-    CSample output;
+    BpskDemodT<R> demod(4,0.35,256);
+    TraceRecorder trace;
+    if ( trace_file.length() ) {
+        if ( trace.open( trace_file, trace_every ) < 0 ) {
+            return -1;
+        }
+        demod.trace.attach( &trace );
+    }
+    CSampleT<R> input;
+    CSampleT<R> output;
 
     // get length of input file
     off_t input_len = lseek(fhi, 0, SEEK_END);
@@ -124,7 +1160,7 @@ int main( int argc, char **argv ) {
 
     // read 1 sample from file per loop iteration
     // bytes_in = 0 when end of file is reached.
-    while ( (bytes_in = read(fhi, &input, sizeof(CSample) )) >= sizeof(CSample) ) {
+    while ( (bytes_in = read(fhi, &input, sizeof(input) )) >= (ssize_t)sizeof(input) ) {
 
         read_pos = tell(fhi);
 
@@ -132,10 +1168,14 @@ int main( int argc, char **argv ) {
         output = demod.process( input );
 
         // write output sample
-        write( fho, &output, sizeof(CSample) );
+        write( fho, &output, sizeof(input) );
+
+        if ( ( ++monitor.samples & 4095 ) == 0 ) {
+            monitor.update( demod );
+        }
 
         // status print
-        if ( demod.PhaseErrorAcc->current_win_value == demod.PhaseErrorAcc->window_size ) {
+        if ( print_status && demod.PhaseErrorAcc->current_win_value == demod.PhaseErrorAcc->window_size ) {
             if ( samp_cntr == 10 ) {
                 // compute current progress
                 progress = ((double)read_pos)/((double)input_len);
@@ -148,6 +1188,11 @@ int main( int argc, char **argv ) {
 
     }
 
+    if ( trace_file.length() ) {
+        trace.close();
+        std::cout << "Loop trace: " << trace.written << " records to " << trace_file;
+        std::cout << ", " << trace.dropped << " dropped\n";
+    }
     std::cout << "End of Run Status:\n";
     progress = ((double)read_pos)/((double)input_len);
     printDemodStatus(progress, demod);
@@ -155,4 +1200,190 @@ int main( int argc, char **argv ) {
     return 0;
 }
 
+// decimate the input down to 4 sps in blocks, then demodulate
+template <typename Demod>
+int demodDecimated( int fhi, int fho, const DemodOptions &opt ) {
+    using R = typename Demod::R;
+    DecimPlan plan;
+    if ( planDecimation( opt.decimate, &plan ) < 0 ) {
+        return -1;
+    }
+    std::cout << "Starting BPSK Carrier wipeoff, decimating by " << opt.decimate << " ("
+              << describeDecimation( plan ) << ")..\n";
+    DecimatorT<R> decim( plan );
+    Demod demod = makeDemod<Demod>();
+    if ( opt.agc.enabled ) {
+        // the AGC runs after decimation, at the output rate
+        demod.Agc = std::make_shared< AGCT<R> >( opt.agc.sample_rate / opt.decimate, opt.agc.target_db,
+                                                 opt.agc.attack, opt.agc.decay );
+    }
+    attachEqualizer( demod, opt.eq.enabled ? &opt.eq : nullptr );
+    TraceRecorder trace;
+    if ( opt.trace_file.length() ) {
+        if ( trace.open( opt.trace_file, opt.trace_every ) < 0 ) {
+            return -1;
+        }
+        demod.trace.attach( &trace );
+    }
+
+    ArenaCSampleVectorT<R> buf( demod_block*opt.decimate, CSampleT<R>(),
+                                ArenaAllocator< CSampleT<R> >( sampleArena( opt ) ) );
+    const size_t bytes = buf.size()*sizeof( CSampleT<R> );
+    char *raw = reinterpret_cast<char*>( buf.data() );
+    long long out_samples = 0;
+    // a pipe can return part of a sample, those bytes are moved to the
+    // front of the buffer and the next read completes them
+    size_t held = 0;
+    ssize_t got;
+    while ( ( got = read( fhi, raw + held, bytes - held ) ) > 0 ) {
+        size_t have = held + got;
+        int count = have / sizeof( CSampleT<R> );
+        held = have % sizeof( CSampleT<R> );
+        // out is never past in, the held bytes after the whole samples stay put
+        int n = decim.process( buf.data(), count, buf.data() );
+        demod.process_block( buf.data(), buf.data(), n );
+        if ( write( fho, buf.data(), n*sizeof( CSampleT<R> ) ) != (ssize_t)( n*sizeof( CSampleT<R> ) ) ) {
+            std::cout << "Output write failed\n";
+            return -1;
+        }
+        memmove( raw, raw + count*sizeof( CSampleT<R> ), held );
+        monitor.samples += count;
+        monitor.update( demod );
+        out_samples += n;
+    }
+    if ( got < 0 ) {
+        std::cout << "Input read failed\n";
+        return -1;
+    }
+
+    if ( opt.trace_file.length() ) {
+        trace.close();
+        std::cout << "Loop trace: " << trace.written << " records to " << opt.trace_file;
+        std::cout << ", " << trace.dropped << " dropped\n";
+    }
+    std::cout << "End of Run Status: " << monitor.samples << " samples in, " << out_samples << " out\n";
+    printDemodStatus( 1.0, demod );
+    std::cout << "Normal Exit..\n";
+    return 0;
+}
+
+int main( int argc, char **argv ) {
+    std::string input_file("");
+    std::string output_file("");
+    int fhi, fho; // file handles
+    DemodOptions opt;
+
+    if ( getOptions(argc, argv, opt) < 0 ) {
+        std::cout << "Exit..\n" << std::endl;
+        return -1;
+    }
+    // periodic stats lines, the last one is written when main returns
+    std::unique_ptr<StatsReporter> stats;
+    if ( opt.stats_interval > 0 ) {
+        // the stats lines keep the original stdout to themselves, the
+        // status text (cout and printf alike) goes to stderr from here on
+        fflush( stdout );
+        FILE *stats_out = fdopen( dup( STDOUT_FILENO ), "w" );
+        if ( !stats_out || dup2( STDERR_FILENO, STDOUT_FILENO ) < 0 ) {
+            std::cout << "Failed to set up the stats output\n";
+            return -1;
+        }
+        stats.reset( new StatsReporter( stats_out, opt.stats_format, opt.stats_interval, demodStatsFields ) );
+    }
+    if ( opt.node >= 0 ) {
+        // every thread started from here on inherits the node's cpus,
+        // the worker threads are then pinned to a core each
+        if ( pinThisThread( nodeCpus( opt.node ) ) < 0 ) {
+            std::cout << "Failed to pin to the cpus of node " << opt.node << std::endl;
+            return -1;
+        }
+        std::cout << "Running on node " << opt.node << ", " << nodeCpus( opt.node ).size() << " cpus\n";
+    }
+    if ( opt.batch() ) {
+        int rc = demodBatch( opt );
+        reportArena( opt );
+        return rc;
+    }
+    input_file = opt.input_file;
+    output_file = opt.output_file;
+    int segments = opt.segments;
+    long overlap = opt.overlap;
+
+    // open input file
+    fhi = open( input_file.c_str(), O_RDONLY, 0666 );
+    if ( fhi < 1 ) {
+        std::cout << "Failed to open input file : " << input_file << std::endl;
+        return -1;
+    }
+
+    // open output file
+    fho = open( output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fho < 1 ) {
+        std::cout << "Failed to open output file : " << output_file << std::endl;
+        return -1;
+    }
+
+    std::cout << "Input/Output files have been openned succesfully\n";
+
+    if ( opt.reprocess_index.length() > 0 ) {
+        off_t len = lseek(fhi, 0, SEEK_END);
+        int rc;
+        if ( opt.format == format_sc16 ) {
+            rc = demodRegions<BpskDemodQ15>( fhi, fho, len, opt );
+        } else if ( opt.format == format_c32 && opt.eq.enabled ) {
+            rc = demodRegions< EqChainBpskDemod<float> >( fhi, fho, len, opt );
+        } else if ( opt.format == format_c32 ) {
+            rc = demodRegions< ChainBpskDemod< CSampleT<float> > >( fhi, fho, len, opt );
+        } else if ( opt.eq.enabled ) {
+            rc = demodRegions< EqChainBpskDemod<double> >( fhi, fho, len, opt );
+        } else {
+            rc = demodRegions< ChainBpskDemod<> >( fhi, fho, len, opt );
+        }
+        reportArena( opt );
+        std::cout << ( rc == 0 ? "Normal Exit..\n" : "Exit with errors..\n" );
+        return rc;
+    }
+
+    if ( opt.decimate > 1 ) {
+        int rc;
+        if ( opt.format == format_c32 ) {
+            rc = opt.eq.enabled ? demodDecimated< EqChainBpskDemod<float> >( fhi, fho, opt )
+                                : demodDecimated< ChainBpskDemod< CSampleT<float> > >( fhi, fho, opt );
+        } else {
+            rc = opt.eq.enabled ? demodDecimated< EqChainBpskDemod<double> >( fhi, fho, opt )
+                                : demodDecimated< ChainBpskDemod<> >( fhi, fho, opt );
+        }
+        reportArena( opt );
+        return rc;
+    }
+
+    // the Q15 pipeline, the squelch, the index, the AGC and the equalizer
+    // always run through the block/segment path
+    if ( segments > 1 || opt.format == format_sc16 || opt.gate.enabled || opt.write_index || opt.agc.enabled ||
+         opt.eq.enabled ) {
+        off_t len = lseek(fhi, 0, SEEK_END);
+        std::cout << "Starting BPSK Carrier wipeoff on " << segments << " segments..\n";
+        int rc;
+        if ( opt.format == format_sc16 ) {
+            rc = demodParallel<BpskDemodQ15>( fhi, fho, len, segments, overlap, opt );
+        } else if ( opt.format == format_c32 && opt.eq.enabled ) {
+            rc = demodParallel< EqChainBpskDemod<float> >( fhi, fho, len, segments, overlap, opt );
+        } else if ( opt.format == format_c32 ) {
+            rc = demodParallel< ChainBpskDemod< CSampleT<float> > >( fhi, fho, len, segments, overlap, opt );
+        } else if ( opt.eq.enabled ) {
+            rc = demodParallel< EqChainBpskDemod<double> >( fhi, fho, len, segments, overlap, opt );
+        } else {
+            rc = demodParallel< ChainBpskDemod<> >( fhi, fho, len, segments, overlap, opt );
+        }
+        reportArena( opt );
+        std::cout << ( rc == 0 ? "Normal Exit..\n" : "Exit with errors..\n" );
+        return rc;
+    }
+
+    if ( opt.format == format_c32 ) {
+        return demodSerial<float>( fhi, fho, !stats, opt.trace_file, opt.trace_every );
+    }
+    return demodSerial<double>( fhi, fho, !stats, opt.trace_file, opt.trace_every );
+}
+
 
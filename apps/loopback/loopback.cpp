@@ -0,0 +1,323 @@
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <unistd.h>
+#include <chrono>
+#include <fcntl.h>
+#include <vector>
+#include "libdsp.hpp"
+#include "channel.hpp"
+#include "firkernel.hpp"
+#include "prbs.hpp"
+
+// End to end loopback benchmark.
+//   PRBSGEN -> BPSK map -> polyphase RRC interpolator -> channel
+//   (carrier offset/drift, phase noise, clock drift, AWGN) -> BpskDemod
+//   -> slicer -> PRBSCHK
+// Runs a sweep of Eb/N0 points and reports demod throughput next to the
+// measured BER, so a change to the demod can be checked for speed and
+// correctness in one run.  Exits non-zero if a point ends out of track or
+// (from 6 dB up) its BER is well above theory, so a short run works as a
+// regression test.
+
+void printHelp() {
+    std::cout << "BPSK Loopback Benchmark\n\n";
+    std::cout << "Modulates a PRBS pattern, passes it through a noisy channel with\n";
+    std::cout << "a carrier offset, demodulates it with BpskDemod and checks the bits.\n\n";
+    std::cout << "Program Options:\n";
+    std::cout << "   -n -- symbols per Eb/N0 point (default 1000000)\n";
+    std::cout << "   -e -- Eb/N0 sweep in dB, start:stop:step (default 0:10:2)\n";
+    std::cout << "   -f -- carrier offset, rads/sample (default 0.001)\n";
+    std::cout << "   -D -- carrier drift, rads/sample per sample (default 0)\n";
+    std::cout << "   -L -- phase noise linewidth, fraction of sample rate (default 0)\n";
+    std::cout << "   -c -- sample clock offset, ppm (default 0)\n";
+    std::cout << "   -s -- samples per symbol (default 4)\n";
+    std::cout << "   -a -- RRC rolloff (default 0.35)\n";
+    std::cout << "   -w -- demod averaging window (default 256)\n";
+    std::cout << "   -p -- pattern: pn9, pn11, pn15, pn23 (default pn23)\n";
+    std::cout << "   -S -- noise seed (default 1)\n";
+    std::cout << "   -o -- also write the channel output (c64) of every point to this file\n";
+    std::cout << "   -R -- reference receiver, known carrier and matched filter only in\n";
+    std::cout << "         place of BpskDemod (checks the harness against theory)\n";
+    std::cout << "   -x -- fail a point at or above 6 dB Eb/N0 with more than N times the\n";
+    std::cout << "         theoretical bit errors, plus one (default 10)\n";
+    std::cout << "   -h -- help message\n";
+    std::cout << std::endl;
+}
+
+// command line settings
+struct LoopbackOptions {
+    long symbols = 1000000;
+    double ebn0_start = 0;
+    double ebn0_stop = 10;
+    double ebn0_step = 2;
+    double freq_offset = 0.001;
+    double freq_drift = 0;
+    double linewidth = 0;
+    double clock_ppm = 0;
+    int sps = 4;
+    double alpha = 0.35;
+    int winsize = 256;
+    prbs_pattern_t pattern = ITU_PN23;
+    unsigned seed = 1;
+    bool reference = false;
+    double ber_factor = 10;
+    std::string capture_file;
+};
+
+// BER is only checked against theory from here up, below it acquisition
+// losses are a large part of the errors
+const double ber_check_ebn0 = 6.0;
+
+// returns 0 if parse completes, -1 if parse is incomplete.
+int getOptions( int argc, char **argv, LoopbackOptions &opt ) {
+    const char *patterns[] = { "pn9", "pn11", "pn15", "pn23" };
+    int c;
+    while (( c = getopt( argc, argv, "n:e:f:D:L:c:s:a:w:p:S:o:Rx:h") ) != -1 ) {
+        switch (c) {
+            case 'h':
+                printHelp();
+                return -1;
+            case 'n':
+                opt.symbols = atol(optarg);
+                break;
+            case 'e':
+                if ( sscanf( optarg, "%lf:%lf:%lf", &opt.ebn0_start, &opt.ebn0_stop, &opt.ebn0_step ) == 1 ) {
+                    opt.ebn0_stop = opt.ebn0_start;
+                }
+                break;
+            case 'f':
+                opt.freq_offset = atof(optarg);
+                break;
+            case 'D':
+                opt.freq_drift = atof(optarg);
+                break;
+            case 'L':
+                opt.linewidth = atof(optarg);
+                break;
+            case 'c':
+                opt.clock_ppm = atof(optarg);
+                break;
+            case 'o':
+                opt.capture_file = optarg;
+                break;
+            case 's':
+                opt.sps = atoi(optarg);
+                break;
+            case 'a':
+                opt.alpha = atof(optarg);
+                break;
+            case 'w':
+                opt.winsize = atoi(optarg);
+                break;
+            case 'p': {
+                int found = 0;
+                for ( int p=0; p < 4; ++p ) {
+                    if ( strcmp( optarg, patterns[p] ) == 0 ) {
+                        opt.pattern = (prbs_pattern_t)( ITU_PN9 + p );
+                        found = 1;
+                    }
+                }
+                if ( !found ) {
+                    std::cout << "Unknown pattern: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            }
+            case 'S':
+                opt.seed = atoi(optarg);
+                break;
+            case 'R':
+                opt.reference = true;
+                break;
+            case 'x':
+                opt.ber_factor = atof(optarg);
+                break;
+            default:
+                std::cout << "Unknown input option provided, try -h for options list.." << std::endl;
+                return -1;
+        }
+    }
+    if ( opt.sps < 2 || opt.symbols < 1 || opt.winsize < 1 || opt.ebn0_step <= 0 || opt.ber_factor <= 0 ) {
+        std::cout << "Need sps >= 2, symbols > 0, window > 0, a positive Eb/N0 step and BER factor\n";
+        return -1;
+    }
+    return 0;
+}
+
+// results of one Eb/N0 point
+struct LoopbackResult {
+    double ebn0_db;
+    double demod_secs;      // time spent in the receiver (BpskDemod::process)
+    double total_secs;      // time for the whole chain
+    long samples;           // channel output samples (clock drift changes the count)
+    uint64_t bits_locked;
+    uint64_t bit_errors;
+    uint64_t sync_slips;
+    bool inverted;          // bits came out inverted (180 degree lock)
+    int final_state;
+};
+
+// run one Eb/N0 point through the whole chain
+LoopbackResult runPoint( const LoopbackOptions &opt, double ebn0_db, int capture_fd ) {
+    const int block_syms = 4096;
+    const int block_bytes = block_syms / 8;
+    const int sps = opt.sps;
+
+    std::vector<double> rrc = computeRRC( sps, opt.alpha, 4 );
+    PRBSGEN gen( opt.pattern );
+    CInterpolator shaper( sps, rrc );
+    BpskDemod demod( sps, opt.alpha, opt.winsize );
+    // block matched filter, kernel picked by the autotuner for this host
+    std::shared_ptr<BlockFIR> matched = makeBlockFIR<double>( CSampleVector( rrc.begin(), rrc.end() ),
+                                                              block_syms*sps );
+    // the demod has a 180 degree ambiguity, check both polarities
+    PRBSCHK chk( opt.pattern );
+    PRBSCHK chk_inv( opt.pattern );
+
+    // channel, the reference receiver gets ideal carrier recovery so the
+    // carrier blocks are left out for it
+    CarrierOffset cfo( opt.freq_offset, opt.freq_drift, 0.3 );
+    PhaseNoise phase_noise( opt.linewidth, opt.seed, 1 );
+    ClockDrift clock( opt.clock_ppm );
+    AWGN awgn( AWGN::sigmaFromEbN0( ebn0_db ), opt.seed, 0 );
+    // symbol centre: transmit and receive filters each delay (taps-1)/2
+    long delay = rrc.size() - 1;
+
+    std::vector<uint8_t> tx_bytes( block_bytes );
+    std::vector<uint8_t> rx_bytes( block_bytes );
+    std::vector<uint8_t> rx_inv( block_bytes );
+    CSampleVector symbols( block_syms );
+    CSampleVector samples( block_syms*sps );
+    CSampleVector resampled;
+    long sample_idx = 0;
+    int rx_bits = 0;
+    long total_samples = 0;
+    LoopbackResult res;
+    res.ebn0_db = ebn0_db;
+    res.demod_secs = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for ( long sent=0; sent < opt.symbols; sent += block_syms ) {
+        // PRBS bits to +/-1 symbols, MSB first
+        gen.generate( tx_bytes.data(), block_bytes );
+        for ( int idx=0; idx < block_syms; ++idx ) {
+            int bit = ( tx_bytes[idx/8] >> ( 7 - idx%8 ) ) & 1;
+            symbols[idx] = CSample( bit ? -1.0 : 1.0, 0.0 );
+        }
+        shaper.process( symbols.data(), samples.data(), block_syms );
+        samples.resize( block_syms*sps );
+        if ( !opt.reference ) {
+            cfo.process( samples.data(), samples.data(), samples.size() );
+            if ( opt.linewidth > 0 ) {
+                phase_noise.process( samples.data(), samples.data(), samples.size() );
+            }
+        }
+        if ( opt.clock_ppm != 0 ) {
+            resampled.clear();
+            clock.process( samples.data(), samples.size(), &resampled );
+            samples.swap( resampled );
+        }
+        awgn.process( samples.data(), samples.data(), samples.size() );
+        if ( capture_fd >= 0 ) {
+            write( capture_fd, samples.data(), samples.size()*sizeof(CSample) );
+        }
+        auto d0 = std::chrono::steady_clock::now();
+        if ( opt.reference ) {
+            matched->process( samples.data(), samples.data(), samples.size() );
+        } else {
+            for ( auto &s: samples ) {
+                s = demod.process(s);
+            }
+        }
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - d0;
+        res.demod_secs += dt.count();
+        total_samples += samples.size();
+        // slice at the symbol centres and pack bits back into bytes
+        for ( auto &s: samples ) {
+            if ( sample_idx >= delay && ( sample_idx - delay ) % sps == 0 ) {
+                int bit = s.real() < 0;
+                uint8_t &b = rx_bytes[rx_bits/8];
+                b = ( b << 1 ) | bit;
+                rx_bits++;
+                if ( rx_bits == block_bytes*8 ) {
+                    for ( int idx=0; idx < block_bytes; ++idx ) {
+                        rx_inv[idx] = ~rx_bytes[idx];
+                    }
+                    chk.check( rx_bytes.data(), block_bytes );
+                    chk_inv.check( rx_inv.data(), block_bytes );
+                    rx_bits = 0;
+                }
+            }
+            sample_idx++;
+        }
+    }
+    std::chrono::duration<double> total = std::chrono::steady_clock::now() - t0;
+    res.total_secs = total.count();
+    res.samples = total_samples;
+    res.inverted = chk_inv.bits_rx_locked > chk.bits_rx_locked;
+    PRBSCHK &best = res.inverted ? chk_inv : chk;
+    res.bits_locked = best.bits_rx_locked;
+    res.bit_errors = best.bit_errors_detected;
+    res.sync_slips = best.sync_slips;
+    res.final_state = opt.reference ? BpskDemodState::track : demod.state;
+    return res;
+}
+
+int main( int argc, char **argv ) {
+    LoopbackOptions opt;
+    const char *state_names[] = { "acq_freq", "acq_phase", "track" };
+    if ( getOptions( argc, argv, opt ) < 0 ) {
+        std::cout << "Exit..\n" << std::endl;
+        return -1;
+    }
+    std::cout << "Loopback: " << pattern_lookup_table[opt.pattern].name << ", " << opt.symbols
+              << " symbols/point, sps " << opt.sps << ", alpha " << opt.alpha
+              << ", carrier offset " << opt.freq_offset << " rads/sample"
+              << ( opt.reference ? ", reference receiver" : "" ) << "\n\n";
+    if ( opt.reference ) {
+        // same taps and call size as runPoint(), so this is its lookup
+        std::vector<double> rrc = computeRRC( opt.sps, opt.alpha, 4 );
+        FirTuning t = tuneBlockFIR<double>( CSampleVector( rrc.begin(), rrc.end() ), 4096*opt.sps );
+        std::cout << "Matched filter kernel: " << firKernelName( t.kernel ) << " " << t.param
+                  << " (" << t.source << ")\n\n";
+    }
+    int capture_fd = -1;
+    if ( opt.capture_file.length() ) {
+        capture_fd = open( opt.capture_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+        if ( capture_fd < 0 ) {
+            std::cout << "Failed to open capture file : " << opt.capture_file << std::endl;
+            return -1;
+        }
+    }
+    printf( "%7s %10s %10s %12s %10s %12s %12s %6s %5s %10s\n", "EbN0_dB", "demod_Msps", "chain_Msps",
+            "bits_locked", "errors", "BER", "BER_theory", "slips", "inv", "state" );
+    int failed = 0;
+    for ( double ebn0 = opt.ebn0_start; ebn0 <= opt.ebn0_stop + 1e-9; ebn0 += opt.ebn0_step ) {
+        LoopbackResult r = runPoint( opt, ebn0, capture_fd );
+        double samples = r.samples;
+        double ber = r.bits_locked ? (double)r.bit_errors / r.bits_locked : NAN;
+        double theory = 0.5 * std::erfc( std::sqrt( std::pow( 10.0, ebn0 / 10.0 ) ) );
+        printf( "%7.2f %10.2f %10.2f %12llu %10llu %12.3e %12.3e %6llu %5s %10s\n", ebn0,
+                samples / r.demod_secs / 1e6, samples / r.total_secs / 1e6,
+                (unsigned long long)r.bits_locked, (unsigned long long)r.bit_errors, ber, theory,
+                (unsigned long long)r.sync_slips, r.inverted ? "yes" : "no", state_names[r.final_state] );
+        if ( r.final_state != BpskDemodState::track || r.bits_locked == 0 ) {
+            printf( "FAIL: %.2f dB, demod not in track (%s, %llu bits locked)\n", ebn0,
+                    state_names[r.final_state], (unsigned long long)r.bits_locked );
+            failed++;
+        } else if ( ebn0 >= ber_check_ebn0 - 1e-9 &&
+                    r.bit_errors > opt.ber_factor * ( theory * r.bits_locked + 1 ) ) {
+            printf( "FAIL: %.2f dB, BER %.3e is over %g x theory\n", ebn0, ber, opt.ber_factor );
+            failed++;
+        }
+        fflush( stdout );
+    }
+    if ( capture_fd >= 0 ) {
+        close( capture_fd );
+    }
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,380 @@
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "libdsp.hpp"
+#include "workpool.hpp"
+
+// Power spectrum of a capture.  The file is cut into Hann windowed,
+// overlapped segments that are FFT'd on a pool of worker threads; the
+// Welch average over the whole file goes to a text PSD and every
+// spectrogram row (the average of a few segments) to a PGM waterfall
+// and/or a binary file of float rows.  Power is in dBFS, a full scale
+// tone reads 0 dB in its bin.
+
+void printHelp() {
+    std::cout << "PSD / Spectrogram Application\n\n";
+    std::cout << "Computes the Welch averaged power spectrum of a capture and a\n";
+    std::cout << "spectrogram (waterfall) of it over time.\n\n";
+    std::cout << "Program Options:\n";
+    std::cout << "   -i -- (required) File of input complex double samples.\n";
+    std::cout << "   -f -- input is complex float (c32) samples\n";
+    std::cout << "   -q -- input is complex int16 (sc16) samples\n";
+    std::cout << "   -n -- FFT size, a power of 2 (default 1024)\n";
+    std::cout << "   -v -- segment overlap in percent (default 50)\n";
+    std::cout << "   -a -- segments averaged per spectrogram row (default 16)\n";
+    std::cout << "   -r -- sample rate in Hz for the frequency axis (default: normalized)\n";
+    std::cout << "   -o -- write the Welch PSD as text, \"frequency,dBFS\" per bin\n";
+    std::cout << "   -w -- write the spectrogram as an 8 bit PGM waterfall, one row per line\n";
+    std::cout << "   -B -- write the spectrogram as float32 dBFS rows of FFT size bins\n";
+    std::cout << "   -d -- waterfall dB range low:high (default -120:0)\n";
+    std::cout << "   -t -- worker threads (default: one per cpu)\n";
+    std::cout << "   -h -- help message\n";
+    std::cout << "Bins run from -rate/2 to +rate/2 (DC in the middle).\n";
+    std::cout << std::endl;
+}
+
+// sample file formats
+enum sample_format_t {
+    format_c64,     // complex double
+    format_c32,     // complex float (-f)
+    format_sc16     // complex int16 (-q)
+};
+
+// command line settings
+struct PsdOptions {
+    std::string input_file;
+    std::string psd_file;       // -o
+    std::string pgm_file;       // -w
+    std::string bin_file;       // -B
+    sample_format_t format = format_c64;
+    int nfft = 1024;            // -n
+    double overlap = 50;        // -v (percent)
+    int average = 16;           // -a
+    double rate = 0;            // -r
+    double db_lo = -120;        // -d
+    double db_hi = 0;
+    int threads = 0;            // -t
+};
+
+// returns 0 if parse completes, -1 if parse is incomplete.
+int getOptions( int argc, char **argv, PsdOptions &opt ) {
+    int c;
+    while (( c = getopt( argc, argv, "i:fqn:v:a:r:o:w:B:d:t:h") ) != -1 ) {
+        switch (c) {
+            case 'h':
+                printHelp();
+                return -1;
+            case 'i':
+                opt.input_file = optarg;
+                break;
+            case 'f':
+                opt.format = format_c32;
+                break;
+            case 'q':
+                opt.format = format_sc16;
+                break;
+            case 'n':
+                opt.nfft = atoi(optarg);
+                break;
+            case 'v':
+                opt.overlap = atof(optarg);
+                break;
+            case 'a':
+                opt.average = atoi(optarg);
+                break;
+            case 'r':
+                opt.rate = atof(optarg);
+                break;
+            case 'o':
+                opt.psd_file = optarg;
+                break;
+            case 'w':
+                opt.pgm_file = optarg;
+                break;
+            case 'B':
+                opt.bin_file = optarg;
+                break;
+            case 'd':
+                if ( sscanf( optarg, "%lf:%lf", &opt.db_lo, &opt.db_hi ) != 2 ) {
+                    std::cout << "Bad dB range: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 't':
+                opt.threads = atoi(optarg);
+                break;
+            default:
+                std::cout << "Unknown input option provided, try -h for options list.." << std::endl;
+                return -1;
+        }
+    }
+    if ( opt.input_file.length() == 0 ) {
+        std::cout << "Must specify input sample source (-i)\n";
+        return -1;
+    }
+    if ( opt.psd_file.length() == 0 && opt.pgm_file.length() == 0 && opt.bin_file.length() == 0 ) {
+        std::cout << "Nothing to do, give a PSD (-o), waterfall (-w) or binary (-B) output\n";
+        return -1;
+    }
+    if ( opt.nfft < 16 || ( opt.nfft & ( opt.nfft-1 ) ) != 0 ) {
+        std::cout << "FFT size (-n) must be a power of 2, 16 or more\n";
+        return -1;
+    }
+    if ( opt.overlap < 0 || opt.overlap >= 100 ) {
+        std::cout << "Overlap (-v) must be 0 to under 100 percent\n";
+        return -1;
+    }
+    if ( opt.average < 1 ) {
+        std::cout << "Segments per row (-a) must be 1 or more\n";
+        return -1;
+    }
+    if ( opt.db_hi <= opt.db_lo ) {
+        std::cout << "Waterfall dB range (-d) is empty\n";
+        return -1;
+    }
+    return 0;
+}
+
+// bytes per sample of a file format
+size_t sampleSize( sample_format_t format ) {
+    switch ( format ) {
+        case format_c32:
+            return sizeof( CSampleT<float> );
+        case format_sc16:
+            return 2*sizeof( int16_t );
+        default:
+            return sizeof( CSample );
+    }
+}
+
+// convert raw file samples to complex float
+void toFloat( sample_format_t format, const char *raw, CSampleT<float> *out, int count ) {
+    if ( format == format_c64 ) {
+        const double *v = (const double*)raw;
+        for ( int idx=0; idx < count; ++idx ) {
+            out[idx] = CSampleT<float>( v[2*idx], v[2*idx+1] );
+        }
+    } else if ( format == format_c32 ) {
+        memcpy( out, raw, count*sizeof(CSampleT<float>) );
+    } else {
+        const int16_t *v = (const int16_t*)raw;
+        for ( int idx=0; idx < count; ++idx ) {
+            out[idx] = CSampleT<float>( v[2*idx] / 32768.0f, v[2*idx+1] / 32768.0f );
+        }
+    }
+}
+
+// Everything shared by the row jobs, set up once: the window, its power
+// scale and the FFT plan (forward() only reads the plan, so one serves
+// every thread).
+struct Spectrum {
+    int nfft;
+    int hop;                        // samples between segment starts
+    std::vector<float> window;
+    double scale;                   // 1/(sum of window)^2, tone power in dBFS
+    FFTT<float> fft;
+    Spectrum( int _nfft, int _hop ) : nfft(_nfft), hop(_hop), fft(_nfft) {
+        CSampleVector w( nfft, CSample(1,0) );
+        applyCpxWindowHann( &w );
+        window.resize( nfft );
+        double sum = 0;
+        for ( int idx=0; idx < nfft; ++idx ) {
+            window[idx] = w[idx].real();
+            sum += window[idx];
+        }
+        scale = 1.0/(sum*sum);
+    }
+};
+
+// One spectrogram row, segments [first_seg, first_seg+segs) of the file.
+struct Row {
+    long first_seg;
+    int segs;
+    std::vector<double> power;      // summed |X|^2 of the segments, fft order
+    int error;
+};
+
+// read the samples under a row and sum the power spectra of its segments
+void computeRow( int fd, sample_format_t format, const Spectrum &sp, Row *row ) {
+    size_t ss = sampleSize( format );
+    int span = ( row->segs-1 )*sp.hop + sp.nfft;
+    std::vector<char> raw( span*ss );
+    std::vector< CSampleT<float> > samples( span );
+    std::vector< CSampleT<float> > seg( sp.nfft );
+    off_t at = (off_t)row->first_seg*sp.hop*ss;
+    size_t got = 0;
+    while ( got < raw.size() ) {
+        ssize_t n = pread( fd, raw.data()+got, raw.size()-got, at+got );
+        if ( n <= 0 ) {
+            row->error = 1;
+            return;
+        }
+        got += n;
+    }
+    toFloat( format, raw.data(), samples.data(), span );
+    row->power.assign( sp.nfft, 0 );
+    for ( int s=0; s < row->segs; ++s ) {
+        const CSampleT<float> *x = &samples[s*sp.hop];
+        for ( int idx=0; idx < sp.nfft; ++idx ) {
+            seg[idx] = x[idx] * sp.window[idx];
+        }
+        // forward() is const, the workers share one plan
+        sp.fft.forward( seg.data() );
+        for ( int idx=0; idx < sp.nfft; ++idx ) {
+            row->power[idx] += std::norm( seg[idx] );
+        }
+    }
+    row->error = 0;
+}
+
+// average power of a row in dBFS, DC moved to the middle
+void rowDb( const Spectrum &sp, const std::vector<double> &power, double segs, std::vector<float> *db ) {
+    int half = sp.nfft/2;
+    db->resize( sp.nfft );
+    for ( int idx=0; idx < sp.nfft; ++idx ) {
+        double p = power[ ( idx + half ) % sp.nfft ] * sp.scale / segs;
+        (*db)[idx] = 10*std::log10( p + 1e-30 );
+    }
+}
+
+int main( int argc, char **argv ) {
+    PsdOptions opt;
+    if ( getOptions( argc, argv, opt ) < 0 ) {
+        std::cout << "Exit..\n" << std::endl;
+        return -1;
+    }
+
+    int fd = open( opt.input_file.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        std::cout << "Failed to open input file : " << opt.input_file << std::endl;
+        return -1;
+    }
+    struct stat sb;
+    fstat( fd, &sb );
+    long total = sb.st_size / sampleSize( opt.format );
+    int hop = (int)( opt.nfft * ( 1 - opt.overlap/100 ) );
+    if ( hop < 1 ) {
+        hop = 1;
+    }
+    if ( total < opt.nfft ) {
+        std::cout << "Input is shorter than one FFT (" << total << " samples)\n";
+        return -1;
+    }
+    long segments = ( total - opt.nfft ) / hop + 1;
+    long rows = ( segments + opt.average - 1 ) / opt.average;
+    Spectrum sp( opt.nfft, hop );
+
+    FILE *pgm = nullptr;
+    FILE *bin = nullptr;
+    if ( opt.pgm_file.length() ) {
+        pgm = fopen( opt.pgm_file.c_str(), "wb" );
+        if ( !pgm ) {
+            std::cout << "Failed to open waterfall file : " << opt.pgm_file << std::endl;
+            return -1;
+        }
+        fprintf( pgm, "P5\n%d %ld\n255\n", opt.nfft, rows );
+    }
+    if ( opt.bin_file.length() ) {
+        bin = fopen( opt.bin_file.c_str(), "wb" );
+        if ( !bin ) {
+            std::cout << "Failed to open binary spectrogram file : " << opt.bin_file << std::endl;
+            return -1;
+        }
+    }
+
+    std::cout << "Spectrum of " << total << " samples: " << segments << " segments of " << opt.nfft
+              << ", hop " << hop << ", " << rows << " rows\n";
+    WorkPool pool( opt.threads );
+    // rows go out in batches, a few per worker, written in order
+    const int batch = 4*pool.size();
+    std::vector<Row> pending( batch );
+    std::vector<double> welch( opt.nfft, 0 );
+    std::vector<float> db;
+    std::vector<uint8_t> pixels( opt.nfft );
+    int rc = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for ( long r0=0; r0 < rows && rc == 0; r0 += batch ) {
+        int n = (int)std::min( (long)batch, rows - r0 );
+        for ( int idx=0; idx < n; ++idx ) {
+            Row *row = &pending[idx];
+            row->first_seg = ( r0+idx )*opt.average;
+            row->segs = (int)std::min( (long)opt.average, segments - row->first_seg );
+            sample_format_t format = opt.format;
+            pool.submit( [fd, format, &sp, row] {
+                computeRow( fd, format, sp, row );
+            } );
+        }
+        pool.wait();
+        for ( int idx=0; idx < n; ++idx ) {
+            Row &row = pending[idx];
+            if ( row.error ) {
+                std::cout << "Read failed at segment " << row.first_seg << std::endl;
+                rc = -1;
+                break;
+            }
+            for ( int k=0; k < opt.nfft; ++k ) {
+                welch[k] += row.power[k];
+            }
+            if ( pgm || bin ) {
+                rowDb( sp, row.power, row.segs, &db );
+            }
+            if ( bin && fwrite( db.data(), sizeof(float), db.size(), bin ) != db.size() ) {
+                std::cout << "Write failed on binary spectrogram file : " << opt.bin_file << std::endl;
+                rc = -1;
+                break;
+            }
+            if ( pgm ) {
+                for ( int k=0; k < opt.nfft; ++k ) {
+                    double v = 255*( db[k] - opt.db_lo )/( opt.db_hi - opt.db_lo );
+                    pixels[k] = (uint8_t)( v < 0 ? 0 : ( v > 255 ? 255 : v ) );
+                }
+                if ( fwrite( pixels.data(), 1, pixels.size(), pgm ) != pixels.size() ) {
+                    std::cout << "Write failed on waterfall file : " << opt.pgm_file << std::endl;
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+    }
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    close( fd );
+    // buffered writes can still fail at close
+    if ( pgm && fclose( pgm ) != 0 ) {
+        std::cout << "Failed to close waterfall file : " << opt.pgm_file << std::endl;
+        rc = -1;
+    }
+    if ( bin && fclose( bin ) != 0 ) {
+        std::cout << "Failed to close binary spectrogram file : " << opt.bin_file << std::endl;
+        rc = -1;
+    }
+
+    if ( rc == 0 && opt.psd_file.length() ) {
+        FILE *out = fopen( opt.psd_file.c_str(), "w" );
+        if ( !out ) {
+            std::cout << "Failed to open PSD file : " << opt.psd_file << std::endl;
+            return -1;
+        }
+        rowDb( sp, welch, segments, &db );
+        double rate = opt.rate > 0 ? opt.rate : 1.0;
+        for ( int k=0; k < opt.nfft; ++k ) {
+            fprintf( out, "%.9g,%.3f\n", rate*( k - opt.nfft/2 )/opt.nfft, db[k] );
+        }
+        if ( fclose( out ) != 0 ) {
+            std::cout << "Failed to close PSD file : " << opt.psd_file << std::endl;
+            rc = -1;
+        }
+    }
+    double mb = (double)total*sampleSize( opt.format )/1e6;
+    printf("%.2f s, %.2f Msps, %.1f MB/s on %d threads\n", dt.count(), total/dt.count()/1e6,
+           mb/dt.count(), pool.size());
+    std::cout << ( rc == 0 ? "Normal Exit..\n" : "Exit with errors..\n" );
+    return rc;
+}
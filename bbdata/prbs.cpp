@@ -1,15 +1,36 @@
 #include "prbs.hpp"
 #include <cmath>
+#include <algorithm>
+#include <thread>
 
 // utility methods
 
 // __INTERNAL__
 // returns number of 1's set in a 64 bit number
 int popcount64(uint64_t y) {
+#if defined(__GNUC__)
+  return __builtin_popcountll(y);
+#else
   y -= ((y >> 1) & 0x5555555555555555ull);
   y = (y & 0x3333333333333333ull) + (y >> 2 & 0x3333333333333333ull);
   int r = ((y + (y >> 4)) & 0xf0f0f0f0f0f0f0full) * 0x101010101010101ull >> 56;
   return r;
+#endif
+}
+
+// __INTERNAL__
+// number of leading zero bits in a non zero 64 bit number
+int count_leading_zeros64(uint64_t y) {
+#if defined(__GNUC__)
+  return __builtin_clzll(y);
+#else
+  int n = 0;
+  while ( ( y & 0x8000000000000000ull ) == 0 ) {
+    y = y << 1;
+    n++;
+  }
+  return n;
+#endif
 }
 
 // __INTERNAL__
@@ -25,21 +46,117 @@ uint8_t flipbitorder(uint8_t b) {
 
 uint64_t TAP(int bit_idx) { return (1 << bit_idx - 1); }
 
+bool PRBSLeapTable::build( uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits,
+                           prbs_leap_output_t _output ) {
+    reg_mask = _reg_mask;
+    fb_mask = _fb_mask;
+    reg_len_bits = _reg_len_bits;
+    output = _output;
+    chunks = 0;
+    bits.clear();
+    next.clear();
+    if ( reg_len_bits == 0 || reg_len_bits > 64 ) {
+        return false;
+    }
+    int nchunks = ( reg_len_bits + 7 ) / 8;
+    bits.resize( nchunks*256 );
+    next.resize( nchunks*256 );
+    // run 64 steps from every single byte register value, superposition
+    // of these gives the result for any register value.
+    for ( int c=0; c < nchunks; ++c ) {
+        for ( int v=0; v < 256; ++v ) {
+            uint64_t r = ( (uint64_t)v << (8*c) ) & reg_mask;
+            uint64_t out = 0;
+            for ( int b=0; b < 64; ++b ) {
+                uint64_t nr = prbs_step( r, reg_mask, fb_mask );
+                uint64_t bit;
+                if ( output == LEAP_OUTPUT_MSB ) {
+                    bit = ( r >> ( reg_len_bits-1 ) ) & 1;
+                } else {
+                    bit = popcount64( r & fb_mask ) & 1;
+                }
+                out = ( out << 1 ) | bit;
+                r = nr;
+            }
+            bits[ c*256+v ] = out;
+            next[ c*256+v ] = r;
+        }
+    }
+    chunks = nchunks;
+    return true;
+}
+
+// multiply a GF(2) matrix (64 columns) by a register value
+static uint64_t applyGF2( const uint64_t *m, uint64_t v ) {
+    uint64_t r = 0;
+    for ( int j=0; v != 0; ++j, v >>= 1 ) {
+        if ( v & 1 ) {
+            r ^= m[j];
+        }
+    }
+    return r;
+}
+
+void PRBSJump::build( uint64_t _reg_mask, uint64_t _fb_mask ) {
+    reg_mask = _reg_mask;
+    fb_mask = _fb_mask;
+    pow2.assign( 64*64, 0 );
+    // M, column j is one step from register bit j alone
+    for ( int j=0; j < 64; ++j ) {
+        pow2[j] = prbs_step( ( (uint64_t)1 << j ) & reg_mask, reg_mask, fb_mask );
+    }
+    // M^(2^k) = M^(2^(k-1)) * M^(2^(k-1))
+    for ( int k=1; k < 64; ++k ) {
+        const uint64_t *prev = &pow2[ (k-1)*64 ];
+        for ( int j=0; j < 64; ++j ) {
+            pow2[ k*64+j ] = applyGF2( prev, prev[j] );
+        }
+    }
+}
+
+uint64_t PRBSJump::advance( uint64_t reg, uint64_t nbits ) const {
+    reg = reg & reg_mask;
+    for ( int k=0; nbits != 0; ++k, nbits >>= 1 ) {
+        if ( nbits & 1 ) {
+            reg = applyGF2( &pow2[ k*64 ], reg );
+        }
+    }
+    return reg;
+}
+
+// number of worker threads to use, 0 means one per cpu
+static int threadCount( int threads ) {
+    if ( threads > 0 ) {
+        return threads;
+    }
+    return std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+// split len bytes into at most threads slices of whole 64 bit words
+static size_t sliceSize( size_t len, int threads ) {
+    size_t slice = ( ( len / threads ) + 7 ) & ~(size_t)7;
+    return slice > 0 ? slice : len;
+}
+
 PRBSGEN::PRBSGEN( prbs_pattern_t pat ) {
     pattern_table_entry_t e = pattern_lookup_table[ pat ];
     bits_tx = 0;
     reg = e.reg;
+    reg_start = e.reg;
     reg_mask = e.reg_mask;
     fb_mask = e.fb_mask;
     reg_len_bits = e.reg_len_bits;
+    leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_MSB );
 }
 
 PRBSGEN::PRBSGEN( uint64_t _reg, uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits ) {
     bits_tx = 0;
     reg = _reg;
+    reg_start = _reg;
     reg_mask = _reg_mask;
     fb_mask = _fb_mask;
     reg_len_bits = _reg_len_bits;
+    leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_MSB );
 }
 
 void PRBSGEN::generate( std::vector<uint8_t> *buffer ) {
@@ -48,6 +165,72 @@ void PRBSGEN::generate( std::vector<uint8_t> *buffer ) {
 }
 
 void PRBSGEN::generate( uint8_t *buffer, int len) {
+  // register parameters are public, rebuild if someone changed them.
+  if ( !leap.matches( reg_mask, fb_mask, reg_len_bits ) ) {
+    if ( !leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_MSB ) ) {
+      generate_serial( buffer, len );
+      return;
+    }
+  }
+  uint8_t *bptr = buffer;
+  int words = len / 8;
+  // 64 bits per step, written out MSB (first bit) first.
+  for (int idx = 0; idx < words; ++idx) {
+    uint64_t w = leap.step( reg );
+    for (int b = 0; b < 8; ++b) {
+      bptr[b] = (uint8_t)( w >> ( 56 - 8*b ) );
+    }
+    bptr += 8;
+  }
+  // finish any trailing bytes a bit at a time.
+  generate_serial( bptr, len - words*8 );
+}
+
+void PRBSGEN::jump( uint64_t nbits ) {
+    if ( !jumper.matches( reg_mask, fb_mask ) ) {
+        jumper.build( reg_mask, fb_mask );
+    }
+    reg = jumper.advance( reg, nbits );
+}
+
+void PRBSGEN::seek( uint64_t nbit ) {
+    reg = reg_start;
+    jump( nbit );
+}
+
+// generate() for lengths past the int range
+static void generateLarge( PRBSGEN *gen, uint8_t *buffer, size_t len ) {
+    while ( len > 0 ) {
+        int piece = (int)std::min( len, (size_t)1 << 30 );
+        gen->generate( buffer, piece );
+        buffer += piece;
+        len -= piece;
+    }
+}
+
+void PRBSGEN::generate_mt( uint8_t *buffer, size_t len, int threads ) {
+    if ( !jumper.matches( reg_mask, fb_mask ) ) {
+        jumper.build( reg_mask, fb_mask );
+    }
+    size_t slice = sliceSize( len, threadCount( threads ) );
+    std::vector<PRBSGEN> gens;
+    for ( size_t start = 0; start < len; start += slice ) {
+        gens.push_back( *this );
+        gens.back().reg = jumper.advance( reg, start*8 );
+    }
+    std::vector<std::thread> workers;
+    for ( size_t s = 0; s < gens.size(); ++s ) {
+        size_t start = s*slice;
+        workers.push_back( std::thread( generateLarge, &gens[s], buffer+start,
+                                        std::min( slice, len-start ) ) );
+    }
+    for ( auto &w : workers ) {
+        w.join();
+    }
+    reg = jumper.advance( reg, len*8 );
+}
+
+void PRBSGEN::generate_serial( uint8_t *buffer, int len) {
   uint8_t *bptr;
   bptr = buffer; // initialize to buffer ptr
   uint8_t wb;    // working byte
@@ -93,12 +276,14 @@ PRBSCHK::PRBSCHK( prbs_pattern_t pat ) {
     bits_rx_locked = 0;
     bit_errors_detected = 0;
     reg = e.reg;
+    reg_start = e.reg;
     reg_mask = e.reg_mask;
     fb_mask = e.fb_mask;
     reg_len_bits = e.reg_len_bits;
     isLocked = 0;
     sync_slips = 0;
     __bit_match = 0;
+    leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_FEEDBACK );
 }
 
 PRBSCHK::PRBSCHK( uint64_t _reg, uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits ) {
@@ -106,12 +291,14 @@ PRBSCHK::PRBSCHK( uint64_t _reg, uint64_t _reg_mask, uint64_t _fb_mask, uint64_t
     bits_rx_locked = 0;
     bit_errors_detected = 0;
     reg = _reg;
+    reg_start = _reg;
     reg_mask = _reg_mask;
     fb_mask = _fb_mask;
     reg_len_bits = _reg_len_bits;
     isLocked = 0;
     sync_slips = 0;
     __bit_match = 0;
+    leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_FEEDBACK );
 }
 
 void PRBSCHK::check( std::vector<uint8_t> *buffer ) {
@@ -120,6 +307,140 @@ void PRBSCHK::check( std::vector<uint8_t> *buffer ) {
 }
 
 void PRBSCHK::check( uint8_t *buffer, int len) {
+  // register parameters are public, rebuild if someone changed them.
+  if ( !leap.matches( reg_mask, fb_mask, reg_len_bits ) ) {
+    if ( !leap.build( reg_mask, fb_mask, reg_len_bits, LEAP_OUTPUT_FEEDBACK ) ) {
+      check_serial( buffer, len );
+      return;
+    }
+  }
+  int idx = 0;
+  while ( idx < len ) {
+    if ( isLocked == 1 && len - idx >= 8 ) {
+      // locked: compare 64 received bits against the expected sequence.
+      uint64_t rx = 0;
+      for (int b = 0; b < 8; ++b) {
+        rx = ( rx << 8 ) | buffer[idx+b];
+      }
+      uint64_t saved_reg = reg;
+      uint64_t expected = leap.step( reg );
+      uint64_t diff = rx ^ expected;
+      // walk the error positions to track the lock threshold exactly as the
+      // serial path would: each match decrements (floor 0), each error increments.
+      double bit_match = __bit_match;
+      int consumed = 0;
+      bool lost = false;
+      while ( consumed < 64 ) {
+        uint64_t rest = diff << consumed;
+        int run = ( rest == 0 ) ? 64 - consumed : count_leading_zeros64( rest );
+        bit_match = ( bit_match > run ) ? bit_match - run : 0;
+        consumed += run;
+        if ( consumed == 64 ) {
+          break;
+        }
+        bit_match++;
+        consumed++;
+        if ( bit_match > (reg_len_bits*4) ) {
+          lost = true;
+          break;
+        }
+      }
+      if ( !lost ) {
+        bits_rx += 64;
+        bits_rx_locked += 64;
+        bit_errors_detected += popcount64( diff );
+        __bit_match = bit_match;
+      } else {
+        // lock lost inside this word, replay it bit by bit
+        reg = saved_reg;
+        check_serial( buffer+idx, 8 );
+      }
+      idx += 8;
+    } else {
+      // searching for sync (or tail bytes), one byte at a time
+      check_serial( buffer+idx, 1 );
+      idx += 1;
+    }
+  }
+}
+
+void PRBSCHK::seek( uint64_t nbit ) {
+    if ( nbit < reg_len_bits ) {
+        // not enough pattern history yet, sync on the data instead
+        reg = reg_start;
+        isLocked = 0;
+        __bit_match = 0;
+        return;
+    }
+    if ( !jumper.matches( reg_mask, fb_mask ) ) {
+        jumper.build( reg_mask, fb_mask );
+    }
+    // a locked checker holds the last reg_len_bits received, which is the
+    // generator register reg_len_bits earlier.
+    reg = jumper.advance( reg_start, nbit - reg_len_bits );
+    isLocked = 1;
+    __bit_match = 0;
+}
+
+// check() for lengths past the int range
+static void checkLarge( PRBSCHK *chk, uint8_t *buffer, size_t len ) {
+    while ( len > 0 ) {
+        int piece = (int)std::min( len, (size_t)1 << 30 );
+        chk->check( buffer, piece );
+        buffer += piece;
+        len -= piece;
+    }
+}
+
+void PRBSCHK::check_mt( uint8_t *buffer, size_t len, int threads ) {
+    // find sync on this thread first
+    size_t idx = 0;
+    while ( isLocked == 0 && idx < len ) {
+        check( buffer+idx, 1 );
+        idx++;
+    }
+    if ( idx == len ) {
+        return;
+    }
+    if ( !jumper.matches( reg_mask, fb_mask ) ) {
+        jumper.build( reg_mask, fb_mask );
+    }
+    size_t rest = len - idx;
+    size_t slice = sliceSize( rest, threadCount( threads ) );
+    // every slice starts locked at its position in the pattern
+    std::vector<PRBSCHK> chks;
+    for ( size_t start = 0; start < rest; start += slice ) {
+        chks.push_back( *this );
+        PRBSCHK &c = chks.back();
+        c.bits_rx = 0;
+        c.bits_rx_locked = 0;
+        c.bit_errors_detected = 0;
+        c.sync_slips = 0;
+        c.isLocked = 1;
+        c.__bit_match = ( start == 0 ) ? __bit_match : 0;
+        c.reg = jumper.advance( reg, start*8 );
+    }
+    std::vector<std::thread> workers;
+    for ( size_t s = 0; s < chks.size(); ++s ) {
+        size_t start = s*slice;
+        workers.push_back( std::thread( checkLarge, &chks[s], buffer+idx+start,
+                                        std::min( slice, rest-start ) ) );
+    }
+    for ( auto &w : workers ) {
+        w.join();
+    }
+    for ( auto &c : chks ) {
+        bits_rx += c.bits_rx;
+        bits_rx_locked += c.bits_rx_locked;
+        bit_errors_detected += c.bit_errors_detected;
+        sync_slips += c.sync_slips;
+    }
+    isLocked = chks.back().isLocked;
+    __bit_match = chks.back().__bit_match;
+    reg = chks.back().reg;
+}
+
+void PRBSCHK::check_serial( uint8_t *buffer, int len) {
   uint8_t *bptr;
   bptr = buffer; // initialize to buffer ptr
   uint8_t bitin=0;  // working bit.
@@ -217,6 +538,190 @@ void PRBSCHK::reset_stats() {
 }
 
 
+// __INTERNAL__
+// buffer as a stream of 64 bit words, first bit in the MSB of word 0,
+// optionally with the bits of every byte reversed.
+static std::vector<uint64_t> packBits( const uint8_t *buffer, int len, bool reverse ) {
+    std::vector<uint64_t> words( ( len + 7 ) / 8, 0 );
+    for ( int idx=0; idx < len; ++idx ) {
+        uint8_t b = reverse ? flipbitorder( buffer[idx] ) : buffer[idx];
+        words[ idx/8 ] |= (uint64_t)b << ( 56 - 8*(idx % 8) );
+    }
+    return words;
+}
+
+// __INTERNAL__
+// stream bits [first, first+count) as a register value, first bit in the MSB
+static uint64_t streamBits( const std::vector<uint64_t> &words, uint64_t first, int count ) {
+    uint64_t v = 0;
+    for ( int b=0; b < count; ++b ) {
+        uint64_t g = first + b;
+        v = ( v << 1 ) | ( ( words[ g/64 ] >> ( 63 - g%64 ) ) & 1 );
+    }
+    return v;
+}
+
+prbs_detect_result_t prbs_detect( const uint8_t *buffer, int len ) {
+    prbs_detect_result_t r;
+    r.pattern = USER;
+    r.inverted = false;
+    r.bit_reversed = false;
+    r.alignment = 0;
+    r.phase = 0;
+    r.error_rate = 1.0;
+    if ( len <= 0 ) {
+        return r;
+    }
+
+    // fixed patterns first, they satisfy every recurrence
+    bool same = true;
+    for ( int idx=1; idx < len; ++idx ) {
+        same = same && buffer[idx] == buffer[0];
+    }
+    if ( same && ( buffer[0] == 0x00 || buffer[0] == 0xFF ) ) {
+        r.pattern = ( buffer[0] == 0x00 ) ? ALL_ZEROS : ALL_ONES;
+        r.error_rate = 0;
+        return r;
+    }
+    if ( same && ( buffer[0] == 0xAA || buffer[0] == 0x55 ) ) {
+        r.pattern = ALT_ONE_ZERO;
+        r.phase = ( buffer[0] == 0xAA ) ? 0 : 1;
+        r.error_rate = 0;
+        return r;
+    }
+
+    // LFSR patterns, one candidate per (pattern, bit order)
+    struct candidate_t {
+        prbs_pattern_t pattern;
+        bool reversed;
+        int taps[64];
+        int ntaps;
+        int span;               // longest tap, first valid check position
+        uint64_t checks;
+        uint64_t ones;
+    };
+    std::vector<candidate_t> cands;
+    for ( int p = ITU_PN9; p <= ITU_PN23; ++p ) {
+        for ( int rev = 0; rev < 2; ++rev ) {
+            candidate_t c;
+            c.pattern = (prbs_pattern_t)p;
+            c.reversed = rev;
+            c.ntaps = 0;
+            c.span = 0;
+            c.checks = 0;
+            c.ones = 0;
+            for ( int b=0; b < 64; ++b ) {
+                if ( pattern_lookup_table[p].fb_mask & ( (uint64_t)1 << b ) ) {
+                    c.taps[ c.ntaps++ ] = b+1;
+                    c.span = b+1;
+                }
+            }
+            cands.push_back( c );
+        }
+    }
+
+    std::vector<uint64_t> streams[2] = { packBits( buffer, len, false ), packBits( buffer, len, true ) };
+    uint64_t total_bits = (uint64_t)len * 8;
+    size_t nwords = streams[0].size();
+    // syndrome bits per word, kept for working out the alignment later
+    std::vector< std::vector<uint64_t> > syndromes( cands.size(), std::vector<uint64_t>( nwords ) );
+    uint64_t delayed[2][64];
+    for ( size_t w=0; w < nwords; ++w ) {
+        // stream delayed by 1..63 bits, shared by every candidate
+        for ( int rev = 0; rev < 2; ++rev ) {
+            uint64_t cur = streams[rev][w];
+            uint64_t prev = ( w > 0 ) ? streams[rev][w-1] : 0;
+            delayed[rev][0] = cur;
+            for ( int d=1; d < 64; ++d ) {
+                delayed[rev][d] = ( cur >> d ) | ( prev << ( 64-d ) );
+            }
+        }
+        // bits of this word that are inside the buffer
+        uint64_t valid = ~(uint64_t)0;
+        if ( (w+1)*64 > total_bits ) {
+            valid = valid << ( (w+1)*64 - total_bits );
+        }
+        for ( size_t c=0; c < cands.size(); ++c ) {
+            candidate_t &cand = cands[c];
+            const uint64_t *dl = delayed[ cand.reversed ];
+            uint64_t syn = dl[0];
+            for ( int t=0; t < cand.ntaps; ++t ) {
+                syn ^= dl[ cand.taps[t] ];
+            }
+            // positions before the longest tap have no history
+            uint64_t v = valid;
+            if ( w*64 < (uint64_t)cand.span ) {
+                v &= ~(uint64_t)0 >> ( cand.span - w*64 );
+            }
+            syndromes[c][w] = syn & v;
+            cand.checks += popcount64( v );
+            cand.ones += popcount64( syn & v );
+        }
+    }
+
+    // best candidate is the one whose recurrence holds most often, either
+    // polarity.  An odd number of terms in the check flips the syndrome
+    // to all ones for complemented data.
+    int best = -1;
+    for ( size_t c=0; c < cands.size(); ++c ) {
+        if ( cands[c].checks == 0 ) {
+            continue;
+        }
+        uint64_t errs = std::min( cands[c].ones, cands[c].checks - cands[c].ones );
+        double rate = (double)errs / cands[c].checks;
+        if ( rate < r.error_rate ) {
+            r.error_rate = rate;
+            best = c;
+        }
+    }
+    if ( best < 0 || r.error_rate > 0.25 ) {
+        return r;
+    }
+    candidate_t &cand = cands[best];
+    const pattern_table_entry_t &e = pattern_lookup_table[ cand.pattern ];
+    r.pattern = cand.pattern;
+    r.bit_reversed = cand.reversed;
+    r.inverted = ( cand.ones*2 > cand.checks ) && ( cand.ntaps % 2 == 0 );
+
+    // alignment: start of the first error free run of 4 register lengths.
+    // a check at position m covers bits m-span..m, so the run start less
+    // span is the first bit the pattern explains.
+    uint64_t flip = ( cand.ones*2 > cand.checks ) ? ~(uint64_t)0 : 0;
+    uint64_t run = 0;
+    uint64_t run_start = cand.span;
+    bool found = false;
+    for ( uint64_t m = cand.span; m < total_bits && !found; ++m ) {
+        bool err = ( ( syndromes[best][ m/64 ] ^ flip ) >> ( 63 - m%64 ) ) & 1;
+        if ( err ) {
+            run = 0;
+            run_start = m+1;
+        } else if ( ++run >= e.reg_len_bits*4 ) {
+            found = true;
+        }
+    }
+    if ( !found ) {
+        return r;
+    }
+    r.alignment = run_start - cand.span;
+
+    // phase: walk the pattern from its start value to the register the
+    // stream holds at the alignment point.
+    uint64_t target = streamBits( streams[ cand.reversed ], r.alignment, e.reg_len_bits );
+    if ( r.inverted ) {
+        target = ~target & e.reg_mask;
+    }
+    uint64_t gen = e.reg;
+    uint64_t period = ( (uint64_t)1 << e.reg_len_bits ) - 1;
+    for ( uint64_t n = 0; n < period; ++n ) {
+        if ( gen == target ) {
+            r.phase = n;
+            break;
+        }
+        gen = prbs_step( gen, e.reg_mask, e.fb_mask );
+    }
+    return r;
+}
+
 // Print buffer contents as a hex dump display to the screen.
 // print std::vector<uint8_t> contents
 void PrintDataBuffer( std::vector<uint8_t> buffer ) {
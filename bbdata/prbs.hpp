@@ -18,12 +18,78 @@ enum prbs_pattern_t {
 
 // utility methods
 int popcount64(uint64_t x);
+int count_leading_zeros64(uint64_t x);
 uint8_t flipbitorder(uint8_t b);
 uint64_t TAP(int bit_idx);
 void PrintDataBuffer( std::vector<uint8_t> buffer );
 void PrintDataBuffer( uint8_t *mem, int len );
 
 
+// advance a PRBS register one bit, feedback is the XOR of the tapped bits
+inline uint64_t prbs_step( uint64_t reg, uint64_t reg_mask, uint64_t fb_mask ) {
+    return ( ( reg << 1 ) | ( popcount64( reg & fb_mask ) & 1 ) ) & reg_mask;
+}
+
+// which bit a leap table reports for each step
+enum prbs_leap_output_t {
+  LEAP_OUTPUT_MSB = 0,      // top register bit before the shift (generator output)
+  LEAP_OUTPUT_FEEDBACK = 1  // feedback bit shifted in (checker expected bit)
+};
+
+// Leap forward tables for a PRBS register.
+// Stepping the register is linear over GF(2), so the 64 bits produced and
+// the register value 64 steps later are the XOR of independent
+// contributions from each byte of the current register.  Those are
+// precomputed per byte position, one step() then does 64 bits.
+struct PRBSLeapTable {
+    // parameters the tables were built for
+    uint64_t reg_mask;
+    uint64_t fb_mask;
+    uint64_t reg_len_bits;
+    prbs_leap_output_t output;
+    int chunks;                 // bytes of register covered
+    std::vector<uint64_t> bits; // [chunk*256+byte] 64 output bits, first bit in the MSB
+    std::vector<uint64_t> next; // [chunk*256+byte] register after 64 steps
+    PRBSLeapTable() : reg_mask(0), fb_mask(0), reg_len_bits(0), output(LEAP_OUTPUT_MSB), chunks(0) {}
+    // (re)build tables, returns false if the register can't be leapt
+    bool build( uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits, prbs_leap_output_t _output );
+    // true if built for these register parameters
+    bool matches( uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits ) const {
+        return chunks > 0 && reg_mask == _reg_mask && fb_mask == _fb_mask && reg_len_bits == _reg_len_bits;
+    }
+    // advance reg 64 bits, returns the 64 bits produced
+    inline uint64_t step( uint64_t &reg ) const {
+        uint64_t out = 0;
+        uint64_t nreg = 0;
+        for ( int c=0; c < chunks; ++c ) {
+            int idx = c*256 + ( ( reg >> (8*c) ) & 0xFF );
+            out ^= bits[idx];
+            nreg ^= next[idx];
+        }
+        reg = nreg;
+        return out;
+    }
+};
+
+// Jump ahead for a PRBS register.
+// One register step is a linear map over GF(2), a n x n bit matrix M.
+// Advancing N bits is M^N, built from cached M^(2^k) for each set bit of N,
+// so any position in a pattern is reached in at most 64 matrix-vector
+// products.  Matrices are stored as 64 columns, column j is the image of
+// register bit j.
+struct PRBSJump {
+    uint64_t reg_mask;
+    uint64_t fb_mask;
+    std::vector<uint64_t> pow2; // [k*64+j] column j of M^(2^k)
+    PRBSJump() : reg_mask(0), fb_mask(0) {}
+    void build( uint64_t _reg_mask, uint64_t _fb_mask );
+    bool matches( uint64_t _reg_mask, uint64_t _fb_mask ) const {
+        return pow2.size() > 0 && reg_mask == _reg_mask && fb_mask == _fb_mask;
+    }
+    // register value nbits steps after reg
+    uint64_t advance( uint64_t reg, uint64_t nbits ) const;
+};
+
 // pattern table entry
 struct pattern_table_entry_t {
   int pattern_idx;       // Index in table
@@ -53,6 +119,15 @@ struct PRBSGEN {
     // generate PRBS pattern to fill the buffer.
     void generate( std::vector<uint8_t> *buffer );
     void generate( uint8_t *buffer, int len );
+    // reference generator, one bit per step.
+    void generate_serial( uint8_t *buffer, int len );
+    // generate across threads (0 = one per cpu), each thread jumps to
+    // the pattern position of its slice of the buffer.
+    void generate_mt( uint8_t *buffer, size_t len, int threads=0 );
+    // skip nbits of pattern output
+    void jump( uint64_t nbits );
+    // position the generator at bit nbit of the pattern (from reg_start)
+    void seek( uint64_t nbit );
     // number of bits sent.
     uint64_t bits_tx;
     // register
@@ -60,6 +135,12 @@ struct PRBSGEN {
     uint64_t reg_mask;
     uint64_t fb_mask;
     uint64_t reg_len_bits;
+    // register value at bit 0 of the pattern
+    uint64_t reg_start;
+    // 64 bit leap tables, rebuilt if the register parameters change
+    PRBSLeapTable leap;
+    // jump ahead matrices, built on first use
+    PRBSJump jumper;
     // constructors
     // initialize from known pattern
     PRBSGEN( prbs_pattern_t pat );
@@ -69,9 +150,22 @@ struct PRBSGEN {
 
 // data/state and functions for PRBS pattern checking.
 struct PRBSCHK {
-    // generate PRBS pattern to fill the buffer.
+    // check buffer against the PRBS pattern.
+    // once locked, 64 bits are checked per step (XOR against the expected
+    // sequence and popcount), sync search and words with errors run the
+    // bit serial path so the counters below keep the same meaning.
     void check( std::vector<uint8_t> *buffer );
     void check( uint8_t *buffer, int len );
+    // reference checker, one bit per step.
+    void check_serial( uint8_t *buffer, int len );
+    // check across threads (0 = one per cpu).  Sync is found serially,
+    // then each thread starts locked at the jumped-ahead pattern position
+    // of its slice and the counters are summed.  Same result as check()
+    // unless the data slips (a slice that slipped re-syncs on its own).
+    void check_mt( uint8_t *buffer, size_t len, int threads=0 );
+    // lock to bit nbit of the pattern (counting from reg_start), for
+    // verifying a recording from a known offset.  nbit >= reg_len_bits.
+    void seek( uint64_t nbit );
     // number of bits received.
     // number of bits received.
     uint64_t bits_rx;
@@ -87,6 +181,12 @@ struct PRBSCHK {
     uint64_t reg_mask;
     uint64_t fb_mask;
     uint64_t reg_len_bits;
+    // generator register value at bit 0 of the pattern
+    uint64_t reg_start;
+    // 64 bit leap tables (expected feedback bits) used while locked
+    PRBSLeapTable leap;
+    // jump ahead matrices, built on first use
+    PRBSJump jumper;
     // constructors
     // initialize from known pattern
     PRBSCHK( prbs_pattern_t pat );
@@ -94,7 +194,21 @@ struct PRBSCHK {
     PRBSCHK( uint64_t _reg, uint64_t _reg_mask, uint64_t _fb_mask, uint64_t _reg_len_bits );
 };
 
+// result of prbs_detect()
+struct prbs_detect_result_t {
+    prbs_pattern_t pattern; // USER when no known pattern matched
+    bool inverted;          // data is the complement of the pattern
+    bool bit_reversed;      // bits are LSB first within each byte
+    uint64_t alignment;     // first buffer bit (MSB of byte 0 = bit 0) the pattern holds from
+    uint64_t phase;         // pattern bit number (see PRBSGEN::seek) at alignment
+    double error_rate;      // fraction of recurrence checks that failed
+};
 
-
-
+// Identify which known pattern a buffer holds, its polarity, bit order
+// and position, from a few hundred bits.  A PRBS bit stream obeys
+// s[m] = XOR of s[m-tap] over the feedback taps, so every ITU pattern
+// (in both bit orders) is tested in one pass over the data, 64 positions
+// per word, by XORing shifted copies of the stream; the complemented
+// pattern shows up as an all ones syndrome.
+prbs_detect_result_t prbs_detect( const uint8_t *buffer, int len );
 
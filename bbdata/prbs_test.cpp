@@ -1,8 +1,190 @@
 #include <iostream>
 #include <fstream>
 #include <cstdint>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
 #include "prbs.hpp"
 
+// time fn over buffer, returns Mbit/s
+template <typename F>
+double mbps( std::vector<uint8_t> &buffer, F fn ) {
+    auto t0 = std::chrono::steady_clock::now();
+    fn( buffer.data(), (int)buffer.size() );
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return buffer.size() * 8 / dt.count() / 1e6;
+}
+
+// table driven generate() must match generate_serial() bit for bit for
+// every known pattern (the USER entry has no register to run).
+int checkGenerators() {
+    int failures = 0;
+    std::cout << "Generator check (table driven vs bit serial)\n";
+    for ( int p = ALL_ZEROS; p <= ITU_PN23; ++p ) {
+        PRBSGEN fast( (prbs_pattern_t)p );
+        PRBSGEN ref( (prbs_pattern_t)p );
+        // odd length, so the serial tail gets exercised, twice to check
+        // the register carries over between calls.
+        std::vector<uint8_t> a(1000003);
+        std::vector<uint8_t> b(1000003);
+        int match = 1;
+        for ( int pass = 0; pass < 2; ++pass ) {
+            fast.generate( &a );
+            ref.generate_serial( b.data(), (int)b.size() );
+            if ( a != b ) {
+                match = 0;
+            }
+        }
+        double fast_rate = mbps( a, [&]( uint8_t *m, int l ) { fast.generate( m, l ); } );
+        double ref_rate = mbps( b, [&]( uint8_t *m, int l ) { ref.generate_serial( m, l ); } );
+        std::cout << "  " << pattern_lookup_table[p].name << ": "
+                  << ( match ? "match" : "MISMATCH" )
+                  << "  table " << fast_rate << " Mbit/s, serial " << ref_rate << " Mbit/s\n";
+        if ( !match ) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// word parallel check() must leave the same counters as check_serial()
+// on clean data, on data with bit errors and through a loss of lock.
+int checkCheckers() {
+    int failures = 0;
+    std::cout << "Checker check (word parallel vs bit serial)\n";
+    std::srand(1);
+    for ( int p = ITU_PN9; p <= ITU_PN23; ++p ) {
+        PRBSGEN gen( (prbs_pattern_t)p );
+        std::vector<uint8_t> data(1000003);
+        gen.generate( &data );
+        // sprinkle errors over the second quarter
+        for ( size_t i = data.size()/4; i < data.size()/2; i += 1 + std::rand() % 2000 ) {
+            data[i] ^= 1 << ( std::rand() % 8 );
+        }
+        // trash a block in the third quarter to force a loss of lock
+        for ( size_t i = data.size()*5/8; i < data.size()*5/8 + 512; ++i ) {
+            data[i] = std::rand();
+        }
+        PRBSCHK fast( (prbs_pattern_t)p );
+        PRBSCHK ref( (prbs_pattern_t)p );
+        double fast_rate = mbps( data, [&]( uint8_t *m, int l ) { fast.check( m, l ); } );
+        double ref_rate = mbps( data, [&]( uint8_t *m, int l ) { ref.check_serial( m, l ); } );
+        int match = fast.bits_rx == ref.bits_rx && fast.bits_rx_locked == ref.bits_rx_locked &&
+                    fast.bit_errors_detected == ref.bit_errors_detected &&
+                    fast.sync_slips == ref.sync_slips && fast.isLocked == ref.isLocked &&
+                    fast.reg == ref.reg;
+        std::cout << "  " << pattern_lookup_table[p].name << ": "
+                  << ( match ? "match" : "MISMATCH" )
+                  << "  errors " << fast.bit_errors_detected << " slips " << fast.sync_slips
+                  << "  word " << fast_rate << " Mbit/s, serial " << ref_rate << " Mbit/s\n";
+        if ( !match ) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// jump()/seek() must land where generating would, and the multi
+// threaded generate/check must match the single threaded ones.
+int checkJumpAhead() {
+    int failures = 0;
+    std::cout << "Jump ahead / multi thread check\n";
+    for ( int p = ITU_PN9; p <= ITU_PN23; ++p ) {
+        int match = 1;
+        // jump vs generate
+        PRBSGEN walked( (prbs_pattern_t)p );
+        PRBSGEN jumped( (prbs_pattern_t)p );
+        std::vector<uint8_t> skip(123457);
+        walked.generate( &skip );
+        jumped.jump( skip.size()*8 );
+        match &= walked.reg == jumped.reg;
+        // seek the generator and the checker into the middle of a buffer
+        PRBSGEN gen( (prbs_pattern_t)p );
+        std::vector<uint8_t> data(1 << 26);
+        double st_rate = mbps( data, [&]( uint8_t *m, int l ) { gen.generate( m, l ); } );
+        PRBSGEN sought( (prbs_pattern_t)p );
+        sought.seek( 1000*8 );
+        std::vector<uint8_t> part(1000);
+        sought.generate( &part );
+        match &= std::equal( part.begin(), part.end(), data.begin()+1000 );
+        PRBSCHK at( (prbs_pattern_t)p );
+        at.seek( 777*8 );
+        at.check( data.data()+777, 4096 );
+        match &= at.bits_rx_locked == 4096*8 && at.bit_errors_detected == 0;
+        // multi threaded generate
+        PRBSGEN mt_gen( (prbs_pattern_t)p );
+        std::vector<uint8_t> mt_data( data.size() );
+        double mt_rate = mbps( mt_data, [&]( uint8_t *m, int l ) { mt_gen.generate_mt( m, l, 4 ); } );
+        match &= mt_data == data && mt_gen.reg == gen.reg;
+        // multi threaded check
+        PRBSCHK chk( (prbs_pattern_t)p );
+        PRBSCHK mt_chk( (prbs_pattern_t)p );
+        double chk_rate = mbps( data, [&]( uint8_t *m, int l ) { chk.check( m, l ); } );
+        double mt_chk_rate = mbps( data, [&]( uint8_t *m, int l ) { mt_chk.check_mt( m, l, 4 ); } );
+        match &= chk.bits_rx == mt_chk.bits_rx && chk.bits_rx_locked == mt_chk.bits_rx_locked &&
+                 chk.bit_errors_detected == mt_chk.bit_errors_detected && chk.reg == mt_chk.reg;
+        std::cout << "  " << pattern_lookup_table[p].name << ": " << ( match ? "match" : "MISMATCH" )
+                  << "  generate " << st_rate << " -> " << mt_rate << " Mbit/s"
+                  << ", check " << chk_rate << " -> " << mt_chk_rate << " Mbit/s\n";
+        if ( !match ) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// prbs_detect() must find pattern, polarity, bit order and position from
+// 512 bits of pattern behind a few bytes of junk.
+int checkDetect() {
+    int failures = 0;
+    std::cout << "Pattern detect check\n";
+    std::srand(2);
+    for ( int p = ITU_PN9; p <= ITU_PN23; ++p ) {
+        int pattern_failures = failures;
+        for ( int variant = 0; variant < 4; ++variant ) {
+            bool inverted = variant & 1;
+            bool reversed = variant & 2;
+            const int junk = 13;
+            std::vector<uint8_t> data( junk + 64 );
+            for ( int i = 0; i < junk; ++i ) {
+                data[i] = std::rand();
+            }
+            PRBSGEN gen( (prbs_pattern_t)p );
+            gen.seek( 12345 );
+            gen.generate( data.data()+junk, 64 );
+            for ( int i = junk; i < (int)data.size(); ++i ) {
+                if ( inverted ) {
+                    data[i] = ~data[i];
+                }
+                if ( reversed ) {
+                    data[i] = flipbitorder( data[i] );
+                }
+            }
+            prbs_detect_result_t r = prbs_detect( data.data(), data.size() );
+            // junk bits that happen to continue the pattern backwards move
+            // the alignment earlier, the phase must move with it.
+            // phase is reported within one pattern period.
+            uint64_t early = junk*8 - r.alignment;
+            uint64_t period = ( (uint64_t)1 << pattern_lookup_table[p].reg_len_bits ) - 1;
+            int ok = r.pattern == p && r.inverted == inverted && r.bit_reversed == reversed &&
+                     r.alignment <= (uint64_t)junk*8 && early < 32 &&
+                     ( r.phase + early ) % period == 12345 % period;
+            if ( !ok ) {
+                std::cout << "  " << pattern_lookup_table[p].name << " inverted " << inverted
+                          << " reversed " << reversed << ": MISMATCH (found "
+                          << pattern_lookup_table[r.pattern].name << " inv " << r.inverted
+                          << " rev " << r.bit_reversed << " align " << r.alignment
+                          << " phase " << r.phase << ")\n";
+                failures++;
+            }
+        }
+        if ( failures == pattern_failures ) {
+            std::cout << "  " << pattern_lookup_table[p].name << ": detected in all polarities/bit orders\n";
+        }
+    }
+    return failures;
+}
+
 int main() {
     std::cout << "BERT TEST\n";
     // create a txbert instance
@@ -28,6 +210,11 @@ int main() {
     std::cout << "sync slips        " << rxbert.sync_slips << std::endl;
     std::cout << "BER               " << rxbert.getBER() << std::endl;
     std::cout << "-----------------------------------------\n";
+    if ( checkGenerators() != 0 || checkCheckers() != 0 || checkJumpAhead() != 0 ||
+         checkDetect() != 0 ) {
+        std::cout << "FAIL\n";
+        return -1;
+    }
     return 0;
 }
 
@@ -0,0 +1,468 @@
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "libdsp.hpp"
+#include "dspchain.hpp"
+#include "channel.hpp"
+#include "correlator.hpp"
+#include "decimate.hpp"
+#include "equalizer.hpp"
+#include "firkernel.hpp"
+#include "arena.hpp"
+#include "planar.hpp"
+#include "prbs.hpp"
+
+// Micro benchmarks for the libdsp blocks and the PRBS generator/checker.
+// Every case is run over a block of input repeatedly until at least the
+// minimum time has passed, the rate (samples/s or bits/s) is reported one
+// result per line as CSV or JSON so runs can be diffed for regressions.
+
+void printHelp() {
+    std::cout << "DSP Benchmark\n\n";
+    std::cout << "Program Options:\n";
+    std::cout << "   -f -- output format: csv or json (default csv)\n";
+    std::cout << "   -o -- write results to this file (default stdout)\n";
+    std::cout << "   -t -- minimum seconds per case (default 0.2)\n";
+    std::cout << "   -k -- only run cases whose name contains this string\n";
+    std::cout << "   -h -- help message\n";
+    std::cout << std::endl;
+}
+
+// command line settings
+struct BenchOptions {
+    bool json = false;
+    std::string output_file;
+    double min_secs = 0.2;
+    std::string filter;
+};
+
+// one benchmark result
+struct BenchResult {
+    std::string name;
+    std::string variant;     // sample precision, or the PRBS pattern
+    int taps;           // 0 when it doesn't apply
+    int block;          // items per call/block
+    double items;       // items processed
+    double secs;
+    const char *unit;   // "samples" or "bits"
+};
+
+// keeps results alive so the compiler can't drop the work
+volatile double bench_sink;
+
+// run body (which processes block items) until min_secs has passed
+BenchResult timeCase( const BenchOptions &opt, const std::string &name, const std::string &variant,
+                      int taps, int block, const char *unit, std::function<void()> body ) {
+    BenchResult r = { name, variant, taps, block, 0, 0, unit };
+    body(); // warm up
+    auto t0 = std::chrono::steady_clock::now();
+    std::chrono::duration<double> dt(0);
+    long reps = 0;
+    while ( dt.count() < opt.min_secs ) {
+        body();
+        reps++;
+        dt = std::chrono::steady_clock::now() - t0;
+    }
+    r.items = (double)reps * block;
+    r.secs = dt.count();
+    return r;
+}
+
+// test vector of complex samples in -1..1
+template <typename R>
+CSampleVectorT<R> benchInput( int count ) {
+    Xoshiro256 rng( 7 );
+    CSampleVectorT<R> v( count );
+    for ( auto &s: v ) {
+        s = CSampleT<R>( R( rng.uniform()*2-1 ), R( rng.uniform()*2-1 ) );
+    }
+    return v;
+}
+
+template <typename R>
+void benchDsp( const BenchOptions &opt, const std::string &precision, std::vector<BenchResult> &results ) {
+    const int tap_counts[] = { 9, 33, 65, 129 };
+    const int block_sizes[] = { 64, 1024, 16384 };
+    auto want = [&]( const char *name ) {
+        return opt.filter.length() == 0 || strstr( name, opt.filter.c_str() ) != nullptr;
+    };
+
+    for ( int block: block_sizes ) {
+        CSampleVectorT<R> in = benchInput<R>( block );
+        CSampleVectorT<R> out( block );
+        for ( int taps: tap_counts ) {
+            if ( want( "FIRFilter" ) ) {
+                FIRFilterT<R> fir( std::vector<R>( taps, R(1.0/taps) ) );
+                results.push_back( timeCase( opt, "FIRFilter", precision, taps, block, "samples", [&] {
+                    R acc = 0;
+                    for ( auto &s: in ) {
+                        acc += fir.process( s.real() );
+                    }
+                    bench_sink = acc;
+                } ) );
+            }
+            if ( want( "BlockFIR" ) ) {
+                // each kernel the autotuner picks from, at its middle setting
+                CSampleVectorT<R> coeff( taps, CSampleT<R>( R(1.0/taps), 0 ) );
+                for ( int k=0; k < fir_kernel_count; ++k ) {
+                    FirTuning t;
+                    t.kernel = (fir_kernel_t)k;
+                    t.param = k == fir_fft ? 4*taps : 1024;
+                    BlockFIRT<R> fir( coeff, t );
+                    std::string name = std::string( "BlockFIR." ) + firKernelName( t.kernel );
+                    results.push_back( timeCase( opt, name.c_str(), precision, taps, block, "samples", [&] {
+                        fir.process( in.data(), out.data(), block );
+                        bench_sink = out[block-1].real();
+                    } ) );
+                }
+            }
+            if ( want( "CFIRFilter" ) ) {
+                CFIRFilterT<R> cfir( CSampleVectorT<R>( taps, CSampleT<R>( R(1.0/taps), R(1.0/taps) ) ) );
+                results.push_back( timeCase( opt, "CFIRFilter", precision, taps, block, "samples", [&] {
+                    for ( int idx=0; idx < block; ++idx ) {
+                        out[idx] = cfir.process( in[idx] );
+                    }
+                    bench_sink = out[block-1].real();
+                } ) );
+            }
+        }
+        if ( want( "CNCO" ) ) {
+            CNCOT<R> nco( R(0.01), 0 );
+            results.push_back( timeCase( opt, "CNCO", precision, 0, block, "samples", [&] {
+                for ( int idx=0; idx < block; ++idx ) {
+                    out[idx] = nco.generate();
+                }
+                bench_sink = out[block-1].real();
+            } ) );
+        }
+        if ( want( "Mixer" ) ) {
+            // NCO times the input, interleaved through generate() vs planar
+            CNCOT<R> nco( R(0.01), 0 );
+            results.push_back( timeCase( opt, "Mixer.interleaved", precision, 0, block, "samples", [&] {
+                for ( int idx=0; idx < block; ++idx ) {
+                    out[idx] = in[idx] * nco.generate();
+                }
+                bench_sink = out[block-1].real();
+            } ) );
+            PlanarSamplesT<R> x( block );
+            x.load( in.data(), block );
+            PlanarSamplesT<R> y( block );
+            results.push_back( timeCase( opt, "Mixer.planar", precision, 0, block, "samples", [&] {
+                nco.mix( x.i.data(), x.q.data(), y.i.data(), y.q.data(), block );
+                bench_sink = y.i[block-1];
+            } ) );
+        }
+        if ( want( "Planar" ) ) {
+            // the I/O boundary converters, and the plain loop they replace
+            PlanarSamplesT<R> x( block );
+            results.push_back( timeCase( opt, "Planar.deinterleave", precision, 0, block, "samples", [&] {
+                deinterleave( in.data(), block, x.i.data(), x.q.data() );
+                bench_sink = x.q[block-1];
+            } ) );
+            results.push_back( timeCase( opt, "Planar.interleave", precision, 0, block, "samples", [&] {
+                interleave( x.i.data(), x.q.data(), block, out.data() );
+                bench_sink = out[block-1].imag();
+            } ) );
+            results.push_back( timeCase( opt, "Planar.loop", precision, 0, block, "samples", [&] {
+                for ( int idx=0; idx < block; ++idx ) {
+                    x.i[idx] = in[idx].real();
+                    x.q[idx] = in[idx].imag();
+                }
+                bench_sink = x.q[block-1];
+            } ) );
+        }
+        if ( want( "PhaseDetectorBPSK" ) ) {
+            results.push_back( timeCase( opt, "PhaseDetectorBPSK", precision, 0, block, "samples", [&] {
+                R acc = 0;
+                for ( auto &s: in ) {
+                    acc += PhaseDetectorBPSK<R>( s );
+                }
+                bench_sink = acc;
+            } ) );
+        }
+        if ( want( "BpskDemod" ) ) {
+            // sps 4 gives the usual 33 tap matched filter
+            BpskDemodT<R> demod( 4, 0.35, 256 );
+            results.push_back( timeCase( opt, "BpskDemod", precision, 33, block, "samples", [&] {
+                for ( int idx=0; idx < block; ++idx ) {
+                    out[idx] = demod.process( in[idx] );
+                }
+                bench_sink = out[block-1].real();
+            } ) );
+        }
+    }
+    if ( want( "FFT" ) ) {
+        for ( int size: { 256, 4096 } ) {
+            FFTT<R> fft( size );
+            CSampleVectorT<R> data = benchInput<R>( size );
+            results.push_back( timeCase( opt, "FFT", precision, 0, size, "samples", [&] {
+                fft.forward( data.data() );
+                bench_sink = data[0].real();
+            } ) );
+        }
+    }
+    if ( want( "Correlator" ) ) {
+        // direct vs overlap-save FFT over reference lengths, taps = reference length
+        const int block = 16384;
+        CSampleVectorT<R> in = benchInput<R>( block );
+        std::vector<CorrelatorHit> hits;
+        for ( int len: { 32, 128, 512, 2048 } ) {
+            CSampleVectorT<R> ref = benchInput<R>( len );
+            CorrelatorT<R> direct( ref, 0.9, correlate_direct );
+            results.push_back( timeCase( opt, "Correlator.direct", precision, len, block, "samples", [&] {
+                direct.process( in.data(), block, &hits );
+                bench_sink = hits.size();
+            } ) );
+            CorrelatorT<R> fft( ref, 0.9, correlate_fft );
+            results.push_back( timeCase( opt, "Correlator.fft", precision, len, block, "samples", [&] {
+                fft.process( in.data(), block, &hits );
+                bench_sink = hits.size();
+            } ) );
+        }
+    }
+    if ( want( "AWGN" ) || want( "Gaussian" ) ) {
+        // noise for test captures, wants to keep up with writing them
+        const int block = 16384;
+        CSampleVectorT<R> in = benchInput<R>( block );
+        CSampleVectorT<R> out( block );
+        std::vector<R> values( 2*block );
+        GaussianT<R> gauss( 1 );
+        AWGNT<R> awgn( AWGNT<R>::sigmaFromEsN0( 10.0 ), 1 );
+        if ( want( "Gaussian" ) ) {
+            results.push_back( timeCase( opt, "Gaussian", precision, 0, 2*block, "values", [&] {
+                gauss.fill( values.data(), 2*block );
+                bench_sink = values[2*block-1];
+            } ) );
+        }
+        if ( want( "AWGN" ) ) {
+            results.push_back( timeCase( opt, "AWGN", precision, 0, block, "samples", [&] {
+                awgn.process( in.data(), out.data(), block );
+                bench_sink = out[block-1].real();
+            } ) );
+        }
+    }
+    if ( want( "Decimator" ) ) {
+        // the planned cascade vs the one CFIRFilter at the input rate it
+        // replaces (same passband and alias rejection), param is the factor
+        const int block = 16384;
+        CSampleVectorT<R> in = benchInput<R>( block );
+        CSampleVectorT<R> out( block );
+        for ( int factor: { 4, 16, 64 } ) {
+            DecimPlan plan;
+            planDecimation( factor, &plan );
+            DecimatorT<R> dec( plan );
+            results.push_back( timeCase( opt, "Decimator.cascade", precision, factor, block, "samples", [&] {
+                int n = dec.process( in.data(), block, out.data() );
+                bench_sink = out[n-1].real();
+            } ) );
+            int taps = (int)std::ceil( 5.5 / ( 0.6/factor ) ) | 1;
+            std::vector<double> lp = computeCICComp( taps, 0.2/factor, 0.8/factor );
+            CFIRFilterT<R> fir( CSampleVectorT<R>( lp.begin(), lp.end() ) );
+            results.push_back( timeCase( opt, "Decimator.fir", precision, factor, block, "samples", [&] {
+                for ( int idx=0; idx < block; ++idx ) {
+                    out[idx] = fir.process( in[idx] );
+                }
+                bench_sink = out[block-1].real();
+            } ) );
+        }
+    }
+    if ( want( "Equalizer" ) ) {
+        // per sample vs block frequency domain, filter and update at 4 sps
+        const int block = 16384;
+        CSampleVectorT<R> in = benchInput<R>( block );
+        CSampleVectorT<R> out( block );
+        // the chain demod without an equalizer stage (taps 0), the
+        // baseline for Equalizer.demod
+        ChainBpskDemod< CSampleT<R> > plain_demod( 0.35, 256 );
+        results.push_back( timeCase( opt, "Equalizer.demod", precision, 0, block, "samples", [&] {
+            plain_demod.process_block( in.data(), out.data(), block );
+            bench_sink = out[block-1].real();
+        } ) );
+        for ( int taps: { 16, 64, 256 } ) {
+            ChainBpskDemod< CSampleT<R>, 4, 64, EqStage< CSampleT<R> > > eq_demod( 0.35, 256 );
+            eq_demod.Eq = EqStage< CSampleT<R> >( taps, 4 );
+            results.push_back( timeCase( opt, "Equalizer.demod", precision, taps, block, "samples", [&] {
+                eq_demod.process_block( in.data(), out.data(), block );
+                bench_sink = out[block-1].real();
+            } ) );
+            EqualizerT<R> time_eq( taps, 4, equalize_time );
+            results.push_back( timeCase( opt, "Equalizer.time", precision, taps, block, "samples", [&] {
+                time_eq.process( in.data(), out.data(), block );
+                bench_sink = out[block-1].real();
+            } ) );
+            EqualizerT<R> fft_eq( taps, 4, equalize_fft );
+            results.push_back( timeCase( opt, "Equalizer.fft", precision, taps, block, "samples", [&] {
+                fft_eq.process( in.data(), out.data(), block );
+                bench_sink = out[block-1].real();
+            } ) );
+        }
+    }
+}
+
+// a pass over a buffer much bigger than the caches and the 4 kB page TLB
+// reach, from the heap and from an arena (hugepages if the pool has them)
+template <typename R>
+void benchBuffers( const BenchOptions &opt, const std::string &precision, std::vector<BenchResult> &results ) {
+    auto want = [&]( const char *name ) {
+        return opt.filter.length() == 0 || strstr( name, opt.filter.c_str() ) != nullptr;
+    };
+    if ( !want( "Buffer.heap" ) && !want( "Buffer.arena" ) ) {
+        return;
+    }
+    const int count = 1 << 22;
+    const int stride = 4096 / sizeof( CSampleT<R> ) + 1;    // a new page each access
+    CSampleVectorT<R> heap( count );
+    BufferArena arena;
+    ArenaCSampleVectorT<R> pages( count, CSampleT<R>(), ArenaAllocator< CSampleT<R> >( &arena ) );
+    auto touch = [&]( CSampleT<R> *buf ) {
+        CSampleT<R> acc = 0;
+        for ( int idx=0, at=0; idx < count; ++idx ) {
+            acc += buf[at];
+            buf[at] *= R(0.5);
+            at += stride;
+            if ( at >= count ) {
+                at -= count;
+            }
+        }
+        bench_sink = acc.real();
+    };
+    if ( want( "Buffer.heap" ) ) {
+        results.push_back( timeCase( opt, "Buffer.heap", precision, 0, count, "samples", [&] {
+            touch( heap.data() );
+        } ) );
+    }
+    if ( want( "Buffer.arena" ) ) {
+        results.push_back( timeCase( opt, "Buffer.arena", precision, 0, count, "samples", [&] {
+            touch( pages.data() );
+        } ) );
+    }
+}
+
+void benchPrbs( const BenchOptions &opt, std::vector<BenchResult> &results ) {
+    const int block_bytes[] = { 64, 4096, 1 << 20 };
+    const prbs_pattern_t patterns[] = { ITU_PN9, ITU_PN23 };
+    auto want = [&]( const char *name ) {
+        return opt.filter.length() == 0 || strstr( name, opt.filter.c_str() ) != nullptr;
+    };
+    for ( int bytes: block_bytes ) {
+        for ( prbs_pattern_t pat: patterns ) {
+            std::vector<uint8_t> buf( bytes );
+            std::string precision = pattern_lookup_table[pat].name;
+            if ( want( "PRBSGEN" ) ) {
+                PRBSGEN gen( pat );
+                results.push_back( timeCase( opt, "PRBSGEN", precision, 0, bytes*8, "bits", [&] {
+                    gen.generate( buf.data(), bytes );
+                    bench_sink = buf[bytes-1];
+                } ) );
+            }
+            if ( want( "PRBSCHK" ) ) {
+                // a continuous pattern, so the checker stays locked
+                PRBSGEN gen( pat );
+                std::vector<uint8_t> data( (size_t)bytes * 16 );
+                gen.generate( data.data(), data.size() );
+                PRBSCHK chk( pat );
+                size_t pos = 0;
+                results.push_back( timeCase( opt, "PRBSCHK", precision, 0, bytes*8, "bits", [&] {
+                    if ( pos + bytes > data.size() ) {
+                        // data restarts at pattern bit 0, one period on
+                        pos = 0;
+                        chk.seek( ( 1ULL << chk.reg_len_bits ) - 1 );
+                    }
+                    chk.check( data.data() + pos, bytes );
+                    pos += bytes;
+                    bench_sink = chk.bit_errors_detected;
+                } ) );
+                if ( chk.bit_errors_detected || chk.sync_slips ) {
+                    std::cout << "PRBSCHK bench lost lock on " << precision << "\n";
+                }
+            }
+        }
+    }
+}
+
+// returns 0 if parse completes, -1 if parse is incomplete.
+int getOptions( int argc, char **argv, BenchOptions &opt ) {
+    int c;
+    while (( c = getopt( argc, argv, "f:o:t:k:h") ) != -1 ) {
+        switch (c) {
+            case 'h':
+                printHelp();
+                return -1;
+            case 'f':
+                if ( strcmp( optarg, "json" ) == 0 ) {
+                    opt.json = true;
+                } else if ( strcmp( optarg, "csv" ) != 0 ) {
+                    std::cout << "Unknown format: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
+            case 'o':
+                opt.output_file = optarg;
+                break;
+            case 't':
+                opt.min_secs = atof(optarg);
+                break;
+            case 'k':
+                opt.filter = optarg;
+                break;
+            default:
+                std::cout << "Unknown input option provided, try -h for options list.." << std::endl;
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int main( int argc, char **argv ) {
+    BenchOptions opt;
+    if ( getOptions( argc, argv, opt ) < 0 ) {
+        std::cout << "Exit..\n" << std::endl;
+        return -1;
+    }
+    FILE *out = stdout;
+    if ( opt.output_file.length() ) {
+        out = fopen( opt.output_file.c_str(), "w" );
+        if ( out == nullptr ) {
+            std::cout << "Failed to open output file : " << opt.output_file << std::endl;
+            return -1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    benchDsp<double>( opt, "double", results );
+    benchDsp<float>( opt, "float", results );
+    benchBuffers<double>( opt, "double", results );
+    benchPrbs( opt, results );
+
+    if ( opt.json ) {
+        fprintf( out, "[\n" );
+    } else {
+        fprintf( out, "name,variant,taps,block,items,seconds,rate,unit\n" );
+    }
+    for ( size_t idx=0; idx < results.size(); ++idx ) {
+        const BenchResult &r = results[idx];
+        double rate = r.items / r.secs;
+        if ( opt.json ) {
+            fprintf( out, "  {\"name\": \"%s\", \"variant\": \"%s\", \"taps\": %d, \"block\": %d, "
+                          "\"items\": %.0f, \"seconds\": %.6f, \"rate\": %.1f, \"unit\": \"%s/s\"}%s\n",
+                     r.name.c_str(), r.variant.c_str(), r.taps, r.block, r.items, r.secs, rate, r.unit,
+                     idx+1 < results.size() ? "," : "" );
+        } else {
+            fprintf( out, "%s,%s,%d,%d,%.0f,%.6f,%.1f,%s/s\n", r.name.c_str(), r.variant.c_str(),
+                     r.taps, r.block, r.items, r.secs, rate, r.unit );
+        }
+    }
+    if ( opt.json ) {
+        fprintf( out, "]\n" );
+    }
+    if ( out != stdout ) {
+        fclose( out );
+    }
+    return 0;
+}
@@ -0,0 +1,314 @@
+#include "arena.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+// from linux/mempolicy.h, there is no libnuma dependency
+static const int mpol_bind = 2;
+
+// smallest block, one cache line
+static const int min_block_shift = 6;
+
+static size_t pageBytes( arena_page_t page ) {
+    switch ( page ) {
+        case arena_page_1g: return (size_t)1 << 30;
+        case arena_page_2m: return (size_t)1 << 21;
+        default:            return 4096;
+    }
+}
+
+static const char *pageName( arena_page_t page ) {
+    switch ( page ) {
+        case arena_page_1g: return "1 GB";
+        case arena_page_2m: return "2 MB";
+        default:            return "4 kB";
+    }
+}
+
+// first line of a (sysfs) file, empty if it can't be read
+static std::string readLine( const std::string &path ) {
+    std::ifstream f( path );
+    std::string line;
+    std::getline( f, line );
+    return line;
+}
+
+// free pages in the hugepage pool of a node (or of the machine for node
+// -1).  Reservations are only kept machine wide, so on a node this is an
+// estimate, good enough to avoid a SIGBUS on first touch of a bound
+// mapping the node can't back.
+static long freeHugepages( int node, arena_page_t page ) {
+    std::string dir = page == arena_page_1g ? "hugepages-1048576kB" : "hugepages-2048kB";
+    std::string path = node < 0 ? "/sys/kernel/mm/hugepages/" + dir + "/free_hugepages"
+                                : "/sys/devices/system/node/node" + std::to_string( node ) +
+                                  "/hugepages/" + dir + "/free_hugepages";
+    std::string line = readLine( path );
+    return line.length() ? atol( line.c_str() ) : 0;
+}
+
+BufferArena::BufferArena( int _node, arena_page_t _page, size_t _region ) {
+    node = _node;
+    page = _page;
+    size_t pb = pageBytes( page == arena_page_4k ? arena_page_2m : page );
+    region = _region ? ( _region + pb - 1 ) / pb * pb : pb;
+    next = nullptr;
+    left = 0;
+    mapped[0] = mapped[1] = mapped[2] = 0;
+    unbound = 0;
+}
+
+BufferArena::~BufferArena() {
+    for ( auto &m: regions ) {
+        unmap( m );
+    }
+    for ( auto &l: large ) {
+        unmap( l.second );
+    }
+}
+
+BufferArena::Mapping BufferArena::map( size_t bytes, size_t need ) {
+    Mapping m = { nullptr, 0, arena_page_4k, false };
+    // the largest page the pool can cover, then smaller ones
+    for ( int p=page; p >= arena_page_4k && !m.addr; --p ) {
+        arena_page_t pg = (arena_page_t)p;
+        size_t pb = pageBytes( pg );
+        size_t len = ( ( p == page ? bytes : need ) + pb - 1 ) / pb * pb;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if ( pg != arena_page_4k ) {
+            if ( freeHugepages( node, pg ) < (long)( len / pb ) ) {
+                continue;
+            }
+            flags |= MAP_HUGETLB | ( ( pg == arena_page_1g ? 30 : 21 ) << MAP_HUGE_SHIFT );
+        }
+        void *addr = mmap( nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0 );
+        if ( addr == MAP_FAILED ) {
+            continue;
+        }
+        if ( pg == arena_page_4k ) {
+            madvise( addr, len, MADV_HUGEPAGE );
+        }
+        m = { addr, len, pg, node < 0 };
+    }
+    if ( !m.addr ) {
+        return m;
+    }
+    if ( node >= 0 ) {
+        // before the first touch, so every page is faulted in on the node
+        const int bits = 8*sizeof(unsigned long);
+        std::vector<unsigned long> mask( node/bits + 1, 0 );
+        mask[node/bits] = 1UL << ( node % bits );
+        m.bound = syscall( SYS_mbind, m.addr, m.bytes, mpol_bind, mask.data(),
+                           (unsigned long)( mask.size()*bits + 1 ), 0 ) == 0;
+        if ( !m.bound ) {
+            unbound++;
+        }
+    }
+    mapped[m.page] += m.bytes;
+    return m;
+}
+
+void BufferArena::unmap( const Mapping &m ) {
+    munmap( m.addr, m.bytes );
+    mapped[m.page] -= m.bytes;
+}
+
+int BufferArena::sizeClass( size_t bytes ) {
+    int c = 0;
+    while ( ( (size_t)1 << ( c + min_block_shift ) ) < bytes ) {
+        ++c;
+    }
+    return c;
+}
+
+void *BufferArena::allocate( size_t bytes ) {
+    std::lock_guard<std::mutex> guard( lock );
+    int c = sizeClass( bytes );
+    size_t block = (size_t)1 << ( c + min_block_shift );
+    if ( block > region/4 ) {
+        // big enough to be worth its own pages
+        Mapping m = map( bytes, bytes );
+        if ( !m.addr ) {
+            return nullptr;
+        }
+        large[m.addr] = m;
+        return m.addr;
+    }
+    if ( c < (int)free_list.size() && free_list[c].size() ) {
+        void *p = free_list[c].back();
+        free_list[c].pop_back();
+        return p;
+    }
+    if ( left < block ) {
+        // the rest of the last region is left unused.  A 1 GB region that
+        // falls back to smaller pages only maps 2 MB (or the block).
+        Mapping m = map( region, std::max( block, pageBytes( arena_page_2m ) ) );
+        if ( !m.addr ) {
+            return nullptr;
+        }
+        regions.push_back( m );
+        next = (char*)m.addr;
+        left = m.bytes;
+    }
+    // blocks are multiples of 64 bytes carved from a page aligned region,
+    // so every one stays 64 byte aligned
+    void *p = next;
+    next += block;
+    left -= block;
+    return p;
+}
+
+void BufferArena::deallocate( void *p, size_t bytes ) {
+    if ( !p ) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard( lock );
+    auto l = large.find( p );
+    if ( l != large.end() ) {
+        unmap( l->second );
+        large.erase( l );
+        return;
+    }
+    int c = sizeClass( bytes );
+    if ( c >= (int)free_list.size() ) {
+        free_list.resize( c+1 );
+    }
+    free_list[c].push_back( p );
+}
+
+std::string BufferArena::describe() {
+    std::lock_guard<std::mutex> guard( lock );
+    std::string s = node < 0 ? "any node" : "node " + std::to_string( node );
+    bool any = false;
+    for ( int p=arena_page_1g; p >= arena_page_4k; --p ) {
+        if ( mapped[p] == 0 ) {
+            continue;
+        }
+        char line[64];
+        snprintf( line, sizeof(line), ", %.1f MB in %s pages", mapped[p] / 1048576.0, pageName( (arena_page_t)p ) );
+        s += line;
+        any = true;
+    }
+    if ( !any ) {
+        s += ", nothing mapped";
+    }
+    bool fallback = false;
+    for ( int p=arena_page_4k; p < page; ++p ) {
+        fallback |= mapped[p] > 0;
+    }
+    if ( fallback ) {
+        s += std::string( " (no free " ) + pageName( page ) + " hugepages for all of it)";
+    }
+    if ( unbound ) {
+        s += ", " + std::to_string( unbound ) + " mappings not bound to the node";
+    }
+    return s;
+}
+
+BufferArena *sharedArena( int node, arena_page_t page ) {
+    static std::mutex lock;
+    // never freed, vectors in them may outlive any static destructor order
+    static std::unordered_map<int, BufferArena*> arenas;
+    std::lock_guard<std::mutex> guard( lock );
+    BufferArena *&a = arenas[node];
+    if ( !a ) {
+        a = new BufferArena( node, page );
+    }
+    return a;
+}
+
+int parseCpuList( const std::string &list, std::vector<int> *cpus ) {
+    cpus->clear();
+    size_t pos = 0;
+    while ( pos < list.length() ) {
+        size_t end = list.find( ',', pos );
+        if ( end == std::string::npos ) {
+            end = list.length();
+        }
+        std::string item = list.substr( pos, end-pos );
+        int first, last;
+        char extra;
+        if ( sscanf( item.c_str(), "%d-%d%c", &first, &last, &extra ) == 2 ) {
+            // range
+        } else if ( sscanf( item.c_str(), "%d%c", &first, &extra ) == 1 ) {
+            last = first;
+        } else {
+            return -1;
+        }
+        if ( first < 0 || last < first ) {
+            return -1;
+        }
+        for ( int c=first; c <= last; ++c ) {
+            cpus->push_back( c );
+        }
+        pos = end+1;
+    }
+    return 0;
+}
+
+int numaNodeCount() {
+    std::vector<int> nodes;
+    if ( parseCpuList( readLine( "/sys/devices/system/node/online" ), &nodes ) < 0 || nodes.size() == 0 ) {
+        return 1;
+    }
+    return nodes.size();
+}
+
+std::vector<int> nodeCpus( int node ) {
+    std::string path = node < 0 ? "/sys/devices/system/cpu/online"
+                                : "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist";
+    std::vector<int> cpus;
+    if ( parseCpuList( readLine( path ), &cpus ) < 0 ) {
+        cpus.clear();
+    }
+    if ( cpus.size() == 0 && node <= 0 ) {
+        // no sysfs, a single node machine
+        for ( int c=0; c < (int)std::max( 1u, std::thread::hardware_concurrency() ); ++c ) {
+            cpus.push_back( c );
+        }
+    }
+    return cpus;
+}
+
+static int setAffinity( pthread_t t, const std::vector<int> &cpus ) {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for ( int c: cpus ) {
+        if ( c >= 0 && c < CPU_SETSIZE ) {
+            CPU_SET( c, &set );
+        }
+    }
+    if ( CPU_COUNT( &set ) == 0 || pthread_setaffinity_np( t, sizeof(set), &set ) != 0 ) {
+        return -1;
+    }
+    return 0;
+}
+
+int pinThread( std::thread &t, const std::vector<int> &cpus ) {
+    return setAffinity( t.native_handle(), cpus );
+}
+
+int pinThisThread( const std::vector<int> &cpus ) {
+    return setAffinity( pthread_self(), cpus );
+}
+
+std::vector<int> threadCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if ( pthread_getaffinity_np( pthread_self(), sizeof(set), &set ) == 0 ) {
+        for ( int c=0; c < CPU_SETSIZE; ++c ) {
+            if ( CPU_ISSET( c, &set ) ) {
+                cpus.push_back( c );
+            }
+        }
+    }
+    return cpus;
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "libdsp.hpp"
+
+/////////////////////////////
+// Buffer arena (hugepages, NUMA node) and thread pinning
+///////////////////////////
+//
+// Big sample buffers in plain vectors land on whichever node first
+// touched them, on 4 kB pages.  A BufferArena maps its memory in regions
+// of 2 MB or 1 GB hugepages bound (mbind) to one NUMA node and hands out
+// 64 byte aligned blocks from them.  Freed blocks go on a free list per
+// power of 2 size class and are handed out again, blocks too big for a
+// region get a mapping of their own and are unmapped when freed.
+//
+// Hugepages come from the kernel's reserved pool (vm.nr_hugepages, or
+// per node under /sys/devices/system/node/node*/hugepages).  If the pool
+// (on the node) can't cover a region it falls back to the next smaller
+// page: 1 GB -> 2 MB -> 4 kB pages with transparent hugepages requested
+// (madvise), so an arena always works, describe() says what it got.
+//
+//   BufferArena arena( 0 );      // node 0, 2 MB pages
+//   ArenaCSampleVectorT<float> buf( 1<<20, CSampleT<float>(), ArenaAllocator< CSampleT<float> >( &arena ) );
+//   pinThisThread( nodeCpus( 0 ) );
+//
+// Threads keep to their node with the pinning helpers, WorkPool takes a
+// node and pins one worker per core of it.
+
+enum arena_page_t {
+    arena_page_4k,      // normal pages, transparent hugepages requested
+    arena_page_2m,
+    arena_page_1g
+};
+
+// every block starts on a cache line
+const size_t arena_align = 64;
+
+struct BufferArena {
+    // node -1 leaves placement to the kernel, region 0 is one page (2 MB
+    // for 4 kB pages)
+    BufferArena( int _node=-1, arena_page_t _page=arena_page_2m, size_t _region=0 );
+    ~BufferArena();
+    BufferArena( const BufferArena & ) = delete;
+    BufferArena &operator=( const BufferArena & ) = delete;
+
+    // a block of at least bytes, 64 byte aligned, nullptr if out of memory
+    void *allocate( size_t bytes );
+    // bytes is the size it was allocated with
+    void deallocate( void *p, size_t bytes );
+    // "node 0, 3 x 2 MB pages" and any fallbacks
+    std::string describe();
+
+    struct Mapping {
+        void *addr;
+        size_t bytes;
+        arena_page_t page;      // what it actually got
+        bool bound;             // mbind to the node worked
+    };
+
+    int node;
+    arena_page_t page;
+    size_t region;
+    std::mutex lock;
+    std::vector<Mapping> regions;
+    std::unordered_map<void*, Mapping> large;   // blocks with their own mapping
+    std::vector< std::vector<void*> > free_list; // [size class]
+    char *next;                                 // unused part of the last region
+    size_t left;
+    size_t mapped[3];                           // bytes per arena_page_t
+    int unbound;                                // mappings mbind refused
+
+    // bytes on the arena's page, need if it falls back to a smaller one
+    Mapping map( size_t bytes, size_t need );
+    void unmap( const Mapping &m );
+    int sizeClass( size_t bytes );
+};
+
+// Arena for a node shared by the process (created on first use, lives
+// until exit), page is only used by the call that creates it.
+BufferArena *sharedArena( int node, arena_page_t page=arena_page_2m );
+
+// Standard allocator over an arena, so sample vectors (and anything else
+// with an allocator parameter) can live in one.  Without an arena it
+// takes 64 byte aligned blocks from the heap.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    BufferArena *arena;
+
+    ArenaAllocator( BufferArena *_arena=nullptr ) : arena( _arena ) {}
+    template <typename U>
+    ArenaAllocator( const ArenaAllocator<U> &other ) : arena( other.arena ) {}
+
+    T *allocate( size_t n ) {
+        size_t bytes = n*sizeof(T);
+        void *p = nullptr;
+        if ( arena ) {
+            p = arena->allocate( bytes );
+        } else if ( posix_memalign( &p, arena_align, bytes ? bytes : 1 ) != 0 ) {
+            p = nullptr;
+        }
+        if ( !p ) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>( p );
+    }
+    void deallocate( T *p, size_t n ) {
+        if ( arena ) {
+            arena->deallocate( p, n*sizeof(T) );
+        } else {
+            free( p );
+        }
+    }
+};
+
+template <typename T, typename U>
+bool operator==( const ArenaAllocator<T> &a, const ArenaAllocator<U> &b ) {
+    return a.arena == b.arena;
+}
+template <typename T, typename U>
+bool operator!=( const ArenaAllocator<T> &a, const ArenaAllocator<U> &b ) {
+    return a.arena != b.arena;
+}
+
+// sample vectors in an arena
+template <typename R>
+using ArenaCSampleVectorT = CSampleVectorT< R, ArenaAllocator< CSampleT<R> > >;
+using ArenaCSampleVector = ArenaCSampleVectorT<double>;
+using ArenaSampleVector = std::vector< Sample, ArenaAllocator<Sample> >;
+
+// NUMA nodes on this machine (1 without the sysfs node directory)
+int numaNodeCount();
+// cpus of a node (from its sysfs cpulist), node -1 is every online cpu
+std::vector<int> nodeCpus( int node );
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11, returns -1 if it doesn't parse
+int parseCpuList( const std::string &list, std::vector<int> *cpus );
+// restrict a thread to cpus, returns -1 if the kernel refuses
+int pinThread( std::thread &t, const std::vector<int> &cpus );
+int pinThisThread( const std::vector<int> &cpus );
+// the calling thread's allowed cpus
+std::vector<int> threadCpus();
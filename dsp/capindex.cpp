@@ -0,0 +1,117 @@
+#include "capindex.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char index_magic[8] = { 'D', 'S', 'P', 'I', 'N', 'D', 'E', 'X' };
+
+int writeCaptureIndex( const std::string &path, uint32_t block_samples, uint32_t sample_size,
+                       const std::vector<IndexEntry> &entries ) {
+    int fd = ::open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fd < 0 ) {
+        std::cout << "Failed to open index file : " << path << std::endl;
+        return -1;
+    }
+    IndexHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.magic, index_magic, sizeof(hdr.magic) );
+    hdr.version = 1;
+    hdr.entry_size = sizeof(IndexEntry);
+    hdr.entries = entries.size();
+    hdr.block_samples = block_samples;
+    hdr.sample_size = sample_size;
+    const char *p = (const char*)entries.data();
+    size_t left = entries.size() * sizeof(IndexEntry);
+    int rc = ( write( fd, &hdr, sizeof(hdr) ) == sizeof(hdr) ) ? 0 : -1;
+    while ( rc == 0 && left > 0 ) {
+        ssize_t n = write( fd, p, left );
+        if ( n <= 0 ) {
+            rc = -1;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    if ( rc < 0 ) {
+        std::cout << "Index file write failed : " << path << std::endl;
+    }
+    ::close(fd);
+    return rc;
+}
+
+CaptureIndex::CaptureIndex() : header(nullptr), entries(nullptr), map(nullptr), map_len(0) {}
+
+CaptureIndex::~CaptureIndex() {
+    close();
+}
+
+int CaptureIndex::open( const std::string &path ) {
+    close();
+    int fd = ::open( path.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        std::cout << "Failed to open index file : " << path << std::endl;
+        return -1;
+    }
+    struct stat sb;
+    if ( fstat( fd, &sb ) < 0 || sb.st_size < (off_t)sizeof(IndexHeader) ) {
+        std::cout << "Not an index file : " << path << std::endl;
+        ::close(fd);
+        return -1;
+    }
+    void *m = mmap( nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close(fd);
+    if ( m == MAP_FAILED ) {
+        std::cout << "Failed to map index file : " << path << std::endl;
+        return -1;
+    }
+    const IndexHeader *hdr = (const IndexHeader*)m;
+    if ( memcmp( hdr->magic, index_magic, sizeof(hdr->magic) ) != 0 || hdr->entry_size != sizeof(IndexEntry) ||
+         sizeof(IndexHeader) + hdr->entries*sizeof(IndexEntry) > (uint64_t)sb.st_size ) {
+        std::cout << "Not an index file : " << path << std::endl;
+        munmap( m, sb.st_size );
+        return -1;
+    }
+    map = m;
+    map_len = sb.st_size;
+    header = hdr;
+    entries = (const IndexEntry*)( (const char*)m + sizeof(IndexHeader) );
+    return 0;
+}
+
+void CaptureIndex::close() {
+    if ( map ) {
+        munmap( map, map_len );
+    }
+    map = nullptr;
+    map_len = 0;
+    header = nullptr;
+    entries = nullptr;
+}
+
+std::vector<SampleRegion> CaptureIndex::regions( uint16_t flags, uint64_t total_samples ) const {
+    std::vector<SampleRegion> list;
+    if ( !header ) {
+        return list;
+    }
+    uint64_t block = header->block_samples;
+    for ( uint64_t n=0; n < size(); ++n ) {
+        if ( ( entries[n].flags & flags ) != flags ) {
+            continue;
+        }
+        uint64_t first = n*block;
+        if ( first >= total_samples ) {
+            break;
+        }
+        uint64_t count = std::min( block, total_samples - first );
+        if ( list.size() && list.back().first + list.back().count == first ) {
+            list.back().count += count;
+        } else {
+            list.push_back( { first, count } );
+        }
+    }
+    return list;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/////////////////////////////
+// Capture index
+///////////////////////////
+//
+// Sidecar index of a capture (bpsk_demod -I writes <output>.idx), one
+// entry per fixed size block of input samples: its level, whether it was
+// demodulated (squelch) and how the carrier loop was doing.  A later run
+// can map the index and go straight to the blocks it cares about instead
+// of re-reading the whole capture (bpsk_demod -r).
+//
+// File layout: one IndexHeader, then IndexHeader::entries IndexEntrys,
+// little endian as written by the host.  Entry n covers input samples
+// [n*block_samples, (n+1)*block_samples), at byte n*block_samples*sample_size.
+
+// entry flags
+enum {
+    index_active = 1,       // block was demodulated (not squelched)
+    index_locked = 2        // the loop was tracking for part of the block
+};
+
+// one block, 32 bytes
+struct IndexEntry {
+    uint64_t byte_offset;   // input file offset of the block
+    uint64_t output_sample; // output sample of its first demodulated sample
+    float power_db;         // mean block power, dBFS
+    float freq_est;         // loop frequency estimate at the end of the block
+    uint16_t state;         // demod state at the end of the block
+    uint16_t flags;         // index_active | index_locked
+    uint32_t track_samples; // samples of the block spent in track
+};
+
+struct IndexHeader {
+    char magic[8];          // "DSPINDEX"
+    uint32_t version;
+    uint32_t entry_size;    // sizeof(IndexEntry)
+    uint64_t entries;
+    uint32_t block_samples; // input samples per entry
+    uint32_t sample_size;   // bytes per input sample (c64/c32/sc16)
+};
+
+// a run of samples, [first, first+count)
+struct SampleRegion {
+    uint64_t first;
+    uint64_t count;
+};
+
+// write an index file, returns -1 on failure
+int writeCaptureIndex( const std::string &path, uint32_t block_samples, uint32_t sample_size,
+                       const std::vector<IndexEntry> &entries );
+
+// Read only view of an index file through mmap, so opening the index of a
+// huge capture costs nothing until entries are touched.
+struct CaptureIndex {
+    CaptureIndex();
+    ~CaptureIndex();
+    // map an index file, returns -1 if it is missing or not an index
+    int open( const std::string &path );
+    void close();
+    // entry count and access
+    uint64_t size() const { return header ? header->entries : 0; }
+    const IndexEntry &operator[]( uint64_t n ) const { return entries[n]; }
+    // sample ranges of consecutive blocks that have all of flags set,
+    // total_samples clips the last block to the end of the capture
+    std::vector<SampleRegion> regions( uint16_t flags, uint64_t total_samples ) const;
+
+    const IndexHeader *header;
+    const IndexEntry *entries;
+    void *map;
+    size_t map_len;
+};
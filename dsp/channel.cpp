@@ -0,0 +1,271 @@
+#include "channel.hpp"
+#include <cstring>
+
+Xoshiro256::Xoshiro256( uint64_t seed, int stream ) {
+    // splitmix64 spreads the seed over the whole state
+    uint64_t x = seed;
+    for ( int idx=0; idx < 4; ++idx ) {
+        uint64_t z = ( x += 0x9E3779B97F4A7C15ULL );
+        z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+        z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+        s[idx] = z ^ ( z >> 31 );
+    }
+    for ( int j=0; j < stream; ++j ) {
+        jump();
+    }
+}
+
+void Xoshiro256::jump() {
+    static const uint64_t JUMP[] = { 0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+                                     0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL };
+    uint64_t t[4] = { 0, 0, 0, 0 };
+    for ( int w=0; w < 4; ++w ) {
+        for ( int b=0; b < 64; ++b ) {
+            if ( JUMP[w] & ( 1ULL << b ) ) {
+                for ( int idx=0; idx < 4; ++idx ) {
+                    t[idx] ^= s[idx];
+                }
+            }
+            next();
+        }
+    }
+    for ( int idx=0; idx < 4; ++idx ) {
+        s[idx] = t[idx];
+    }
+}
+
+// Box-Muller without libm calls, so the pass over a block vectorizes
+// (the sqrt needs -fno-math-errno, see CMakeLists.txt).  log() splits off
+// the exponent and sums a series on the mantissa, sin/cos turn a
+// [-pi/4,pi/4) angle by a whole quarter.  Float sums fewer terms, each
+// type is good to about its own precision.
+
+// 1/(2k+1): log(m) = 2s * sum s^2k/(2k+1), s = (m-1)/(m+1)
+static const double log_coeff[] = { 1.0, 1.0/3, 1.0/5, 1.0/7, 1.0/9, 1.0/11, 1.0/13, 1.0/15, 1.0/17,
+                                     1.0/19, 1.0/21 };
+// (-1)^n/(2n)! and (-1)^n/(2n+1)!
+static const double cos_coeff[] = { 1.0, -1.0/2, 1.0/24, -1.0/720, 1.0/40320, -1.0/3628800,
+                                    1.0/479001600, -1.0/87178291200.0, 1.0/20922789888000.0 };
+static const double sin_coeff[] = { 1.0, -1.0/6, 1.0/120, -1.0/5040, 1.0/362880, -1.0/39916800,
+                                    1.0/6227020800.0, -1.0/1307674368000.0, 1.0/355687428096000.0 };
+
+template <typename R>
+struct BoxMullerTraits;
+
+template <>
+struct BoxMullerTraits<float> {
+    using U = uint32_t;
+    static const int mant_bits = 23;
+    static const U one = 0x3f800000;            // 1.0f
+    static const U sqrt_half = 0x3f3504f3;      // sqrt(0.5)f
+    static const int log_terms = 5;
+    static const int trig_terms = 5;
+};
+
+template <>
+struct BoxMullerTraits<double> {
+    using U = uint64_t;
+    static const int mant_bits = 52;
+    static const U one = 0x3ff0000000000000ULL;
+    static const U sqrt_half = 0x3fe6a09e667f3bcdULL;
+    static const int log_terms = 11;
+    static const int trig_terms = 9;
+};
+
+// natural log of a positive normal x
+template <typename R>
+static inline R seriesLog( R x ) {
+    typedef BoxMullerTraits<R> B;
+    typename B::U bits;
+    memcpy( &bits, &x, sizeof(bits) );
+    // moved so the mantissa lands in [sqrt(0.5), sqrt(2)), no branch
+    bits += B::one - B::sqrt_half;
+    int e = int( bits >> B::mant_bits ) - int( B::one >> B::mant_bits );
+    bits = ( bits & ( ( typename B::U(1) << B::mant_bits ) - 1 ) ) + B::sqrt_half;
+    R m;
+    memcpy( &m, &bits, sizeof(m) );
+    R s = ( m - 1 ) / ( m + 1 );
+    R s2 = s*s;
+    R p = R( log_coeff[B::log_terms-1] );
+    for ( int k=B::log_terms-2; k >= 0; --k ) {
+        p = p*s2 + R( log_coeff[k] );
+    }
+    return R(e)*R(M_LN2) + 2*s*p;
+}
+
+// u1 in (0,1] and u2 in [0,1), one pair per value pair
+static void drawUniforms( Xoshiro256 &rng, float *u1, float *u2, int pairs ) {
+    // 24 bits each, both from one draw
+    const float scale = 1.0f/16777216;
+    for ( int idx=0; idx < pairs; ++idx ) {
+        uint64_t x = rng.next();
+        u1[idx] = float( ( x >> 40 ) + 1 ) * scale;
+        u2[idx] = float( ( x >> 16 ) & 0xffffff ) * scale;
+    }
+}
+
+static void drawUniforms( Xoshiro256 &rng, double *u1, double *u2, int pairs ) {
+    const double scale = 1.0/9007199254740992.0;
+    for ( int idx=0; idx < pairs; ++idx ) {
+        u1[idx] = double( ( rng.next() >> 11 ) + 1 ) * scale;
+        u2[idx] = double( rng.next() >> 11 ) * scale;
+    }
+}
+
+template <typename R>
+void GaussianT<R>::fillPairs( int pairs, R sigma ) {
+    typedef BoxMullerTraits<R> B;
+    u1.resize( pairs );
+    u2.resize( pairs );
+    drawUniforms( rng, u1.data(), u2.data(), pairs );
+    R *a1 = u1.data();
+    R *a2 = u2.data();
+    for ( int idx=0; idx < pairs; ++idx ) {
+        R r = sigma * std::sqrt( R(-2) * seriesLog( a1[idx] ) );
+        // quarter k, and an angle in [-pi/4,pi/4) within it
+        R q = a2[idx] * 4;
+        int k = int( q );
+        R a = ( q - R(k) - R(0.5) ) * R(M_PI/2);
+        R sq = a*a;
+        R c = R( cos_coeff[B::trig_terms-1] );
+        R s = R( sin_coeff[B::trig_terms-1] );
+        for ( int n=B::trig_terms-2; n >= 0; --n ) {
+            c = c*sq + R( cos_coeff[n] );
+            s = s*sq + R( sin_coeff[n] );
+        }
+        s *= a;
+        // turn by k quarters: odd k takes (c,s) to (-s,c), k >= 2 negates
+        R odd = R( k & 1 );
+        R sign = R(1) - R( k & 2 );
+        a1[idx] = r * sign * ( c - odd*( c + s ) );
+        a2[idx] = r * sign * ( s + odd*( c - s ) );
+    }
+}
+
+template <typename R>
+void GaussianT<R>::fill( R *out, int count, R sigma ) {
+    int pairs = ( count + 1 ) / 2;
+    fillPairs( pairs, sigma );
+    for ( int idx=0; idx < count/2; ++idx ) {
+        out[2*idx] = u1[idx];
+        out[2*idx+1] = u2[idx];
+    }
+    if ( count & 1 ) {
+        out[count-1] = u1[pairs-1];
+    }
+}
+
+template <typename R>
+void AWGNT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    // a pair per sample, I and Q
+    gauss.fillPairs( count, sigma );
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = CSampleT<R>( in[idx].real() + gauss.u1[idx], in[idx].imag() + gauss.u2[idx] );
+    }
+}
+
+template <typename R>
+R AWGNT<R>::sigmaFromEsN0( double esn0_db ) {
+    return R( std::sqrt( 0.5 / std::pow( 10.0, esn0_db / 10.0 ) ) );
+}
+
+template <typename R>
+R AWGNT<R>::sigmaFromEbN0( double ebn0_db, int bits_per_symbol ) {
+    return sigmaFromEsN0( ebn0_db + 10.0*std::log10( (double)bits_per_symbol ) );
+}
+
+template <typename R>
+void CarrierOffsetT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = in[idx] * CSampleT<R>( R(std::cos(phase)), R(std::sin(phase)) );
+        phase = std::remainder( phase + rate, 2*M_PI );
+        rate += drift;
+    }
+}
+
+template <typename R>
+PhaseNoiseT<R>::PhaseNoiseT( double linewidth, uint64_t seed, int stream ) : gauss( seed, stream ) {
+    step_sigma = std::sqrt( 2*M_PI*linewidth );
+    phase = 0;
+}
+
+template <typename R>
+void PhaseNoiseT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    steps.resize( count );
+    gauss.fill( steps.data(), count, R(step_sigma) );
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = in[idx] * CSampleT<R>( R(std::cos(phase)), R(std::sin(phase)) );
+        phase = std::remainder( phase + steps[idx], 2*M_PI );
+    }
+}
+
+template <typename R>
+ClockDriftT<R>::ClockDriftT( double ppm, double drift_ppm ) {
+    ratio = 1.0 + ppm*1e-6;
+    drift = drift_ppm*1e-6;
+    mu = 0;
+    for ( auto &h: hist ) {
+        h = CSampleT<R>(0,0);
+    }
+}
+
+template <typename R>
+int ClockDriftT<R>::process( const CSampleT<R> *in, int count, CSampleVectorT<R> *out ) {
+    int produced = 0;
+    for ( int idx=0; idx < count; ++idx ) {
+        hist[0] = hist[1];
+        hist[1] = hist[2];
+        hist[2] = hist[3];
+        hist[3] = in[idx];
+        // outputs fall between hist[1] and hist[2]
+        while ( mu < 1.0 ) {
+            R m = R(mu);
+            // Lagrange basis at points -1, 0, 1, 2
+            R c0 = -m*(m-1)*(m-2) / 6;
+            R c1 = (m+1)*(m-1)*(m-2) / 2;
+            R c2 = -(m+1)*m*(m-2) / 2;
+            R c3 = (m+1)*m*(m-1) / 6;
+            out->push_back( c0*hist[0] + c1*hist[1] + c2*hist[2] + c3*hist[3] );
+            produced++;
+            mu += ratio;
+            ratio += drift;
+        }
+        mu -= 1.0;
+    }
+    return produced;
+}
+
+template <typename R>
+MultipathT<R>::MultipathT( CSampleVectorT<R> _taps ) {
+    taps = _taps;
+    hist.assign( 2*taps.size(), CSampleT<R>(0,0) );
+    pos = 0;
+}
+
+template <typename R>
+void MultipathT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    int n = taps.size();
+    for ( int idx=0; idx < count; ++idx ) {
+        pos = ( pos == 0 ) ? n-1 : pos-1;
+        hist[pos] = in[idx];
+        hist[pos+n] = in[idx];
+        const CSampleT<R> *h = &hist[pos];
+        CSampleT<R> acc(0,0);
+        for ( int k=0; k < n; ++k ) {
+            acc += taps[k] * h[k];
+        }
+        out[idx] = acc;
+    }
+}
+
+// float (c32) and double (c64) precision instantiations
+#define CHANNEL_INSTANTIATE(R) \
+    template struct GaussianT<R>; \
+    template struct AWGNT<R>; \
+    template struct CarrierOffsetT<R>; \
+    template struct PhaseNoiseT<R>; \
+    template struct ClockDriftT<R>; \
+    template struct MultipathT<R>;
+
+CHANNEL_INSTANTIATE(float)
+CHANNEL_INSTANTIATE(double)
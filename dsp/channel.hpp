@@ -0,0 +1,132 @@
+#pragma once
+#include "libdsp.hpp"
+
+/////////////////////////////
+// Channel emulation
+///////////////////////////
+//
+// Impairment blocks for building test signals: AWGN, carrier offset and
+// drift, phase noise, sample clock drift and static multipath.  Every
+// block works on blocks of samples and draws its randomness from its own
+// Xoshiro256 stream, so a run is reproducible from (seed, stream) and
+// threads generating different parts of a capture never share state.
+//
+//   // BPSK at 6 dB Eb/N0 (1 bit per symbol, whatever the samples per symbol)
+//   AWGNT<float> awgn( AWGNT<float>::sigmaFromEbN0(6.0), seed, thread_id );
+//   awgn.process( in, out, count );
+
+// xoshiro256** generator (Blackman & Vigna).  Fast, 256 bits of state,
+// and jump() advances 2^128 draws, so stream n of a seed is n jumps in
+// and never overlaps another stream.
+struct Xoshiro256 {
+    uint64_t s[4];
+    // seed with splitmix64, then jump stream times
+    Xoshiro256( uint64_t seed=1, int stream=0 );
+    inline uint64_t next() {
+        uint64_t result = rotl( s[1] * 5, 7 ) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl( s[3], 45 );
+        return result;
+    }
+    // uniform in [0,1)
+    inline double uniform() { return ( next() >> 11 ) * ( 1.0 / 9007199254740992.0 ); }
+    // advance 2^128 draws
+    void jump();
+    static inline uint64_t rotl( uint64_t x, int k ) { return ( x << k ) | ( x >> ( 64 - k ) ); }
+};
+
+// Block Gaussian source, Box-Muller over whole blocks.  Uniforms are drawn
+// first (two 24 bit ones per draw for float), then the log/sqrt/sin/cos
+// pass runs as a loop over the arrays with series in place of libm calls,
+// which the compiler vectorizes.
+template <typename R>
+struct GaussianT {
+    Xoshiro256 rng;
+    std::vector<R> u1;
+    std::vector<R> u2;
+    GaussianT( uint64_t seed=1, int stream=0 ) : rng( seed, stream ) {}
+    // fill out with count N(0, sigma^2) values
+    void fill( R *out, int count, R sigma=1 );
+    // pairs of values into u1 and u2 (pairs of each)
+    void fillPairs( int pairs, R sigma=1 );
+};
+
+// additive white gaussian noise
+template <typename R>
+struct AWGNT {
+    R sigma;    // per dimension (I and Q each)
+    GaussianT<R> gauss;
+    AWGNT( R _sigma, uint64_t seed=1, int stream=0 ) : sigma(_sigma), gauss( seed, stream ) {}
+    // out = in + noise (in and out may be the same buffer)
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    // per dimension sigma, sqrt(N0/2) with Es = 1.  Holds at any samples
+    // per symbol if each symbol's pulse has unit energy (taps with a sum
+    // of squares of 1) and the receiver matched filters, so there is no
+    // sps argument.
+    static R sigmaFromEsN0( double esn0_db );
+    // Es = bits_per_symbol * Eb, 1 for BPSK, 2 for QPSK
+    static R sigmaFromEbN0( double ebn0_db, int bits_per_symbol=1 );
+};
+
+// carrier frequency offset with linear drift.  rate is rads/sample and
+// grows by drift rads/sample every sample.  Phase is kept in double so
+// long runs don't lose accuracy in float.
+template <typename R>
+struct CarrierOffsetT {
+    double rate;
+    double drift;
+    double phase;
+    CarrierOffsetT( RadRate _rate, double _drift=0, Phase _phase=0 ) : rate(_rate), drift(_drift), phase(_phase) {}
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+};
+
+// Wiener (random walk) phase noise.  The phase moves by N(0, 2pi*B)
+// every sample, B is the oscillator's -3 dB linewidth as a fraction of
+// the sample rate.
+template <typename R>
+struct PhaseNoiseT {
+    double step_sigma;
+    double phase;
+    GaussianT<R> gauss;
+    std::vector<R> steps;
+    PhaseNoiseT( double linewidth, uint64_t seed=1, int stream=0 );
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+};
+
+// Sample clock offset and drift.  Resamples by ratio (input samples per
+// output sample, 1 + ppm*1e-6) with 4 point Lagrange interpolation, the
+// ratio changes by drift every output sample.  The number of outputs per
+// block varies, they are appended to out.  Output k is input time
+// k*ratio - 2 (two samples of interpolator delay).
+template <typename R>
+struct ClockDriftT {
+    double ratio;
+    double drift;
+    double mu;              // position of the next output past hist[1]
+    CSampleT<R> hist[4];    // last 4 inputs, oldest first
+    ClockDriftT( double ppm, double drift_ppm=0 );
+    int process( const CSampleT<R> *in, int count, CSampleVectorT<R> *out );
+};
+
+// Static multipath, a complex FIR of path gains (tap n = delay of n
+// samples).  Doubled delay line like CFIRFilterQ15.
+template <typename R>
+struct MultipathT {
+    CSampleVectorT<R> taps;
+    CSampleVectorT<R> hist;
+    int pos;
+    MultipathT( CSampleVectorT<R> _taps );
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+};
+
+using Gaussian = GaussianT<double>;
+using AWGN = AWGNT<double>;
+using CarrierOffset = CarrierOffsetT<double>;
+using PhaseNoise = PhaseNoiseT<double>;
+using ClockDrift = ClockDriftT<double>;
+using Multipath = MultipathT<double>;
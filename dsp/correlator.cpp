@@ -0,0 +1,169 @@
+#include "correlator.hpp"
+
+template <typename R>
+CorrelatorT<R>::CorrelatorT( std::vector< CSampleT<R> > _ref, double _threshold,
+                             correlator_method_t _method, int _fft_size ) {
+    ref = _ref;
+    ref_energy = 0;
+    for ( auto &r : ref ) {
+        ref_energy += std::norm( r );
+    }
+    threshold = _threshold;
+    method = _method;
+    if ( method == correlate_auto ) {
+        method = (int)ref.size() > direct_max ? correlate_fft : correlate_direct;
+    }
+    fft_size = 0;
+    if ( method == correlate_fft ) {
+        // at least 4x the reference, so most of each transform is output
+        fft_size = 1;
+        while ( fft_size < std::max( _fft_size, 4*(int)ref.size() ) ) {
+            fft_size <<= 1;
+        }
+        fft = std::make_shared< FFTT<R> >( fft_size );
+        ref_fft.assign( fft_size, CSampleT<R>(0,0) );
+        std::copy( ref.begin(), ref.end(), ref_fft.begin() );
+        fft->forward( ref_fft.data() );
+        // correlation is ifft( X * conj(REF) ), fold in the 1/N of the inverse
+        for ( auto &r : ref_fft ) {
+            r = std::conj( r ) / R( fft_size );
+        }
+        work.resize( fft_size );
+    }
+    base = 0;
+    in_peak = false;
+}
+
+template <typename R>
+CSampleT<R> CorrelatorT<R>::correlateAt( const CSampleT<R> *x, int from, int to ) const {
+    // sum conj(ref[k])*x[k] over ref[from..to), on flat I/Q arrays
+    const R *rv = reinterpret_cast<const R*>( ref.data() );
+    const R *xv = reinterpret_cast<const R*>( x );
+    R re = 0;
+    R im = 0;
+    for ( int k=from; k < to; ++k ) {
+        R rr = rv[2*k];
+        R ri = rv[2*k+1];
+        R xr = xv[2*k];
+        R xi = xv[2*k+1];
+        re += rr*xr + ri*xi;
+        im += rr*xi - ri*xr;
+    }
+    return CSampleT<R>( re, im );
+}
+
+template <typename R>
+void CorrelatorT<R>::correlateDirect( int outputs ) {
+    // tap outer, output inner on planar I/Q, so the inner loop has no
+    // reduction and vectorizes
+    const int len = ref.size();
+    xr.resize( buf.size() );
+    xi.resize( buf.size() );
+    for ( size_t idx=0; idx < buf.size(); ++idx ) {
+        xr[idx] = buf[idx].real();
+        xi[idx] = buf[idx].imag();
+    }
+    cr.assign( outputs, 0 );
+    ci.assign( outputs, 0 );
+    R *pr = cr.data();
+    R *pi = ci.data();
+    for ( int k=0; k < len; ++k ) {
+        const R rr = ref[k].real();
+        const R ri = ref[k].imag();
+        const R *a = xr.data() + k;
+        const R *b = xi.data() + k;
+        for ( int n=0; n < outputs; ++n ) {
+            pr[n] += rr*a[n] + ri*b[n];
+            pi[n] += rr*b[n] - ri*a[n];
+        }
+    }
+    for ( int n=0; n < outputs; ++n ) {
+        corr[n] = CSampleT<R>( cr[n], ci[n] );
+    }
+}
+
+template <typename R>
+void CorrelatorT<R>::correlateFFT( int outputs ) {
+    // overlap-save, each transform of fft_size samples gives
+    // fft_size-len+1 valid correlations
+    const int len = ref.size();
+    const int step = fft_size - len + 1;
+    for ( int n=0; n < outputs; n += step ) {
+        int avail = std::min( fft_size, (int)buf.size() - n );
+        std::copy( buf.begin()+n, buf.begin()+n+avail, work.begin() );
+        std::fill( work.begin()+avail, work.end(), CSampleT<R>(0,0) );
+        fft->forward( work.data() );
+        for ( int k=0; k < fft_size; ++k ) {
+            const CSampleT<R> &a = work[k];
+            const CSampleT<R> &b = ref_fft[k];
+            work[k] = CSampleT<R>( a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real() );
+        }
+        fft->inverse( work.data() );
+        int count = std::min( step, outputs - n );
+        std::copy( work.begin(), work.begin()+count, corr.begin()+n );
+    }
+}
+
+template <typename R>
+void CorrelatorT<R>::detect( int outputs, std::vector<CorrelatorHit> *hits ) {
+    const int len = ref.size();
+    // window energy, restarted every call so rounding can't build up
+    R energy = 0;
+    for ( int k=0; k < len; ++k ) {
+        energy += std::norm( buf[k] );
+    }
+    for ( int n=0; n < outputs; ++n ) {
+        if ( n > 0 ) {
+            energy += std::norm( buf[n+len-1] ) - std::norm( buf[n-1] );
+        }
+        R denom = ref_energy * energy;
+        R m = denom > 0 ? std::norm( corr[n] ) / denom : 0;
+        uint64_t at = base + n;
+        if ( in_peak && ( m < threshold || at - best.offset >= (uint64_t)len ) ) {
+            hits->push_back( best );
+            in_peak = false;
+        }
+        if ( m >= threshold && ( !in_peak || m > best.metric ) ) {
+            best.offset = at;
+            best.metric = m;
+            best.phase = std::arg( corr[n] );
+            // phase step between the halves of the reference gives frequency
+            CSampleT<R> first = correlateAt( &buf[n], 0, len/2 );
+            CSampleT<R> second = correlateAt( &buf[n], len/2, len );
+            best.freq = std::arg( second * std::conj( first ) ) / ( len/2 );
+            in_peak = true;
+        }
+    }
+}
+
+template <typename R>
+void CorrelatorT<R>::process( const CSampleT<R> *in, int count, std::vector<CorrelatorHit> *hits ) {
+    const int len = ref.size();
+    buf.insert( buf.end(), in, in+count );
+    int outputs = (int)buf.size() - len + 1;
+    if ( method == correlate_fft ) {
+        // only whole transforms, short calls wait for more samples
+        int step = fft_size - len + 1;
+        outputs = ( outputs / step ) * step;
+    }
+    if ( outputs <= 0 ) {
+        return;
+    }
+    corr.resize( outputs );
+    if ( method == correlate_fft ) {
+        correlateFFT( outputs );
+    } else {
+        correlateDirect( outputs );
+    }
+    detect( outputs, hits );
+    // keep the last len-1 samples for the next call
+    buf.erase( buf.begin(), buf.begin()+outputs );
+    base += outputs;
+}
+
+// float (c32) and double (c64) precision instantiations
+#define CORRELATOR_INSTANTIATE(R) \
+    template struct CorrelatorT<R>;
+
+CORRELATOR_INSTANTIATE(float)
+CORRELATOR_INSTANTIATE(double)
@@ -0,0 +1,76 @@
+#pragma once
+#include "libdsp.hpp"
+
+/////////////////////////////
+// Correlator (burst / frame sync)
+///////////////////////////
+//
+// Streams samples against a known reference (a preamble or unique word)
+// and reports every place it shows up.  Works on raw samples ahead of
+// BpskDemod (reference = the modulated preamble at the capture's sps,
+// burst detect) or on sliced symbols after it (reference = the sync word
+// as +/-1, frame sync).
+//
+// The metric is the normalized correlation |c|^2 / (|ref|^2 * |window|^2),
+// 0 to 1 and independent of the signal level.  A hit is the largest metric
+// of a run of samples at or over the threshold.  Short references are
+// correlated directly (flat multiply-add loop the compiler vectorizes),
+// long ones by overlap-save FFT, O(log N) per sample instead of O(L).
+//
+//   CorrelatorT<float> sync( preamble, 0.6 );
+//   std::vector< CorrelatorHit > hits;
+//   sync.process( in, count, &hits );
+
+struct CorrelatorHit {
+    uint64_t offset;    // stream sample where the reference starts
+    double metric;      // normalized correlation, 0..1
+    double phase;       // phase of the match (rads) at the middle of the reference
+    double freq;        // coarse frequency offset (rads/sample), from the two halves
+};
+
+enum correlator_method_t {
+    correlate_auto,     // direct up to direct_max taps, FFT above
+    correlate_direct,
+    correlate_fft
+};
+
+template <typename R>
+struct CorrelatorT {
+    // references up to this long are correlated directly by default, about
+    // where the FFT path starts winning (dsp_bench -k Correlator)
+    static const int direct_max = 32;
+
+    std::vector< CSampleT<R> > ref;
+    R ref_energy;
+    R threshold;
+    correlator_method_t method;
+    // FFT path, fft_size samples in, fft_size-len+1 correlations out
+    int fft_size;
+    std::shared_ptr< FFTT<R> > fft;
+    std::vector< CSampleT<R> > ref_fft;  // conj(FFT(ref)) / fft_size
+    std::vector< CSampleT<R> > work;
+    // samples not yet correlated, buf[0] is stream sample base
+    std::vector< CSampleT<R> > buf;
+    uint64_t base;
+    std::vector< CSampleT<R> > corr;
+    // direct path, planar copies of buf and the correlation
+    std::vector<R> xr, xi, cr, ci;
+    // peak being followed
+    bool in_peak;
+    CorrelatorHit best;
+
+    CorrelatorT( std::vector< CSampleT<R> > _ref, double _threshold,
+                 correlator_method_t _method=correlate_auto, int _fft_size=0 );
+    // correlate count more samples, hits found are appended.  A hit is
+    // reported once its run drops under the threshold (or after a
+    // reference length), so it can trail the input by that much, plus up
+    // to a transform's worth of samples on the FFT path.
+    void process( const CSampleT<R> *in, int count, std::vector<CorrelatorHit> *hits );
+    // sum of conj(ref[k])*x[k] for k in [from,to)
+    CSampleT<R> correlateAt( const CSampleT<R> *x, int from, int to ) const;
+
+    void correlateDirect( int outputs );
+    void correlateFFT( int outputs );
+    void detect( int outputs, std::vector<CorrelatorHit> *hits );
+};
+using Correlator = CorrelatorT<double>;
@@ -0,0 +1,316 @@
+#include <iostream>
+#include "decimate.hpp"
+
+// passband kept through the cascade, fraction of the output rate
+static const double decim_pass = 0.2;
+// Blackman windowed designs, transition width is about 5.5/taps
+static const double blackman_width = 5.5;
+
+static double blackman( int n, int len ) {
+    // n in [0,len), the end points are not zero
+    double x = 2*M_PI*( n+1 ) / ( len+1 );
+    return 0.42 - 0.5*std::cos( x ) + 0.08*std::cos( 2*x );
+}
+
+template <typename R>
+CICDecimatorT<R>::CICDecimatorT( int _stages, int _decim ) {
+    stages = _stages;
+    decim = _decim;
+    // the integrators grow by stages*log2(decim) bits, keep a sign and a
+    // guard bit for inputs a little over full scale
+    int growth = std::ceil( stages*std::log2( (double)decim ) );
+    in_bits = std::min( 30, 62 - growth );
+    in_scale = std::ldexp( 1.0, in_bits );
+    out_scale = 1.0 / ( std::pow( (double)decim, stages ) * std::ldexp( 1.0, in_bits ) );
+    integ.assign( 2*stages, 0 );
+    comb.assign( 2*stages, 0 );
+    phase = 0;
+}
+
+template <typename R>
+int CICDecimatorT<R>::process( const CSampleT<R> *in, int count, CSampleT<R> *out ) {
+    int n = 0;
+    uint64_t *acc = integ.data();
+    for ( int idx=0; idx < count; ++idx ) {
+        uint64_t xi = (uint64_t)(int64_t)std::llrint( in[idx].real()*in_scale );
+        uint64_t xq = (uint64_t)(int64_t)std::llrint( in[idx].imag()*in_scale );
+        for ( int s=0; s < stages; ++s ) {
+            xi = acc[2*s] += xi;
+            xq = acc[2*s+1] += xq;
+        }
+        if ( ++phase < decim ) {
+            continue;
+        }
+        phase = 0;
+        for ( int s=0; s < stages; ++s ) {
+            uint64_t yi = xi - comb[2*s];
+            uint64_t yq = xq - comb[2*s+1];
+            comb[2*s] = xi;
+            comb[2*s+1] = xq;
+            xi = yi;
+            xq = yq;
+        }
+        out[n++] = CSampleT<R>( R( (int64_t)xi*out_scale ), R( (int64_t)xq*out_scale ) );
+    }
+    return n;
+}
+
+template <typename R>
+CFIRDecimatorT<R>::CFIRDecimatorT( std::vector<double> taps, int _decim ) {
+    decim = _decim;
+    coeff.assign( taps.begin(), taps.end() );
+    len = coeff.size();
+    hist.assign( 2*len, CSampleT<R>(0,0) );
+    pos = 0;
+    phase = 0;
+}
+
+template <typename R>
+int CFIRDecimatorT<R>::process( const CSampleT<R> *in, int count, CSampleT<R> *out ) {
+    int n = 0;
+    for ( int idx=0; idx < count; ++idx ) {
+        // newest sample first, doubled so the history is contiguous
+        pos = ( pos == 0 ) ? len-1 : pos-1;
+        hist[pos] = in[idx];
+        hist[pos+len] = in[idx];
+        if ( ++phase < decim ) {
+            continue;
+        }
+        phase = 0;
+        const R *h = reinterpret_cast<const R*>( &hist[pos] );
+        R acc_i = 0;
+        R acc_q = 0;
+        for ( int k=0; k < len; ++k ) {
+            acc_i += coeff[k] * h[2*k];
+            acc_q += coeff[k] * h[2*k+1];
+        }
+        out[n++] = CSampleT<R>( acc_i, acc_q );
+    }
+    return n;
+}
+
+template <typename R>
+CHalfBandT<R>::CHalfBandT( std::vector<double> taps ) {
+    len = taps.size();
+    int c = len / 2;
+    centre = taps[c];
+    for ( int k=c+1; k < len; k += 2 ) {
+        coeff.push_back( taps[k] );
+    }
+    hist.assign( 2*len, CSampleT<R>(0,0) );
+    pos = 0;
+    phase = 0;
+}
+
+template <typename R>
+int CHalfBandT<R>::process( const CSampleT<R> *in, int count, CSampleT<R> *out ) {
+    int n = 0;
+    const int c = len / 2;
+    const int half = coeff.size();
+    for ( int idx=0; idx < count; ++idx ) {
+        pos = ( pos == 0 ) ? len-1 : pos-1;
+        hist[pos] = in[idx];
+        hist[pos+len] = in[idx];
+        if ( ++phase < 2 ) {
+            continue;
+        }
+        phase = 0;
+        // centre tap, then the odd offsets folded in symmetric pairs
+        const CSampleT<R> *h = &hist[pos];
+        R acc_i = centre * h[c].real();
+        R acc_q = centre * h[c].imag();
+        for ( int j=0; j < half; ++j ) {
+            const CSampleT<R> &a = h[c-1-2*j];
+            const CSampleT<R> &b = h[c+1+2*j];
+            acc_i += coeff[j] * ( a.real() + b.real() );
+            acc_q += coeff[j] * ( a.imag() + b.imag() );
+        }
+        out[n++] = CSampleT<R>( acc_i, acc_q );
+    }
+    return n;
+}
+
+std::vector<double> computeHalfBand( int taps ) {
+    int len = 7;
+    while ( len < taps ) {
+        len += 4;
+    }
+    std::vector<double> h( len, 0.0 );
+    int c = len / 2;
+    double odd_sum = 0;
+    for ( int m=1; m <= c; m += 2 ) {
+        double t = std::sin( M_PI*m/2 ) / ( M_PI*m ) * blackman( c+m, len );
+        h[c+m] = t;
+        h[c-m] = t;
+        odd_sum += 2*t;
+    }
+    // centre stays exactly 0.5 (a true half-band), the odd taps make up
+    // the rest of unity gain at DC
+    for ( int m=1; m <= c; m += 2 ) {
+        h[c+m] *= 0.5 / odd_sum;
+        h[c-m] *= 0.5 / odd_sum;
+    }
+    h[c] = 0.5;
+    return h;
+}
+
+std::vector<double> computeCICComp( int taps, double pass, double stop, int cic_stages, int cic_decim ) {
+    int len = taps | 1;
+    stop = std::min( stop, 0.5 );
+    // desired response: inverse CIC droop over the passband, raised cosine
+    // down to 0 at stop, then the taps by numerically integrating the
+    // inverse transform over a fine grid
+    const int grid = 4096;
+    std::vector<double> want( grid );
+    for ( int g=0; g < grid; ++g ) {
+        double f = ( g + 0.5 ) * 0.5 / grid;
+        double shape = 0;
+        if ( f <= pass ) {
+            shape = 1;
+        } else if ( f < stop ) {
+            shape = 0.5 + 0.5*std::cos( M_PI*( f - pass ) / ( stop - pass ) );
+        }
+        if ( shape > 0 && cic_stages > 0 ) {
+            double droop = std::sin( M_PI*f ) / ( cic_decim*std::sin( M_PI*f/cic_decim ) );
+            shape /= std::pow( std::abs( droop ), cic_stages );
+        }
+        want[g] = shape;
+    }
+    std::vector<double> h( len );
+    int c = len / 2;
+    double sum = 0;
+    for ( int n=0; n < len; ++n ) {
+        double acc = 0;
+        for ( int g=0; g < grid; ++g ) {
+            double f = ( g + 0.5 ) * 0.5 / grid;
+            acc += want[g] * std::cos( 2*M_PI*f*( n - c ) );
+        }
+        h[n] = acc / grid * blackman( n, len );
+        sum += h[n];
+    }
+    for ( auto &t: h ) {
+        t /= sum;
+    }
+    return h;
+}
+
+// smallest tap count that gets a Blackman design from pass to stop
+static int tapsFor( double pass, double stop ) {
+    return (int)std::ceil( blackman_width / ( stop - pass ) ) | 1;
+}
+
+int planDecimation( int factor, DecimPlan *plan ) {
+    DecimPlan p;
+    if ( factor < 1 ) {
+        std::cout << "Decimation factor must be 1 or more : " << factor << std::endl;
+        return -1;
+    }
+    p.factor = factor;
+    int twos = 0;
+    while ( ( ( factor >> twos ) & 1 ) == 0 ) {
+        ++twos;
+    }
+    int halfbands;
+    if ( factor == ( 1 << twos ) && factor <= 8 ) {
+        // small powers of 2 are half-bands only
+        halfbands = twos;
+    } else {
+        // the CIC takes what it can, leaving /2 for the compensation FIR
+        // and /2 for a half-band where the factor allows
+        halfbands = twos >= 2 ? 1 : 0;
+        p.comp_decim = twos >= 1 ? 2 : 1;
+        p.cic_decim = factor / ( p.comp_decim << halfbands );
+        // integrator growth has to leave at least 22 bits of input
+        double bits = std::log2( (double)p.cic_decim );
+        if ( 4*bits <= 40 ) {
+            p.cic_stages = 4;
+        } else if ( 3*bits <= 40 ) {
+            p.cic_stages = 3;
+        } else {
+            std::cout << "Decimation factor too large for the CIC : " << factor << std::endl;
+            return -1;
+        }
+    }
+    // passband at each stage's input rate, working back from the output
+    double pass = decim_pass;
+    p.halfband_taps.resize( halfbands );
+    for ( int k=halfbands-1; k >= 0; --k ) {
+        pass /= 2;
+        int len = tapsFor( pass, 0.5 - pass );
+        p.halfband_taps[k] = computeHalfBand( len ).size();
+    }
+    if ( p.cic_stages > 0 ) {
+        pass /= p.comp_decim;
+        double stop = p.comp_decim == 2 ? 0.5 - pass : 0.5;
+        p.comp_taps = tapsFor( pass, stop );
+    }
+    *plan = p;
+    return 0;
+}
+
+std::string describeDecimation( const DecimPlan &plan ) {
+    std::string s;
+    if ( plan.cic_stages > 0 ) {
+        s += "CIC " + std::to_string( plan.cic_stages ) + "x/" + std::to_string( plan.cic_decim );
+    }
+    if ( plan.comp_taps > 0 ) {
+        s += ", comp " + std::to_string( plan.comp_taps ) + " taps/" + std::to_string( plan.comp_decim );
+    }
+    for ( int taps: plan.halfband_taps ) {
+        s += ( s.length() ? ", " : "" );
+        s += "half-band " + std::to_string( taps ) + " taps";
+    }
+    return s.length() ? s : "none";
+}
+
+template <typename R>
+DecimatorT<R>::DecimatorT( const DecimPlan &_plan ) {
+    plan = _plan;
+    if ( plan.cic_stages > 0 ) {
+        cic = std::make_shared< CICDecimatorT<R> >( plan.cic_stages, plan.cic_decim );
+    }
+    if ( plan.comp_taps > 0 ) {
+        // the passband the planner sized it for, at the CIC output rate
+        double pass = decim_pass / ( plan.comp_decim << plan.halfband_taps.size() );
+        double stop = plan.comp_decim == 2 ? 0.5 - pass : 0.5;
+        comp = std::make_shared< CFIRDecimatorT<R> >(
+            computeCICComp( plan.comp_taps, pass, stop, plan.cic_stages, plan.cic_decim ), plan.comp_decim );
+    }
+    for ( int taps: plan.halfband_taps ) {
+        halfbands.push_back( std::make_shared< CHalfBandT<R> >( computeHalfBand( taps ) ) );
+    }
+}
+
+template <typename R>
+int DecimatorT<R>::process( const CSampleT<R> *in, int count, CSampleT<R> *out ) {
+    // every stage writes output n only after reading input n*decim, so
+    // each one can run in place on the previous one's output
+    const CSampleT<R> *src = in;
+    int n = count;
+    if ( cic ) {
+        n = cic->process( src, n, out );
+        src = out;
+    }
+    if ( comp ) {
+        n = comp->process( src, n, out );
+        src = out;
+    }
+    for ( auto &hb: halfbands ) {
+        n = hb->process( src, n, out );
+        src = out;
+    }
+    if ( src != out ) {
+        std::copy( src, src+n, out );
+    }
+    return n;
+}
+
+// float (c32) and double (c64) precision instantiations
+#define DECIMATE_INSTANTIATE(R) \
+    template struct CICDecimatorT<R>; \
+    template struct CFIRDecimatorT<R>; \
+    template struct CHalfBandT<R>; \
+    template struct DecimatorT<R>;
+
+DECIMATE_INSTANTIATE(float)
+DECIMATE_INSTANTIATE(double)
@@ -0,0 +1,107 @@
+#pragma once
+#include "libdsp.hpp"
+
+/////////////////////////////
+// Decimation (high rate captures down to the demod's 4 sps)
+///////////////////////////
+//
+// A capture at tens of Msps holding a narrow signal is brought down to
+// the demod rate by a cascade, cheapest stage at the highest rate:
+//
+//   CIC / M  ->  compensation FIR / 2  ->  half-band / 2  (-> BpskDemod)
+//
+// The CIC is adds and subtracts only (integers, so the integrators wrap
+// instead of drifting), the compensation FIR flattens the CIC's droop
+// over the passband, and the half-band skips its zero taps and folds the
+// symmetric ones, about a quarter of the multiplies of a plain FIR of the
+// same length.  planDecimation() picks the split for a total factor.
+//
+//   DecimPlan plan;
+//   planDecimation( 16, &plan );        // 64 Msps at 64 sps -> 4 sps
+//   DecimatorT<float> dec( plan );
+//   int n = dec.process( in, count, out );
+
+// CIC decimator, stages integrators at the input rate then stages combs
+// (differential delay 1) at the output rate.  Samples are quantized to
+// in_bits fraction bits, sized so the CIC gain decim^stages still fits in
+// 64 bits.  Output is scaled back to unity gain at DC.
+template <typename R>
+struct CICDecimatorT {
+    int stages;
+    int decim;
+    int in_bits;
+    R in_scale;
+    R out_scale;
+    std::vector<uint64_t> integ;    // [2*stage + (0 i, 1 q)], wrap around is intended
+    std::vector<uint64_t> comb;     // previous comb inputs, same layout
+    int phase;                      // inputs since the last output
+    CICDecimatorT( int _stages, int _decim );
+    // decimate count samples, returns the number written to out
+    int process( const CSampleT<R> *in, int count, CSampleT<R> *out );
+};
+using CICDecimator = CICDecimatorT<double>;
+
+// FIR decimator with real taps, only every decim'th output is computed.
+template <typename R>
+struct CFIRDecimatorT {
+    int decim;
+    std::vector<R> coeff;                // coeff[k] multiplies the k'th newest sample
+    std::vector< CSampleT<R> > hist;     // history, doubled
+    int len;
+    int pos;
+    int phase;
+    CFIRDecimatorT( std::vector<double> taps, int _decim );
+    int process( const CSampleT<R> *in, int count, CSampleT<R> *out );
+};
+using CFIRDecimator = CFIRDecimatorT<double>;
+
+// Half-band decimate by 2.  taps is 4k+3 long: every other tap away from
+// the centre is zero and the rest are symmetric, so an output costs k+2
+// multiplies per I/Q instead of 4k+3.
+template <typename R>
+struct CHalfBandT {
+    std::vector<R> coeff;                // non-zero taps, centre+1, centre+3, ..
+    R centre;
+    std::vector< CSampleT<R> > hist;     // history, doubled
+    int len;
+    int pos;
+    int phase;
+    CHalfBandT( std::vector<double> taps );
+    int process( const CSampleT<R> *in, int count, CSampleT<R> *out );
+};
+using CHalfBand = CHalfBandT<double>;
+
+// half-band lowpass, taps is rounded up to 4k+3, Blackman windowed sinc
+std::vector<double> computeHalfBand( int taps );
+// lowpass FIR passing [0,pass] and stopping from stop (cycles/sample),
+// inverting the droop of a stages/decim CIC ahead of it when cic_stages > 0
+std::vector<double> computeCICComp( int taps, double pass, double stop, int cic_stages=0, int cic_decim=1 );
+
+// How a decimation factor is split up.  Passband is kept to 0.2 of the
+// output rate, room for a 0.6 rolloff RRC signal at 4 sps.
+struct DecimPlan {
+    int factor = 1;
+    int cic_decim = 1;       // 1 = no CIC
+    int cic_stages = 0;
+    int comp_decim = 1;      // compensation FIR, 1 or 2
+    int comp_taps = 0;       // 0 = no compensation FIR
+    std::vector<int> halfband_taps;  // one per half-band, first runs first
+};
+// returns 0 and fills plan, or -1 if the factor can not be done
+int planDecimation( int factor, DecimPlan *plan );
+// "CIC 4x/16, comp 15 taps/2, half-band 19 taps" style summary
+std::string describeDecimation( const DecimPlan &plan );
+
+// the planned cascade, unity gain at DC
+template <typename R>
+struct DecimatorT {
+    DecimPlan plan;
+    std::shared_ptr< CICDecimatorT<R> > cic;
+    std::shared_ptr< CFIRDecimatorT<R> > comp;
+    std::vector< std::shared_ptr< CHalfBandT<R> > > halfbands;
+    DecimatorT( const DecimPlan &_plan );
+    // decimate count samples, writes up to count/factor+1 to out and
+    // returns how many.  in and out may be the same buffer.
+    int process( const CSampleT<R> *in, int count, CSampleT<R> *out );
+};
+using Decimator = DecimatorT<double>;
@@ -0,0 +1,314 @@
+#pragma once
+#include "libdsp.hpp"
+#include "equalizer.hpp"
+#include "profile.hpp"
+#include <array>
+
+/////////////////////////////
+// Compile time DSP chains
+///////////////////////////
+//
+// Header only building blocks that are composed at compile time.
+// Every stage is held by value and has an inline process(), so a
+// Chain<A,B,C> collapses into one loop body the compiler can inline,
+// unroll and vectorize, with no heap indirection between stages.
+//
+//   Chain< MixStage<CSample>, FirStage<CSample,33> > fwd;
+//   CSample y = fwd.process(x);            // per sample
+//   fwd.process_block<64>(in, out);        // fixed size block
+//   fwd.get<0>().rate = 0.01;              // reach a stage
+
+// wrap phase into -pi to +pi (same as libdsp's NCO)
+template <typename R>
+inline R chainWrapPhase( R p ) {
+    while ( p >= R(M_PI) )
+        p = p - R(2*M_PI);
+    while ( p < R(-M_PI) )
+        p = p + R(2*M_PI);
+    return p;
+}
+
+// complex NCO mixer stage, output = NCO sample * input
+template <typename T>
+struct MixStage {
+    using R = typename T::value_type;
+    R rate = 0;
+    R phase_acc = 0;
+    R offset = 0;       // added to phase_acc every sample (see CNCO::generate)
+    inline T process( T in ) {
+        T lo( std::cos(phase_acc), std::sin(phase_acc) );
+        phase_acc = chainWrapPhase<R>( phase_acc + rate + offset );
+        return lo * in;
+    }
+};
+
+// FIR stage with a compile time tap count.  The delay line is stored
+// twice back to back so the newest Taps samples are always contiguous,
+// no rotate per sample.  Sums newest first, like CFIRFilter.
+template <typename T, int Taps, typename C=T>
+struct FirStage {
+    std::array<C, Taps> coeff;
+    std::array<T, 2*Taps> hist;
+    int pos = 0;
+    FirStage() { coeff.fill( C(0) ); hist.fill( T(0) ); }
+    void setCoeff( const std::vector<C> &c ) {
+        for ( int idx=0; idx < Taps; ++idx ) {
+            coeff[idx] = idx < (int)c.size() ? c[idx] : C(0);
+        }
+    }
+    inline T process( T in ) {
+        pos = ( pos == 0 ) ? Taps-1 : pos-1;
+        hist[pos] = in;
+        hist[pos+Taps] = in;
+        const T *h = &hist[pos];
+        T out = T(0);
+        for ( int idx=0; idx < Taps; ++idx ) {
+            out = out + ( coeff[idx] * h[idx] );
+        }
+        return out;
+    }
+};
+
+// BPSK phase detector stage (see PhaseDetectorBPSK)
+template <typename R>
+struct PhaseDetectStage {
+    template <typename T>
+    inline R process( T input ) {
+        R abs_phase = std::arg(input);
+        if ( input.real() >= 0 ) {
+            return abs_phase;
+        }
+        if ( input.imag() > 0 ) {
+            return abs_phase - R(M_PI);
+        }
+        return abs_phase + R(M_PI);
+    }
+};
+
+// first difference, output = in - in(n-1)
+template <typename R>
+struct DiffStage {
+    R last = 0;
+    inline R process( R in ) {
+        R out = in - last;
+        last = in;
+        return out;
+    }
+};
+
+// output = in * conj(in Lag samples back), the rotation over Lag samples
+template <typename T, int Lag>
+struct LagProductStage {
+    std::array<T, Lag+1> hist;
+    int pos = 0;
+    LagProductStage() { hist.fill( T(0) ); }
+    inline T process( T in ) {
+        hist[pos] = in;
+        pos = ( pos == Lag ) ? 0 : pos+1;
+        return in * std::conj( hist[pos] );
+    }
+};
+
+// accumulate and dump stage (see AccumulateAndDump, CAccumulateAndDump)
+template <typename R>
+struct AccDumpStage {
+    int window_size = 1;
+    int current_win_value = 0;
+    R accumulator = R(0);
+    R lastDumpValue = R(0);
+    inline R process( R input ) {
+        if ( current_win_value == window_size ) {
+            lastDumpValue = accumulator;
+            accumulator = R(0);
+            current_win_value = 0;
+        }
+        accumulator += input;
+        current_win_value++;
+        return lastDumpValue;
+    }
+};
+
+// no equalizer, ChainBpskDemod's default equalizer stage, compiles away
+template <typename T>
+struct NoEqStage {
+    inline T process( T in ) { return in; }
+    void reset() {}
+};
+
+// adaptive equalizer stage (see EqualizerT), held by value.  Time path
+// only, the fft path's output is len samples late, too late to close the
+// carrier loop on.
+template <typename T>
+struct EqStage {
+    using R = typename T::value_type;
+    EqualizerT<R> eq;
+    EqStage( int taps=32, int sps=4 ) : eq( taps, sps, equalize_time ) {}
+    inline T process( T in ) { return eq.process( in ); }
+    void reset() { eq.reset(); }
+};
+
+// A statically composed chain of stages, applied left to right.
+template <typename... Stages>
+struct Chain;
+
+// ChainStage<I, Chain<..>>::get(c) returns stage I of a chain
+template <int I, typename C>
+struct ChainStage;
+
+template <>
+struct Chain<> {
+    template <typename T>
+    inline T process( T in ) { return in; }
+};
+
+template <typename First, typename... Rest>
+struct Chain<First, Rest...> {
+    First head;
+    Chain<Rest...> tail;
+
+    template <typename T>
+    inline auto process( T in ) -> decltype( tail.process( head.process(in) ) ) {
+        return tail.process( head.process(in) );
+    }
+
+    // run a compile time sized block through the whole chain
+    template <int N, typename In, typename Out>
+    inline void process_block( const In *in, Out *out ) {
+        for ( int idx=0; idx < N; ++idx ) {
+            out[idx] = process( in[idx] );
+        }
+    }
+
+    // stage I of the chain
+    template <int I>
+    inline typename ChainStage<I, Chain>::type &get() { return ChainStage<I, Chain>::get(*this); }
+};
+
+template <typename First, typename... Rest>
+struct ChainStage<0, Chain<First, Rest...>> {
+    using type = First;
+    static inline type &get( Chain<First, Rest...> &c ) { return c.head; }
+};
+
+template <int I, typename First, typename... Rest>
+struct ChainStage<I, Chain<First, Rest...>> {
+    using type = typename ChainStage<I-1, Chain<Rest...>>::type;
+    static inline type &get( Chain<First, Rest...> &c ) { return ChainStage<I-1, Chain<Rest...>>::get(c.tail); }
+};
+
+// BpskDemod re-expressed with compile time chains.  The forward path
+// (NCO mixer -> RRC matched filter) and the loop error path (squared
+// sample -> lag product -> accumulate and dump) are held by value
+// and inline into one loop per sample.  Same state machine, same output
+// as BpskDemod, sample for sample.  EqT sits between the matched filter
+// and the loop, EqStage for an equalizer (BpskDemod's Eq).
+template <typename T=CSample, int SPS=4, int BlockSize=64, typename EqT=NoEqStage<T> >
+struct ChainBpskDemod : BpskDemodState {
+    using sample_t = T;
+    using R = typename T::value_type;
+    // computeCpxRRC(SPS, alpha, 4) tap count
+    static const int Taps = SPS*2*4+1;
+
+    int win_size;
+    R freq_scale;
+    R freq_est;
+    R phase_est;
+    R freq_lock_threshold;
+    R phase_lock_threshold;
+    Chain< MixStage<T>, FirStage<T, Taps> > Forward;
+    // loop on squared samples, see BpskDemod
+    Chain< LagProductStage<T, freq_lag*SPS>, AccDumpStage<T> > FreqError;
+    AccDumpStage<T> PhaseErrorAcc;
+    // per sample phase error, only for the trace
+    PhaseDetectStage<R> PhaseDetector;
+    // optional gain control ahead of the forward path, block calls only
+    std::shared_ptr< AGCT<R> > Agc;
+    // equalizer between the matched filter and the loop
+    EqT Eq;
+    TraceTap trace;
+
+    ChainBpskDemod( double alpha, int winsize ) {
+        std::vector< std::complex<double> > c = computeCpxRRC(SPS, alpha, 4);
+        std::vector<T> coeff( c.begin(), c.end() );
+        Forward.template get<1>().setCoeff( coeff );
+        FreqError.template get<1>().window_size = winsize;
+        PhaseErrorAcc.window_size = winsize;
+        win_size = winsize;
+        freq_scale = R(0.5)/(freq_lag*SPS);
+        phase_est = 0;
+        freq_est = 0;
+        freq_lock_threshold = 0.01;
+        phase_lock_threshold = 0.1;
+        state = acq_freq;
+    }
+
+    inline T process( T input ) {
+        state_t last_state = state;
+        // forward part of loop, the mixer turns the input back by the
+        // estimates
+        MixStage<T> &mix = Forward.template get<0>();
+        mix.rate = -freq_est;
+        T nb_sample = Forward.process( input );
+        nb_sample = Eq.process( nb_sample );
+        // feedback loop
+        T square = nb_sample * nb_sample;
+        // a window ends on this sample, its sums update the loop
+        bool dump = PhaseErrorAcc.current_win_value == win_size;
+        T freq_sum = FreqError.process( square );
+        T phase_sum = PhaseErrorAcc.process( square );
+        if ( dump ) {
+            R step = updateLoop( freq_scale*std::arg(freq_sum), R(0.5)*std::arg(phase_sum), win_size,
+                                 freq_est, phase_est, freq_lock_threshold, phase_lock_threshold );
+            mix.phase_acc = chainWrapPhase<R>( mix.phase_acc - step );
+        }
+        if ( trace.rec && trace.due( state, last_state ) ) {
+            trace.record( state, last_state, PhaseDetector.process( nb_sample ), freq_scale*std::arg(freq_sum),
+                          R(0.5)*std::arg(phase_sum), freq_est, phase_est, nb_sample );
+        }
+        return nb_sample;
+    }
+
+    // back to the just constructed state (filter history, loop and estimates)
+    void reset() {
+        Forward.template get<0>() = MixStage<T>();
+        FirStage<T, Taps> &fir = Forward.template get<1>();
+        fir.hist.fill( T(0) );
+        fir.pos = 0;
+        FreqError.template get<0>() = LagProductStage<T, freq_lag*SPS>();
+        FreqError.template get<1>() = AccDumpStage<T>();
+        FreqError.template get<1>().window_size = win_size;
+        PhaseErrorAcc = AccDumpStage<T>();
+        PhaseErrorAcc.window_size = win_size;
+        phase_est = 0;
+        freq_est = 0;
+        state = acq_freq;
+        Eq.reset();
+    }
+
+    // demodulate one BlockSize block of samples
+    inline void process_block( const T *in, T *out ) {
+        for ( int idx=0; idx < BlockSize; ++idx ) {
+            out[idx] = process( in[idx] );
+        }
+    }
+
+    // demodulate any number of samples, in BlockSize steps, through the
+    // AGC first if there is one
+    void process_block( const T *in, T *out, size_t count ) {
+        DSP_PROFILE_START(t);
+        if ( Agc ) {
+            Agc->process( in, out, count );
+            in = out;
+            DSP_PROFILE_LAP(t, "demod.agc", count);
+        }
+        size_t whole = count - count % BlockSize;
+        size_t idx = 0;
+        for ( ; idx < whole; idx += BlockSize ) {
+            process_block( in+idx, out+idx );
+        }
+        for ( ; idx < count; ++idx ) {
+            out[idx] = process( in[idx] );
+        }
+        DSP_PROFILE_LAP(t, "demod.loop", count);
+    }
+};
@@ -0,0 +1,226 @@
+#include "equalizer.hpp"
+
+// keeps the normalized steps finite on silence
+static const double eq_eps = 1e-20;
+
+template <typename R>
+EqualizerT<R>::EqualizerT( int _len, int _sps, equalizer_method_t _method,
+                           double _mu_cma, double _mu_dd, double _dd_threshold ) {
+    len = std::max( _len, 2 );
+    sps = _sps;
+    method = _method;
+    mu_cma = _mu_cma;
+    mu_dd = _mu_dd;
+    dd_threshold = _dd_threshold;
+    if ( method == equalize_fft ) {
+        int n = 2;
+        while ( n < len ) {
+            n <<= 1;
+        }
+        len = n;
+        fft = std::make_shared< FFTT<R> >( 2*len );
+    }
+    reset();
+}
+
+template <typename R>
+void EqualizerT<R>::reset() {
+    w.assign( len, CSampleT<R>(0,0) );
+    w[len/2] = 1;
+    hist.assign( 2*len, CSampleT<R>(0,0) );
+    pos = 0;
+    phase = 0;
+    dd = false;
+    // start high so decisions only count once the average has settled
+    mse = 2;
+    square = 0;
+    primed = false;
+    seen = 0;
+    fill = 0;
+    if ( method == equalize_fft ) {
+        xbuf.assign( 2*len, CSampleT<R>(0,0) );
+        wf.assign( 2*len, CSampleT<R>(0,0) );
+        std::copy( w.begin(), w.end(), wf.begin() );
+        fft->forward( wf.data() );
+        xf.resize( 2*len );
+        work.resize( 2*len );
+        bin_power.assign( 2*len, 0 );
+        ybuf.assign( len, CSampleT<R>(0,0) );
+    }
+}
+
+template <typename R>
+CSampleT<R> EqualizerT<R>::error( CSampleT<R> y ) {
+    // BPSK axis from the average of y^2 (twice the carrier phase), so
+    // neither mode pulls against the carrier loop
+    square = R(0.99)*square + R(0.01)*y*y;
+    R mag = std::abs( square );
+    CSampleT<R> u = mag > 0 ? square / mag : CSampleT<R>(1,0);
+    CSampleT<R> axis = std::sqrt( u );
+    CSampleT<R> r = y*std::conj( axis );
+    CSampleT<R> de = y - axis*R( r.real() >= 0 ? 1 : -1 );
+    mse = R(0.99)*mse + R(0.01)*std::norm( de );
+    // blind: y^2 onto the unit axis, i.e. |y| = 1 and every symbol on one
+    // line.  Plain CMA (|y| = 1 only) also settles on mixes of I and Q
+    // from different symbols, which a BPSK slicer can not use.
+    CSampleT<R> e = dd ? de : std::conj( y )*( y*y - u );
+    if ( !dd && mse < dd_threshold ) {
+        dd = true;
+    } else if ( dd && mse > 2*dd_threshold ) {
+        dd = false;
+    }
+    return e;
+}
+
+template <typename R>
+CSampleT<R> EqualizerT<R>::process( CSampleT<R> input ) {
+    if ( method == equalize_fft ) {
+        xbuf[len+fill] = input;
+        CSampleT<R> y = ybuf[fill];
+        if ( ++fill == len ) {
+            processBlock();
+            fill = 0;
+        }
+        return y;
+    }
+    // newest sample first, doubled so the history is contiguous
+    pos = ( pos == 0 ) ? len-1 : pos-1;
+    hist[pos] = input;
+    hist[pos+len] = input;
+    const R *h = reinterpret_cast<const R*>( &hist[pos] );
+    R *wv = reinterpret_cast<R*>( w.data() );
+    R yr = 0;
+    R yi = 0;
+    for ( int k=0; k < len; ++k ) {
+        yr += wv[2*k]*h[2*k] - wv[2*k+1]*h[2*k+1];
+        yi += wv[2*k]*h[2*k+1] + wv[2*k+1]*h[2*k];
+    }
+    CSampleT<R> y( yr, yi );
+    if ( seen < len ) {
+        ++seen;
+    }
+    if ( ++phase < sps ) {
+        return y;
+    }
+    phase = 0;
+    R energy = 0;
+    for ( int k=0; k < 2*len; ++k ) {
+        energy += h[k]*h[k];
+    }
+    if ( !primed ) {
+        // centre tap from the input level once the history is full, so
+        // CMA starts near |y| = 1
+        if ( seen < len || energy <= 0 ) {
+            return y;
+        }
+        w[len/2] = R(1) / std::sqrt( energy/len );
+        primed = true;
+        return y;
+    }
+    R mu = dd ? mu_dd : mu_cma;
+    CSampleT<R> e = error( y ) * ( mu / ( energy + R(eq_eps) ) );
+    // w -= mu*e*conj(x), flat over the I/Q pairs
+    for ( int k=0; k < len; ++k ) {
+        wv[2*k] -= e.real()*h[2*k] + e.imag()*h[2*k+1];
+        wv[2*k+1] -= e.imag()*h[2*k] - e.real()*h[2*k+1];
+    }
+    return y;
+}
+
+template <typename R>
+void EqualizerT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = process( in[idx] );
+    }
+}
+
+template <typename R>
+void EqualizerT<R>::processBlock() {
+    const int n = 2*len;
+    const R scale = R(1) / n;
+    seen = std::min( seen+len, n );
+    if ( !primed && seen == n ) {
+        // centre tap from the input level once both blocks are full
+        R energy = 0;
+        for ( int k=0; k < n; ++k ) {
+            energy += std::norm( xbuf[k] );
+        }
+        if ( energy > 0 ) {
+            R g = R(1) / std::sqrt( energy/n );
+            for ( auto &t: wf ) {
+                t *= g;
+            }
+            primed = true;
+        }
+    }
+    // filter: last len outputs of the circular convolution of the two
+    // blocks with the zero padded taps
+    std::copy( xbuf.begin(), xbuf.end(), xf.begin() );
+    fft->forward( xf.data() );
+    for ( int k=0; k < n; ++k ) {
+        work[k] = xf[k]*wf[k];
+        // |X|^2/2 is about len times the per sample power, like the time path
+        bin_power[k] = primed && bin_power[k] > 0 ? R(0.9)*bin_power[k] + R(0.05)*std::norm( xf[k] )
+                                                  : R(0.5)*std::norm( xf[k] );
+    }
+    fft->inverse( work.data() );
+    for ( int k=0; k < len; ++k ) {
+        ybuf[k] = work[len+k]*scale;
+    }
+    // errors at the symbol instants (step folded in), zero elsewhere
+    std::fill( work.begin(), work.begin()+len, CSampleT<R>(0,0) );
+    for ( int k=0; k < len; ++k ) {
+        CSampleT<R> e(0,0);
+        if ( ++phase >= sps ) {
+            phase = 0;
+            R mu = dd ? mu_dd : mu_cma;
+            e = error( ybuf[k] ) * mu;
+        }
+        work[len+k] = primed ? e : CSampleT<R>(0,0);
+    }
+    // gradient: correlate errors with the input, normalized per bin, and
+    // keep it to len taps (the first half) before moving the taps
+    fft->forward( work.data() );
+    R mean_power = 0;
+    for ( int k=0; k < n; ++k ) {
+        mean_power += bin_power[k];
+    }
+    mean_power /= n;
+    for ( int k=0; k < n; ++k ) {
+        // bins under the mean (outside the signal's band) get the mean's
+        // step, rather than a huge one from their own tiny power
+        work[k] = std::conj( xf[k] )*work[k] / ( std::max( bin_power[k], mean_power ) + R(eq_eps) );
+    }
+    fft->inverse( work.data() );
+    for ( int k=0; k < len; ++k ) {
+        work[k] *= scale;
+    }
+    std::fill( work.begin()+len, work.end(), CSampleT<R>(0,0) );
+    fft->forward( work.data() );
+    for ( int k=0; k < n; ++k ) {
+        wf[k] -= work[k];
+    }
+    // this block is the history for the next one
+    std::copy( xbuf.begin()+len, xbuf.end(), xbuf.begin() );
+}
+
+template <typename R>
+std::vector< CSampleT<R> > EqualizerT<R>::taps() {
+    if ( method != equalize_fft ) {
+        return w;
+    }
+    std::vector< CSampleT<R> > t( wf );
+    fft->inverse( t.data() );
+    t.resize( len );
+    for ( auto &x: t ) {
+        x /= R( 2*len );
+    }
+    return t;
+}
+
+// float (c32) and double (c64) precision instantiations
+#define EQUALIZER_INSTANTIATE(R) \
+    template struct EqualizerT<R>;
+
+EQUALIZER_INSTANTIATE(float)
+EQUALIZER_INSTANTIATE(double)
@@ -0,0 +1,77 @@
+#pragma once
+#include "libdsp.hpp"
+
+/////////////////////////////
+// Adaptive equalizer (multipath)
+///////////////////////////
+//
+// Fractionally spaced: the taps are at the sample spacing (T/sps) and
+// adapt once per symbol, every sps'th sample.  There is no symbol timing
+// recovery in the demod, so which sample that is is arbitrary, the taps
+// move the eye opening onto it.
+//
+// Adaptation starts blind with CMA (constant modulus, drives |y| to 1,
+// blind to the carrier phase so it works while the loop is still
+// acquiring) and switches to decision directed LMS for BPSK (slicing to
+// +/-1 on the real axis) once the decision error is under dd_threshold,
+// and back if it rises over twice that.  The centre tap starts at the
+// gain that brings the first symbols to |y| = 1 and steps are normalized
+// by the input power, so mu does not depend on the signal level.
+//
+// Two ways to run it, same adaptation:
+//   equalize_time  per sample filter and update, cost O(len) per sample
+//   equalize_fft   block LMS, overlap-save with a block of len samples,
+//                  O(log len) per sample, but the output is len samples
+//                  late and the taps only move once per block
+//
+//   EqualizerT<float> eq( 32, 4 );
+//   y = eq.process( x );
+
+enum equalizer_method_t {
+    equalize_time,
+    equalize_fft
+};
+
+template <typename R>
+struct EqualizerT {
+    int len;                    // taps (rounded up to a power of 2 on the FFT path)
+    int sps;
+    equalizer_method_t method;
+    R mu_cma;
+    R mu_dd;
+    R dd_threshold;
+    bool dd;                    // decision directed, else CMA
+    R mse;                      // decision error power, averaged over ~100 symbols
+    CSampleT<R> square;         // y^2 averaged the same, its angle is twice the BPSK axis
+    int phase;                  // samples since the last update
+    bool primed;                // centre tap set from the input level yet
+    int seen;                   // samples in, up to the history length
+    // time path
+    std::vector< CSampleT<R> > w;       // w[k] multiplies the k'th newest sample
+    std::vector< CSampleT<R> > hist;    // history, doubled
+    int pos;
+    // FFT path, transforms of 2*len: last and current block in, the taps
+    // zero padded, and each bin's input power for the step normalization
+    std::shared_ptr< FFTT<R> > fft;
+    std::vector< CSampleT<R> > xbuf;
+    std::vector< CSampleT<R> > wf;
+    std::vector< CSampleT<R> > xf;
+    std::vector< CSampleT<R> > work;
+    std::vector<R> bin_power;
+    std::vector< CSampleT<R> > ybuf;    // last block's output, handed out while the next fills
+    int fill;                           // samples into the block
+
+    EqualizerT( int _len, int _sps, equalizer_method_t _method=equalize_time,
+                double _mu_cma=0.01, double _mu_dd=0.01, double _dd_threshold=0.2 );
+    CSampleT<R> process( CSampleT<R> input );
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    // centre spike taps, CMA, history cleared, level taken again
+    void reset();
+    // error of an output at a symbol instant (and the mode switch)
+    CSampleT<R> error( CSampleT<R> y );
+    // the taps in the time domain, either path
+    std::vector< CSampleT<R> > taps();
+
+    void processBlock();
+};
+using Equalizer = EqualizerT<double>;
@@ -0,0 +1,409 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include "firkernel.hpp"
+
+static const char *fir_kernel_names[] = { "scalar", "planar", "symmetric", "fft" };
+
+const char *firKernelName( fir_kernel_t kernel ) {
+    return ( kernel >= 0 && kernel < fir_kernel_count ) ? fir_kernel_names[kernel] : "unknown";
+}
+
+int firKernelFromName( const std::string &name, fir_kernel_t *kernel ) {
+    for ( int k=0; k < fir_kernel_count; ++k ) {
+        if ( name == fir_kernel_names[k] ) {
+            *kernel = (fir_kernel_t)k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int nextPow2( int n ) {
+    int p = 1;
+    while ( p < n ) {
+        p <<= 1;
+    }
+    return p;
+}
+
+template <typename R>
+BlockFIRT<R>::BlockFIRT( std::vector< CSampleT<R> > _coeff, FirTuning _tuning ) {
+    coeff = _coeff;
+    len = coeff.size();
+    tuning = _tuning;
+    symmetric = true;
+    for ( int k=0; k < len/2; ++k ) {
+        symmetric = symmetric && coeff[k] == coeff[len-1-k];
+    }
+    if ( tuning.kernel == fir_symmetric && !symmetric ) {
+        tuning.kernel = fir_scalar;
+    }
+    hist.assign( 2*len, CSampleT<R>(0,0) );
+    pos = 0;
+    if ( tuning.kernel == fir_planar ) {
+        if ( tuning.param <= 0 ) {
+            tuning.param = 1024;
+        }
+        for ( auto &c: coeff ) {
+            cr.push_back( c.real() );
+            ci.push_back( c.imag() );
+        }
+        xr.assign( len-1+tuning.param, 0 );
+        xi.assign( len-1+tuning.param, 0 );
+        yr.resize( tuning.param );
+        yi.resize( tuning.param );
+    }
+    if ( tuning.kernel == fir_fft ) {
+        // room for at least as many outputs as taps per transform
+        tuning.param = nextPow2( std::max( tuning.param, 2*len ) );
+        fft = std::make_shared< FFTT<R> >( tuning.param );
+        coeff_fft.assign( tuning.param, CSampleT<R>(0,0) );
+        std::copy( coeff.begin(), coeff.end(), coeff_fft.begin() );
+        fft->forward( coeff_fft.data() );
+        for ( auto &c: coeff_fft ) {
+            c /= R( tuning.param );
+        }
+        work.resize( tuning.param );
+        tail.assign( len-1, CSampleT<R>(0,0) );
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    switch ( tuning.kernel ) {
+        case fir_planar:
+            processPlanar( in, out, count );
+            break;
+        case fir_symmetric:
+            processSymmetric( in, out, count );
+            break;
+        case fir_fft:
+            processFFT( in, out, count );
+            break;
+        default:
+            processScalar( in, out, count );
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::processScalar( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        // newest sample first, doubled so the history is contiguous
+        pos = ( pos == 0 ) ? len-1 : pos-1;
+        hist[pos] = in[idx];
+        hist[pos+len] = in[idx];
+        const CSampleT<R> *h = &hist[pos];
+        CSampleT<R> acc(0,0);
+        for ( int k=0; k < len; ++k ) {
+            acc += coeff[k] * h[k];
+        }
+        out[idx] = acc;
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::processSymmetric( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    const R *c = reinterpret_cast<const R*>( coeff.data() );
+    const int half = len / 2;
+    for ( int idx=0; idx < count; ++idx ) {
+        pos = ( pos == 0 ) ? len-1 : pos-1;
+        hist[pos] = in[idx];
+        hist[pos+len] = in[idx];
+        const R *h = reinterpret_cast<const R*>( &hist[pos] );
+        R acc_i = 0;
+        R acc_q = 0;
+        // pairs that share a tap are added first, then one multiply
+        for ( int k=0; k < half; ++k ) {
+            R si = h[2*k] + h[2*(len-1-k)];
+            R sq = h[2*k+1] + h[2*(len-1-k)+1];
+            acc_i += c[2*k]*si - c[2*k+1]*sq;
+            acc_q += c[2*k]*sq + c[2*k+1]*si;
+        }
+        if ( len & 1 ) {
+            acc_i += c[2*half]*h[2*half] - c[2*half+1]*h[2*half+1];
+            acc_q += c[2*half]*h[2*half+1] + c[2*half+1]*h[2*half];
+        }
+        out[idx] = CSampleT<R>( acc_i, acc_q );
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::filterChunk( int m, R *out_i, R *out_q ) {
+    const int keep = len - 1;
+    std::fill( out_i, out_i+m, R(0) );
+    std::fill( out_q, out_q+m, R(0) );
+    // tap outer, sample inner: no reduction in the inner loop
+    for ( int k=0; k < len; ++k ) {
+        const R a = cr[k];
+        const R b = ci[k];
+        const R *pr = &xr[keep-k];
+        const R *pi = &xi[keep-k];
+        for ( int n=0; n < m; ++n ) {
+            out_i[n] += a*pr[n] - b*pi[n];
+            out_q[n] += a*pi[n] + b*pr[n];
+        }
+    }
+    // the newest len-1 samples are the next chunk's history
+    std::copy( xr.begin()+m, xr.begin()+m+keep, xr.begin() );
+    std::copy( xi.begin()+m, xi.begin()+m+keep, xi.begin() );
+}
+
+template <typename R>
+void BlockFIRT<R>::processPlanar( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    const int keep = len - 1;
+    for ( int at=0; at < count; at += tuning.param ) {
+        int m = std::min( tuning.param, count-at );
+        deinterleave( in+at, m, &xr[keep], &xi[keep] );
+        filterChunk( m, yr.data(), yi.data() );
+        interleave( yr.data(), yi.data(), m, out+at );
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::process( const R *in_i, const R *in_q, R *out_i, R *out_q, int count ) {
+    if ( tuning.kernel == fir_planar ) {
+        const int keep = len - 1;
+        for ( int at=0; at < count; at += tuning.param ) {
+            int m = std::min( tuning.param, count-at );
+            std::copy( in_i+at, in_i+at+m, &xr[keep] );
+            std::copy( in_q+at, in_q+at+m, &xi[keep] );
+            filterChunk( m, out_i+at, out_q+at );
+        }
+        return;
+    }
+    const int piece = 1024;
+    pack.resize( piece );
+    for ( int at=0; at < count; at += piece ) {
+        int m = std::min( piece, count-at );
+        interleave( in_i+at, in_q+at, m, pack.data() );
+        process( pack.data(), pack.data(), m );
+        deinterleave( pack.data(), m, out_i+at, out_q+at );
+    }
+}
+
+template <typename R>
+void BlockFIRT<R>::processFFT( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    const int keep = len - 1;
+    const int step = tuning.param - keep;
+    for ( int at=0; at < count; at += step ) {
+        // a short last piece still costs a whole transform, its outputs
+        // only depend on samples that are here
+        int m = std::min( step, count-at );
+        std::copy( tail.begin(), tail.end(), work.begin() );
+        std::copy( in+at, in+at+m, work.begin()+keep );
+        std::fill( work.begin()+keep+m, work.end(), CSampleT<R>(0,0) );
+        if ( m >= keep ) {
+            std::copy( in+at+m-keep, in+at+m, tail.begin() );
+        } else {
+            std::copy( work.begin()+m, work.begin()+m+keep, tail.begin() );
+        }
+        fft->forward( work.data() );
+        for ( int k=0; k < tuning.param; ++k ) {
+            work[k] *= coeff_fft[k];
+        }
+        fft->inverse( work.data() );
+        std::copy( work.begin()+keep, work.begin()+keep+m, out+at );
+    }
+}
+
+/////////////////////////////
+// tuning
+///////////////////////////
+
+static std::mutex tune_mutex;
+static std::map< std::string, FirTuning > tune_memo;
+static bool tune_cache_loaded = false;
+
+void resetFirTuning() {
+    std::lock_guard<std::mutex> lock( tune_mutex );
+    tune_memo.clear();
+    tune_cache_loaded = false;
+}
+
+// cpu model name with the spaces taken out, "unknown" without /proc
+static std::string cpuModel() {
+    std::ifstream cpuinfo( "/proc/cpuinfo" );
+    std::string line;
+    while ( std::getline( cpuinfo, line ) ) {
+        if ( line.compare( 0, 10, "model name" ) == 0 ) {
+            std::string model = line.substr( line.find(':')+1 );
+            std::string out;
+            for ( char c: model ) {
+                if ( c != ' ' && c != '\t' && c != '|' ) {
+                    out += c;
+                } else if ( out.length() && out.back() != '_' ) {
+                    out += '_';
+                }
+            }
+            return out.length() ? out : "unknown";
+        }
+    }
+    return "unknown";
+}
+
+static std::string cacheDir() {
+    const char *dir = getenv( "LIBDSP_CACHE_DIR" );
+    if ( dir && dir[0] ) {
+        return dir;
+    }
+    const char *xdg = getenv( "XDG_CACHE_HOME" );
+    if ( xdg && xdg[0] ) {
+        return std::string( xdg ) + "/libdsp";
+    }
+    const char *home = getenv( "HOME" );
+    return std::string( home ? home : "/tmp" ) + "/.cache/libdsp";
+}
+
+// read the cache file into the memo, once per process (lock held)
+static void loadTuneCache() {
+    if ( tune_cache_loaded ) {
+        return;
+    }
+    tune_cache_loaded = true;
+    std::ifstream cache( cacheDir() + "/fir_kernels" );
+    std::string key, name;
+    int param;
+    while ( cache >> key >> name >> param ) {
+        FirTuning t;
+        if ( firKernelFromName( name, &t.kernel ) == 0 ) {
+            t.param = param;
+            t.source = "cached";
+            tune_memo[key] = t;
+        }
+    }
+}
+
+static void saveTuning( const std::string &key, const FirTuning &t ) {
+    std::string dir = cacheDir();
+    // make the directory and its parent, a failure shows up at the open
+    mkdir( dir.substr( 0, dir.find_last_of('/') ).c_str(), 0755 );
+    mkdir( dir.c_str(), 0755 );
+    FILE *f = fopen( ( dir + "/fir_kernels" ).c_str(), "a" );
+    if ( !f ) {
+        std::cout << "FIR tuning cache not writable : " << dir << std::endl;
+        return;
+    }
+    fprintf( f, "%s %s %d\n", key.c_str(), firKernelName( t.kernel ), t.param );
+    fclose( f );
+}
+
+// LIBDSP_FIR_KERNEL=<kernel>[:<param>], returns false if unset or unknown
+static bool forcedTuning( FirTuning *t ) {
+    const char *env = getenv( "LIBDSP_FIR_KERNEL" );
+    if ( !env || !env[0] ) {
+        return false;
+    }
+    std::string spec( env );
+    size_t colon = spec.find(':');
+    if ( firKernelFromName( spec.substr( 0, colon ), &t->kernel ) < 0 ) {
+        std::cout << "Unknown LIBDSP_FIR_KERNEL : " << spec << std::endl;
+        return false;
+    }
+    t->param = colon == std::string::npos ? 0 : atoi( spec.c_str()+colon+1 );
+    t->source = "forced";
+    return true;
+}
+
+// ns per sample of one candidate, block samples per call
+template <typename R>
+static double timeCandidate( const std::vector< CSampleT<R> > &coeff, FirTuning t,
+                             const std::vector< CSampleT<R> > &buf ) {
+    BlockFIRT<R> fir( coeff, t );
+    const int block = buf.size();
+    std::vector< CSampleT<R> > out( block );
+    fir.process( buf.data(), out.data(), block );
+    long long samples = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    std::chrono::duration<double> dt( 0 );
+    while ( dt.count() < 0.003 ) {
+        fir.process( buf.data(), out.data(), block );
+        samples += block;
+        dt = std::chrono::steady_clock::now() - t0;
+    }
+    return dt.count()*1e9 / samples;
+}
+
+template <typename R>
+FirTuning tuneBlockFIR( const std::vector< CSampleT<R> > &coeff, int block ) {
+    FirTuning forced;
+    if ( forcedTuning( &forced ) ) {
+        return forced;
+    }
+    const int len = coeff.size();
+    BlockFIRT<R> probe( coeff, FirTuning() );
+    std::string key = cpuModel() + "|" + ( sizeof(R) == sizeof(float) ? "float" : "double" ) + "|" +
+                      std::to_string( len ) + "|" + ( probe.symmetric ? "sym" : "asym" ) + "|" +
+                      std::to_string( block );
+
+    std::lock_guard<std::mutex> lock( tune_mutex );
+    loadTuneCache();
+    auto found = tune_memo.find( key );
+    if ( found != tune_memo.end() ) {
+        return found->second;
+    }
+
+    std::vector<FirTuning> candidates;
+    FirTuning t;
+    t.kernel = fir_scalar;
+    candidates.push_back( t );
+    if ( probe.symmetric ) {
+        t.kernel = fir_symmetric;
+        candidates.push_back( t );
+    }
+    t.kernel = fir_planar;
+    for ( int chunk: { 256, 1024, 4096 } ) {
+        if ( chunk <= std::max( block, 256 ) ) {
+            t.param = chunk;
+            candidates.push_back( t );
+        }
+    }
+    t.kernel = fir_fft;
+    for ( int mult: { 2, 4, 8 } ) {
+        t.param = nextPow2( mult*len );
+        candidates.push_back( t );
+    }
+
+    // noise input, the same for every candidate
+    std::vector< CSampleT<R> > buf( std::max( 1, std::min( block, 1 << 16 ) ) );
+    uint32_t lcg = 12345;
+    for ( auto &s: buf ) {
+        lcg = lcg*1664525u + 1013904223u;
+        R re = R( lcg >> 8 ) / R( 1 << 24 ) - R(0.5);
+        lcg = lcg*1664525u + 1013904223u;
+        R im = R( lcg >> 8 ) / R( 1 << 24 ) - R(0.5);
+        s = CSampleT<R>( re, im );
+    }
+    FirTuning best;
+    double best_ns = 0;
+    for ( auto &c: candidates ) {
+        double ns = timeCandidate<R>( coeff, c, buf );
+        if ( best_ns == 0 || ns < best_ns ) {
+            best_ns = ns;
+            best = c;
+        }
+    }
+    best.source = "tuned";
+    tune_memo[key] = best;
+    saveTuning( key, best );
+    return best;
+}
+
+template <typename R>
+std::shared_ptr< BlockFIRT<R> > makeBlockFIR( const std::vector< CSampleT<R> > &coeff, int block ) {
+    return std::make_shared< BlockFIRT<R> >( coeff, tuneBlockFIR<R>( coeff, block ) );
+}
+
+// float (c32) and double (c64) precision instantiations
+#define FIRKERNEL_INSTANTIATE(R) \
+    template struct BlockFIRT<R>; \
+    template FirTuning tuneBlockFIR<R>( const std::vector< CSampleT<R> > &coeff, int block ); \
+    template std::shared_ptr< BlockFIRT<R> > makeBlockFIR<R>( const std::vector< CSampleT<R> > &coeff, int block );
+
+FIRKERNEL_INSTANTIATE(float)
+FIRKERNEL_INSTANTIATE(double)
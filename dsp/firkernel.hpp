@@ -0,0 +1,90 @@
+#pragma once
+#include "libdsp.hpp"
+#include "planar.hpp"
+
+/////////////////////////////
+// Block FIR kernels and the per host autotuner
+///////////////////////////
+//
+// One complex FIR (y[n] = sum coeff[k]*x[n-k], a sample out per sample
+// in, no added delay) with several ways to compute it.  Which is fastest
+// depends on the tap count, the call size and the CPU, so makeBlockFIR()
+// times the candidates the first time a configuration is seen and keeps
+// the winner in a cache file, later runs just read it back:
+//
+//   $LIBDSP_CACHE_DIR/fir_kernels  (default $XDG_CACHE_HOME/libdsp or
+//                                   ~/.cache/libdsp)
+//
+// one "<cpu model>|<precision>|<taps>|<sym>|<block> <kernel> <param>"
+// line per configuration, the last line for a key wins.  Setting
+// LIBDSP_FIR_KERNEL=<kernel>[:<param>] skips the tuning and forces a
+// kernel everywhere it can run.
+//
+//   std::shared_ptr< BlockFIRT<float> > fir = makeBlockFIR<float>( coeff, 4096 );
+//   fir->process( in, out, count );
+
+enum fir_kernel_t {
+    fir_scalar,         // per sample dot product over a doubled delay line
+    fir_planar,         // planar I/Q, tap outer loop over a chunk (vectorizes)
+    fir_symmetric,      // symmetric taps folded, half the multiplies
+    fir_fft,            // overlap-save
+    fir_kernel_count
+};
+
+struct FirTuning {
+    fir_kernel_t kernel = fir_scalar;
+    int param = 0;                  // planar: chunk samples, fft: transform size
+    const char *source = "default"; // tuned, cached or forced
+};
+
+// "scalar", "planar", ..
+const char *firKernelName( fir_kernel_t kernel );
+// returns 0 and sets kernel, -1 if the name is unknown
+int firKernelFromName( const std::string &name, fir_kernel_t *kernel );
+
+template <typename R>
+struct BlockFIRT {
+    std::vector< CSampleT<R> > coeff;
+    int len;
+    bool symmetric;                     // coeff[k] == coeff[len-1-k]
+    FirTuning tuning;
+    // scalar and symmetric: history, doubled
+    std::vector< CSampleT<R> > hist;
+    int pos;
+    // planar: len-1 samples of history then the chunk, and the outputs
+    std::vector<R> cr, ci, xr, xi, yr, yi;
+    // planar samples through the other kernels, interleaved on the way
+    std::vector< CSampleT<R> > pack;
+    // fft: coefficient spectrum (1/size folded in), len-1 history + input
+    std::shared_ptr< FFTT<R> > fft;
+    std::vector< CSampleT<R> > coeff_fft;
+    std::vector< CSampleT<R> > work;
+    std::vector< CSampleT<R> > tail;
+
+    BlockFIRT( std::vector< CSampleT<R> > _coeff, FirTuning _tuning );
+    // filter count samples, in and out may be the same buffer
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    // the same on planar samples (planar.hpp), shuffle free on the planar
+    // kernel, the others interleave and deinterleave around themselves.
+    // Either call can follow the other on one filter.
+    void process( const R *in_i, const R *in_q, R *out_i, R *out_q, int count );
+
+    void processScalar( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    void processSymmetric( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    void processPlanar( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    void processFFT( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    // planar kernel on the m samples after the history in xr/xi
+    void filterChunk( int m, R *out_i, R *out_q );
+};
+using BlockFIR = BlockFIRT<double>;
+
+// the kernel to use for these taps called block samples at a time:
+// forced, cached, or timed now (a few ms per candidate) and cached
+template <typename R>
+FirTuning tuneBlockFIR( const std::vector< CSampleT<R> > &coeff, int block );
+// a tuned filter
+template <typename R>
+std::shared_ptr< BlockFIRT<R> > makeBlockFIR( const std::vector< CSampleT<R> > &coeff, int block=4096 );
+// forget what this process has looked up, the next tune reads the cache
+// file again (tests)
+void resetFirTuning();
@@ -1,5 +1,7 @@
 
 #include "libdsp.hpp"
+#include "equalizer.hpp"
+#include "profile.hpp"
 #include <iostream>
 
 NormFreq computeNormFreqRads(SampleRate s, FreqRads f) {
@@ -18,20 +20,22 @@ RadRate computeRadRateFromFreqRads( SampleRate s, FreqRads f ) {
     return s/f;
 }
 
-Phase wrapPhase(Phase p) {
-    Phase result = p;
-    while (result >= M_PI )
-        result = result - 2*M_PI;
+template <typename R>
+R wrapPhase(R p) {
+    R result = p;
+    while (result >= R(M_PI) )
+        result = result - R(2*M_PI);
 
-    while (result < -M_PI )
-        result = result + 2*M_PI;
+    while (result < R(-M_PI) )
+        result = result + R(2*M_PI);
 
     return result;
 }
 
-Sample NCO::generate( Phase offset ) {
+template <typename R>
+R NCOT<R>::generate( R offset ) {
     // compute output sample for current state
-    Sample s;
+    R s;
     s = std::cos(phase_acc);
     // update for next sample
     phase_acc = wrapPhase( phase_acc + rate + offset );
@@ -39,8 +43,9 @@ Sample NCO::generate( Phase offset ) {
     return s;
 }
 
-CSample CNCO::generate( Phase offset ) {
-    CSample s;
+template <typename R>
+CSampleT<R> CNCOT<R>::generate( R offset ) {
+    CSampleT<R> s;
     s.real( std::cos(phase_acc) );
     s.imag( std::sin(phase_acc) );
     // update for next sample
@@ -49,6 +54,35 @@ CSample CNCO::generate( Phase offset ) {
     return s;
 }
 
+template <typename R>
+void CNCOT<R>::mix( const R *in_i, const R *in_q, R *out_i, R *out_q, int count ) {
+    // one cos/sin per chunk at its start phase, rotated by a table of
+    // 0..chunk-1 rate steps, so rounding doesn't build up across chunks
+    // and the inner loop is planar multiplies only
+    const int chunk = 64;
+    R step_i[chunk];
+    R step_q[chunk];
+    int steps = std::min( count, chunk );
+    for ( int k=0; k < steps; ++k ) {
+        step_i[k] = std::cos( R(k)*rate );
+        step_q[k] = std::sin( R(k)*rate );
+    }
+    for ( int at=0; at < count; at += chunk ) {
+        int m = std::min( chunk, count-at );
+        const R c = std::cos( phase_acc );
+        const R s = std::sin( phase_acc );
+        for ( int k=0; k < m; ++k ) {
+            R pi = c*step_i[k] - s*step_q[k];
+            R pq = c*step_q[k] + s*step_i[k];
+            R x = in_i[at+k];
+            R y = in_q[at+k];
+            out_i[at+k] = x*pi - y*pq;
+            out_q[at+k] = x*pq + y*pi;
+        }
+        phase_acc = wrapPhase( phase_acc + R(m)*rate );
+    }
+}
+
 Magnitude getMagnitude( CSample s ) {
     return abs(s);
 }
@@ -61,7 +95,8 @@ CSample Polar2CSample( Magnitude m, Phase p ) {
     return std::polar(m,p);
 }
 
-FIRFilter::FIRFilter( std::vector<double> _coeff ) {
+template <typename R>
+FIRFilterT<R>::FIRFilterT( std::vector<R> _coeff ) {
     // grab local copy of coefficents
     coeff = _coeff;
     // need 1 tap for coeff
@@ -70,12 +105,13 @@ FIRFilter::FIRFilter( std::vector<double> _coeff ) {
     for ( auto& t : taps ) { t = 0; }
 }
 
-Sample FIRFilter::process(Sample in) {
+template <typename R>
+R FIRFilterT<R>::process(R in) {
     // shift in new sample
     std::rotate( taps.begin(), taps.begin()+taps.size()-1, taps.end() );
     taps[0] = in;
     // compute output sample given current state
-    Sample out = 0;
+    R out = 0;
     // scale taps and sum..
     for ( int idx=0; idx < taps.size(); ++idx ) {
         out = out + ( coeff[idx] * taps[idx] );
@@ -84,7 +120,8 @@ Sample FIRFilter::process(Sample in) {
     return out;
 }
 
-CFIRFilter::CFIRFilter( std::vector< std::complex<double> > _coeff ) {
+template <typename R>
+CFIRFilterT<R>::CFIRFilterT( std::vector< CSampleT<R> > _coeff ) {
     // grab local copy of coefficents
     coeff = _coeff;
     // need 1 tap for coeff
@@ -93,12 +130,13 @@ CFIRFilter::CFIRFilter( std::vector< std::complex<double> > _coeff ) {
     for ( auto &t : taps ) { t = (0,0); }
 }
 
-CSample CFIRFilter::process(CSample in) {
+template <typename R>
+CSampleT<R> CFIRFilterT<R>::process(CSampleT<R> in) {
     // shift in new sample
     std::rotate( taps.begin(), taps.begin()+taps.size()-1, taps.end() );
     taps[0] = in;
     // compute output sample given current state
-    CSample out = (0,0);
+    CSampleT<R> out = (0,0);
     // scale taps and sum..
     for ( int idx=0; idx < taps.size(); ++idx ) {
         out = out + ( coeff[idx] * taps[idx] );
@@ -107,19 +145,54 @@ CSample CFIRFilter::process(CSample in) {
     return out;
 }
 
+template <typename R>
+CInterpolatorT<R>::CInterpolatorT( int _sps, std::vector<double> proto ) {
+    sps = _sps;
+    branch_len = ( proto.size() + sps - 1 ) / sps;
+    branches.assign( sps*branch_len, 0 );
+    for ( int k=0; k < (int)proto.size(); ++k ) {
+        branches[ ( k % sps )*branch_len + k / sps ] = proto[k];
+    }
+    hist.assign( 2*branch_len, CSampleT<R>(0,0) );
+    pos = 0;
+}
+
+template <typename R>
+void CInterpolatorT<R>::process( CSampleT<R> symbol, CSampleT<R> *out ) {
+    // newest symbol first, doubled so the history is contiguous
+    pos = ( pos == 0 ) ? branch_len-1 : pos-1;
+    hist[pos] = symbol;
+    hist[pos+branch_len] = symbol;
+    const CSampleT<R> *h = &hist[pos];
+    for ( int phase=0; phase < sps; ++phase ) {
+        const R *b = &branches[phase*branch_len];
+        R acc_i = 0;
+        R acc_q = 0;
+        for ( int k=0; k < branch_len; ++k ) {
+            acc_i += b[k] * h[k].real();
+            acc_q += b[k] * h[k].imag();
+        }
+        out[phase] = CSampleT<R>( acc_i, acc_q );
+    }
+}
+
+template <typename R>
+void CInterpolatorT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        process( in[idx], out + idx*sps );
+    }
+}
+
 std::vector<double> computeRRC(double sps, double a, double d) {
     double tap_count = ( sps*2.0*d )+1.0;
     std::vector<double> p(tap_count);
     std::fill(p.begin(), p.end(), 0.0);
     std::vector<double>::iterator cp = p.begin(); // current tap iterator.
     for ( double t=-1*d; t < d+(1.0/sps); t=t+(1.0/sps) ) {
-        std::cout << "T=" << t << std::endl;
         if ( t == 0 ) {
-            std::cout << "(debug) t=0 case hit..\n";
             *cp = (1-a)+4.0*a/M_PI; // OK
         } else {
             if ( ( t == 1.0/(4.0*a)) || (t == -1.0/(4.0*a)) ) {
-                std::cout << "(debug) t=1/(4*a) case hit..\n";
                 *cp = a/std::sqrt(2)*((1.0+2.0/M_PI)*std::sin(M_PI/(4.0*a))+(1.0-2.0/M_PI)*std::cos(M_PI/(4.0*a)));
             } else {
                 // matlab: (sin(pi*-4*(1-a))+4*a*-4*cos(pi*-4*(1+a)))/(pi*-4*(1-(4*a*-4)^2))
@@ -148,41 +221,101 @@ std::vector<std::complex<double>> computeCpxRRC(double sps, double a,
   std::vector<std::complex<double>> ctaps;
   ctaps.resize(taps.size());
   for (int i = 0; i < taps.size(); ++i) {
-    ctaps[i] = std::complex<double>(taps[i], taps[i]);
+    ctaps[i] = std::complex<double>(taps[i], 0);
   }
   return ctaps;
 }
 
 // apply a hann window to a set of double values
-void applyWindowHann(std::vector<double> v) {
-  double el = v.size();
+void applyWindowHann(std::vector<double> *v) {
+  double el = v->size();
   for (int i = 0; i < el; ++i) {
     double scalar = 0.5 * (1 - (std::cos((2 * M_PI * i) / (el - 1))));
-    v[i] = v[i] * scalar;
+    (*v)[i] = (*v)[i] * scalar;
   }
 }
 
 // apply a hann window to I/Q values.
-void applyCpxWindowHann(std::vector<std::complex<double>> v) {
-  double el = v.size();
+void applyCpxWindowHann(std::vector<std::complex<double>> *v) {
+  double el = v->size();
   for (int i = 0; i < el; ++i) {
     double scalar = 0.5 * (1 - (std::cos((2 * M_PI * i) / (el - 1))));
-    v[i] = v[i] * scalar;
+    (*v)[i] = (*v)[i] * scalar;
   }
 }
 
+template <typename R>
+FFTT<R>::FFTT( int _size ) {
+    size = _size;
+    int bits = 0;
+    while ( ( 1 << bits ) < size ) {
+        bits++;
+    }
+    bitrev.resize( size );
+    for ( int idx=0; idx < size; ++idx ) {
+        int r = 0;
+        for ( int b=0; b < bits; ++b ) {
+            r |= ( ( idx >> b ) & 1 ) << ( bits-1-b );
+        }
+        bitrev[idx] = r;
+    }
+    twiddle.resize( size/2 );
+    for ( int k=0; k < size/2; ++k ) {
+        twiddle[k] = CSampleT<R>( std::cos( -2*M_PI*k/size ), std::sin( -2*M_PI*k/size ) );
+    }
+}
+
+template <typename R>
+void FFTT<R>::forward( CSampleT<R> *data ) const {
+    for ( int idx=0; idx < size; ++idx ) {
+        if ( idx < bitrev[idx] ) {
+            std::swap( data[idx], data[ bitrev[idx] ] );
+        }
+    }
+    // butterflies, complex multiply written out so it skips the NaN checks
+    for ( int len=2; len <= size; len <<= 1 ) {
+        int half = len/2;
+        int step = size/len;
+        for ( int base=0; base < size; base += len ) {
+            for ( int j=0; j < half; ++j ) {
+                const CSampleT<R> &w = twiddle[j*step];
+                CSampleT<R> &a = data[base+j];
+                CSampleT<R> &b = data[base+j+half];
+                R vr = b.real()*w.real() - b.imag()*w.imag();
+                R vi = b.real()*w.imag() + b.imag()*w.real();
+                b = CSampleT<R>( a.real() - vr, a.imag() - vi );
+                a = CSampleT<R>( a.real() + vr, a.imag() + vi );
+            }
+        }
+    }
+}
+
+template <typename R>
+void FFTT<R>::inverse( CSampleT<R> *data ) const {
+    // ifft(x) = conj(fft(conj(x)))
+    for ( int idx=0; idx < size; ++idx ) {
+        data[idx] = std::conj( data[idx] );
+    }
+    forward( data );
+    for ( int idx=0; idx < size; ++idx ) {
+        data[idx] = std::conj( data[idx] );
+    }
+}
+
 // Accumulate and Dump  (complex and normal)
-CAccumulateAndDump::CAccumulateAndDump( int _window_size, CSample init_val) {
+template <typename R>
+CAccumulateAndDumpT<R>::CAccumulateAndDumpT( int _window_size, CSampleT<R> init_val) {
     window_size = _window_size;
     current_win_value = 0;
     accumulator = 0;
     lastDumpValue = init_val;
 }
 
-CSample CAccumulateAndDump::process( CSample input ) {
+template <typename R>
+CSampleT<R> CAccumulateAndDumpT<R>::process( CSampleT<R> input ) {
     if ( current_win_value == window_size ) {
         lastDumpValue = accumulator;
-        accumulator = CSample(0,0);
+        accumulator = CSampleT<R>(0,0);
         current_win_value = 0;
     }
     accumulator += input;
@@ -190,14 +323,16 @@ CSample CAccumulateAndDump::process( CSample input ) {
     return lastDumpValue;
 }
 
-AccumulateAndDump::AccumulateAndDump( int _window_size, Sample init_val) {
+template <typename R>
+AccumulateAndDumpT<R>::AccumulateAndDumpT( int _window_size, R init_val) {
     window_size = _window_size;
     current_win_value = 0;
     accumulator = 0;
     lastDumpValue = init_val;
 }
 
-Sample AccumulateAndDump::process( Sample input ) {
+template <typename R>
+R AccumulateAndDumpT<R>::process( R input ) {
     if ( current_win_value == window_size ) {
         lastDumpValue = accumulator;
         accumulator = 0;
@@ -208,34 +343,52 @@ Sample AccumulateAndDump::process( Sample input ) {
     return lastDumpValue;
 }
 
-Phase PhaseDetectorBPSK( CSample input ) {
-    Phase error_out;
-    Phase abs_phase = getPhase(input);
+template <typename R>
+R PhaseDetectorBPSK( CSampleT<R> input ) {
+    R error_out;
+    R abs_phase = std::arg(input);
     // compute error from BPSK Reference Constelation points 0 and +/-PI
     if ( input.real() >= 0 ) {
         error_out = abs_phase;
     }
     if ( input.real() < 0 ) {
         if ( input.imag() > 0 ) {
-            error_out = abs_phase - M_PI;
+            error_out = abs_phase - R(M_PI);
         } else {
-            error_out = (-1)*(abs_phase + M_PI);
+            error_out = abs_phase + R(M_PI);
         }
     }
     return error_out;
 }
 
+template <typename R>
+void PhaseDetectorBPSK( const R *in_i, const R *in_q, R *err, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        R abs_phase = std::atan2( in_q[idx], in_i[idx] );
+        if ( in_i[idx] >= 0 ) {
+            err[idx] = abs_phase;
+        } else if ( in_q[idx] > 0 ) {
+            err[idx] = abs_phase - R(M_PI);
+        } else {
+            err[idx] = abs_phase + R(M_PI);
+        }
+    }
+}
+
 
-SampleDelay::SampleDelay( int delay_cnt ) {
-    delay_reg.resize(delay_cnt);
+template <typename R>
+SampleDelayT<R>::SampleDelayT( int delay_cnt ) {
+    // one extra slot, so the value read back was written delay_cnt samples ago
+    delay_reg.resize(delay_cnt+1);
     std::fill(delay_reg.begin(), delay_reg.end(), 0 );
     read_idx = 1;
     write_idx = 0;
 }
 
-Sample SampleDelay::process(Sample input ) {
+template <typename R>
+R SampleDelayT<R>::process(R input ) {
     delay_reg[write_idx] = input;
-    Sample output = delay_reg[read_idx];
+    R output = delay_reg[read_idx];
     write_idx++;
     read_idx++;
     if ( write_idx == delay_reg.size() ) {
@@ -247,16 +400,19 @@ Sample SampleDelay::process(Sample input ) {
     return output;
 }
 
-CSampleDelay::CSampleDelay( int delay_cnt ) {
-    delay_reg.resize(delay_cnt);
+template <typename R>
+CSampleDelayT<R>::CSampleDelayT( int delay_cnt ) {
+    // one extra slot, so the value read back was written delay_cnt samples ago
+    delay_reg.resize(delay_cnt+1);
     std::fill(delay_reg.begin(), delay_reg.end(), 0 );
     read_idx = 1;
     write_idx = 0;
 }
 
-CSample CSampleDelay::process(CSample input ) {
+template <typename R>
+CSampleT<R> CSampleDelayT<R>::process(CSampleT<R> input ) {
     delay_reg[write_idx] = input;
-    CSample output = delay_reg[read_idx];
+    CSampleT<R> output = delay_reg[read_idx];
     write_idx++;
     read_idx++;
     if ( write_idx == delay_reg.size() ) {
@@ -268,60 +424,388 @@ CSample CSampleDelay::process(CSample input ) {
     return output;
 }
 
+template <typename R>
+R blockPower( const CSampleT<R> *in, int count ) {
+    if ( count <= 0 ) {
+        return 0;
+    }
+    // walk the I/Q pairs as one flat array so the sum vectorizes
+    const R *v = reinterpret_cast<const R*>( in );
+    R sum = 0;
+    for ( int idx=0; idx < 2*count; ++idx ) {
+        sum += v[idx]*v[idx];
+    }
+    return sum / count;
+}
+
+template <typename R>
+R blockPower( const R *in_i, const R *in_q, int count ) {
+    if ( count <= 0 ) {
+        return 0;
+    }
+    R sum = 0;
+    for ( int idx=0; idx < count; ++idx ) {
+        sum += in_i[idx]*in_i[idx] + in_q[idx]*in_q[idx];
+    }
+    return sum / count;
+}
+
+Squelch::Squelch( double open_db, double close_db, long _pre_roll, long _post_roll ) {
+    open_level = std::pow( 10.0, open_db/10 );
+    close_level = std::pow( 10.0, close_db/10 );
+    pre_roll = _pre_roll;
+    post_roll = _post_roll;
+    open = false;
+    quiet = 0;
+}
+
+bool Squelch::update( double power, int count ) {
+    if ( !open ) {
+        if ( power < open_level ) {
+            return false;
+        }
+        open = true;
+        quiet = 0;
+        return true;
+    }
+    if ( power >= close_level ) {
+        quiet = 0;
+        return true;
+    }
+    quiet += count;
+    if ( quiet > post_roll ) {
+        open = false;
+        return false;
+    }
+    return true;
+}
+
+template <typename R>
+AGCT<R>::AGCT( double sample_rate, double _target_db, double attack_db_s, double decay_db_s,
+               int _block, double _max_gain_db ) {
+    target_db = _target_db;
+    attack = attack_db_s / sample_rate;
+    decay = decay_db_s / sample_rate;
+    max_gain_db = _max_gain_db;
+    gain_db = 0;
+    block = _block;
+}
+
+template <typename R>
+void AGCT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    for ( int at=0; at < count; at += block ) {
+        int n = std::min( block, count-at );
+        // where the gain wants to be, then limit how far it moves
+        double want = target_db - 10*std::log10( blockPower( in+at, n ) + 1e-30 );
+        want = std::max( -max_gain_db, std::min( max_gain_db, want ) );
+        double delta = want - gain_db;
+        double limit = ( delta < 0 ? attack : decay ) * n;
+        delta = std::max( -limit, std::min( limit, delta ) );
+        R g0 = std::pow( 10.0, gain_db/20 );
+        gain_db += delta;
+        R dg = ( std::pow( 10.0, gain_db/20 ) - g0 ) / n;
+        // ramp across the block, gain from the index so it vectorizes
+        const R *x = reinterpret_cast<const R*>( in+at );
+        R *y = reinterpret_cast<R*>( out+at );
+        for ( int k=0; k < n; ++k ) {
+            R g = g0 + dg*R(k+1);
+            y[2*k] = x[2*k]*g;
+            y[2*k+1] = x[2*k+1]*g;
+        }
+    }
+}
+
 
-BpskDemod::BpskDemod( int sps, double alpha, int winsize ) {
-    Filter = std::make_shared<CFIRFilter>( computeCpxRRC(sps, alpha, 4 ) );
-    FreqErrorAcc = std::make_shared<AccumulateAndDump>(winsize);
-    PhaseErrorAcc = std::make_shared<AccumulateAndDump>(winsize);
-    PhaseDelay = std::make_shared<SampleDelay>(1);
-    NCO = std::make_shared<CNCO>(0,0);
+template <typename R>
+BpskDemodT<R>::BpskDemodT( int sps, double alpha, int winsize ) {
+    std::vector< std::complex<double> > rrc = computeCpxRRC(sps, alpha, 4 );
+    Filter = std::make_shared< CFIRFilterT<R> >( std::vector< CSampleT<R> >( rrc.begin(), rrc.end() ) );
+    FreqErrorAcc = std::make_shared< CAccumulateAndDumpT<R> >(winsize);
+    PhaseErrorAcc = std::make_shared< CAccumulateAndDumpT<R> >(winsize);
+    SquareDelay = std::make_shared< CSampleDelayT<R> >(freq_lag*sps);
+    NCO = std::make_shared< CNCOT<R> >(0,0);
+    win_size = winsize;
+    freq_scale = R(0.5)/(freq_lag*sps);
     phase_est = 0;
     freq_est = 0;
+    freq_lock_threshold = 0.01;
+    phase_lock_threshold = 0.1;
     state = acq_freq;
 }
 
-CSample BpskDemod::process( CSample input) {
-    // forward part of loop
-    NCO->rate = freq_est;
-    CSample wb_sample = NCO->generate(phase_est) * input;
-    CSample nb_sample = Filter->process(wb_sample);
+template <typename R>
+int BpskDemodT<R>::setEqualizer( std::shared_ptr< EqualizerT<R> > eq ) {
+    if ( eq && eq->method != equalize_time ) {
+        std::cout << "Equalizer: only equalize_time can run inside the carrier loop\n";
+        return -1;
+    }
+    Eq = eq;
+    return 0;
+}
+
+template <typename R>
+CSampleT<R> BpskDemodT<R>::process( CSampleT<R> input) {
+    state_t last_state = state;
+    // forward part of loop, the NCO turns the input back by the estimates
+    NCO->rate = -freq_est;
+    CSampleT<R> wb_sample = NCO->generate() * input;
+    CSampleT<R> nb_sample = Filter->process(wb_sample);
+    if ( Eq ) {
+        nb_sample = Eq->process(nb_sample);
+    }
     // feedback loop
-    Phase phase_err = PhaseDetectorBPSK(nb_sample);
-    Phase phase_err_d1 = PhaseDelay->process(phase_err);
-    Phase delta_phase_err = phase_err - phase_err_d1;
-    // accumlate and scale output to give average
-    double AvgFreqError = FreqErrorAcc->process(delta_phase_err) / FreqErrorAcc->window_size;
-    double AvgPhaseError = PhaseErrorAcc->process(phase_err) / PhaseErrorAcc->window_size;
-    // state machine, update estimate for next sample input.
-    switch (state) {
-        case acq_freq:
-            phase_est = 0;
-            freq_est = AvgFreqError;
-            if ( AvgFreqError < freq_lock_threshold ) {
-                state == acq_phase;
-            }
-            break;
-        case acq_phase:
-            phase_est = AvgPhaseError;
-            if ( AvgPhaseError < phase_lock_threshold ) {
-                state == track;
-            }
-            if ( AvgFreqError > freq_lock_threshold ) {
-                state == acq_freq;
-            }
-            break;
-        case track:
-            phase_est = 0.25*AvgPhaseError;
-            freq_est = 0.1*AvgFreqError;
-            if ( AvgPhaseError > phase_lock_threshold) {
-                state == acq_phase;
-            }
-            if ( AvgFreqError > freq_lock_threshold ) {
-                state == acq_freq;
-            }
+    CSampleT<R> square = nb_sample * nb_sample;
+    CSampleT<R> rotation = square * std::conj( SquareDelay->process(square) );
+    // a window ends on this sample, its sums update the loop
+    bool dump = PhaseErrorAcc->current_win_value == PhaseErrorAcc->window_size;
+    CSampleT<R> freq_sum = FreqErrorAcc->process(rotation);
+    CSampleT<R> phase_sum = PhaseErrorAcc->process(square);
+    if ( dump ) {
+        R step = updateLoop( freq_scale*std::arg(freq_sum), R(0.5)*std::arg(phase_sum), win_size,
+                             freq_est, phase_est, freq_lock_threshold, phase_lock_threshold );
+        NCO->phase_acc = wrapPhase( NCO->phase_acc - step );
+    }
+    if ( trace.rec && trace.due( state, last_state ) ) {
+        trace.record( state, last_state, PhaseDetectorBPSK(nb_sample), freq_scale*std::arg(freq_sum),
+                      R(0.5)*std::arg(phase_sum), freq_est, phase_est, nb_sample );
     }
 
     return nb_sample;
 }
 
+template <typename R>
+void BpskDemodT<R>::process( const CSampleT<R> *in, CSampleT<R> *out, int count ) {
+    // profiled per block, timestamps per sample would cost more than the
+    // stages they measure
+    DSP_PROFILE_START(t);
+    const CSampleT<R> *src = in;
+    if ( Agc ) {
+        Agc->process( in, out, count );
+        src = out;
+        DSP_PROFILE_LAP(t, "demod.agc", count);
+    }
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = process( src[idx] );
+    }
+    DSP_PROFILE_LAP(t, "demod.loop", count);
+}
+
+template <typename R>
+void BpskDemodT<R>::reset() {
+    std::fill( Filter->taps.begin(), Filter->taps.end(), CSampleT<R>(0,0) );
+    *FreqErrorAcc = CAccumulateAndDumpT<R>( win_size );
+    *PhaseErrorAcc = CAccumulateAndDumpT<R>( win_size );
+    *SquareDelay = CSampleDelayT<R>( SquareDelay->delay_reg.size()-1 );
+    NCO->rate = 0;
+    NCO->phase_acc = 0;
+    phase_est = 0;
+    freq_est = 0;
+    state = acq_freq;
+    if ( Eq ) {
+        Eq->reset();
+    }
+}
+
+// float (c32) and double (c64) precision instantiations
+#define LIBDSP_INSTANTIATE(R) \
+    template R wrapPhase<R>(R p); \
+    template struct NCOT<R>; \
+    template struct CNCOT<R>; \
+    template struct FIRFilterT<R>; \
+    template struct CFIRFilterT<R>; \
+    template struct CInterpolatorT<R>; \
+    template struct FFTT<R>; \
+    template struct CAccumulateAndDumpT<R>; \
+    template struct AccumulateAndDumpT<R>; \
+    template struct SampleDelayT<R>; \
+    template struct CSampleDelayT<R>; \
+    template R blockPower<R>( const CSampleT<R> *in, int count ); \
+    template R blockPower<R>( const R *in_i, const R *in_q, int count ); \
+    template struct AGCT<R>; \
+    template R PhaseDetectorBPSK<R>( CSampleT<R> input ); \
+    template void PhaseDetectorBPSK<R>( const R *in_i, const R *in_q, R *err, int count ); \
+    template struct BpskDemodT<R>;
+
+LIBDSP_INSTANTIATE(float)
+LIBDSP_INSTANTIATE(double)
+
+
+/////////////////////////////
+// Fixed point (Q15) path
+///////////////////////////
+
+double blockPower( const CSampleQ15 *in, int count ) {
+    if ( count <= 0 ) {
+        return 0;
+    }
+    const int16_t *v = reinterpret_cast<const int16_t*>( in );
+    int64_t sum = 0;
+    for ( int idx=0; idx < 2*count; ++idx ) {
+        sum += (int32_t)v[idx]*v[idx];
+    }
+    return (double)sum / ( 32768.0*32768.0 ) / count;
+}
+
+std::vector<int16_t> quantizeQ15( const std::vector<double> &coeff, double gain ) {
+    std::vector<int16_t> q( coeff.size() );
+    for ( size_t idx=0; idx < coeff.size(); ++idx ) {
+        q[idx] = saturateQ15( (int32_t)std::lround( coeff[idx] * gain * 32768.0 ) );
+    }
+    return q;
+}
+
+// 4096 entry Q15 cos table, sin is read a quarter turn back.
+static const int q15_lut_bits = 12;
+static const std::vector<int16_t> &cosTableQ15() {
+    static std::vector<int16_t> table = [] {
+        std::vector<int16_t> t( 1 << q15_lut_bits );
+        for ( size_t idx=0; idx < t.size(); ++idx ) {
+            t[idx] = saturateQ15( (int32_t)std::lround( 32767.0 * std::cos( 2*M_PI*idx/t.size() ) ) );
+        }
+        return t;
+    }();
+    return table;
+}
+
+CNCOQ15::CNCOQ15( RadRate _r, Phase _p ) {
+    rate = toPhase(_r);
+    phase_acc = toPhase(_p);
+}
+
+uint32_t CNCOQ15::toPhase( Phase p ) {
+    // 2pi maps onto the full 32 bit range, wrap is free
+    return (uint32_t)(int64_t)std::llround( p * ( 4294967296.0 / (2*M_PI) ) );
+}
+
+CSampleQ15 CNCOQ15::generate( uint32_t offset ) {
+    const std::vector<int16_t> &lut = cosTableQ15();
+    const uint32_t mask = ( 1 << q15_lut_bits ) - 1;
+    uint32_t idx = ( phase_acc + ( 1u << (31-q15_lut_bits) ) ) >> ( 32-q15_lut_bits );
+    CSampleQ15 s;
+    s.i = lut[ idx & mask ];
+    s.q = lut[ ( idx - ( 1 << (q15_lut_bits-2) ) ) & mask ];
+    // update for next sample
+    phase_acc = phase_acc + rate + offset;
+    return s;
+}
+
+// Q15 complex multiply with rounding
+static inline CSampleQ15 cmulQ15( CSampleQ15 a, CSampleQ15 b ) {
+    CSampleQ15 r;
+    r.i = saturateQ15( ( (int32_t)a.i*b.i - (int32_t)a.q*b.q + (1 << 14) ) >> 15 );
+    r.q = saturateQ15( ( (int32_t)a.i*b.q + (int32_t)a.q*b.i + (1 << 14) ) >> 15 );
+    return r;
+}
+
+void CNCOQ15::mix( const CSampleQ15 *in, CSampleQ15 *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = cmulQ15( generate(), in[idx] );
+    }
+}
+
+CFIRFilterQ15::CFIRFilterQ15( std::vector<int16_t> _coeff_i, std::vector<int16_t> _coeff_q ) {
+    coeff_i = _coeff_i;
+    coeff_q = _coeff_q;
+    // delay line stored twice, newest sample first
+    hist_i.assign( 2*coeff_i.size(), 0 );
+    hist_q.assign( 2*coeff_i.size(), 0 );
+    pos = 0;
+}
+
+CSampleQ15 CFIRFilterQ15::process( CSampleQ15 in ) {
+    const int ntaps = coeff_i.size();
+    // shift in new sample
+    pos = ( pos == 0 ) ? ntaps-1 : pos-1;
+    hist_i[pos] = hist_i[pos+ntaps] = in.i;
+    hist_q[pos] = hist_q[pos+ntaps] = in.q;
+    const int16_t *hi = &hist_i[pos];
+    const int16_t *hq = &hist_q[pos];
+    const int16_t *ci = coeff_i.data();
+    const int16_t *cq = coeff_q.data();
+    // int32 multiply accumulate, taps scaled so this can't overflow
+    int32_t acc_i = 0;
+    int32_t acc_q = 0;
+    for ( int idx=0; idx < ntaps; ++idx ) {
+        acc_i += (int32_t)ci[idx]*hi[idx] - (int32_t)cq[idx]*hq[idx];
+        acc_q += (int32_t)ci[idx]*hq[idx] + (int32_t)cq[idx]*hi[idx];
+    }
+    CSampleQ15 out;
+    out.i = saturateQ15( ( acc_i + (1 << 14) ) >> 15 );
+    out.q = saturateQ15( ( acc_q + (1 << 14) ) >> 15 );
+    return out;
+}
+
+void CFIRFilterQ15::process( const CSampleQ15 *in, CSampleQ15 *out, int count ) {
+    for ( int idx=0; idx < count; ++idx ) {
+        out[idx] = process( in[idx] );
+    }
+}
+
+CFIRFilterQ15 makeCpxRRCQ15( double sps, double a, double d, double *gain ) {
+    std::vector<double> taps = computeRRC( sps, a, d );
+    // computeCpxRRC taps are real (Q parts 0), worst case accumulator
+    // growth is the sum of |I|+|Q| over all taps.
+    double l1 = 0;
+    for ( auto &t : taps ) {
+        l1 += std::abs(t);
+    }
+    double g = ( l1 > 1.99 ) ? 1.99/l1 : 1.0;
+    if ( gain ) {
+        *gain = g;
+    }
+    std::vector<int16_t> q = quantizeQ15( taps, g );
+    return CFIRFilterQ15( q, std::vector<int16_t>( q.size(), 0 ) );
+}
+
+BpskDemodQ15::BpskDemodQ15( int sps, double alpha, int winsize ) :
+    Filter( makeCpxRRCQ15( sps, alpha, 4, &filter_gain ) ),
+    FreqErrorAcc( winsize ),
+    PhaseErrorAcc( winsize ),
+    SquareDelay( freq_lag*sps ) {
+    win_size = winsize;
+    freq_scale = 0.5f/(freq_lag*sps);
+    phase_est = 0;
+    freq_est = 0;
+    freq_lock_threshold = 0.01;
+    phase_lock_threshold = 0.1;
+    state = acq_freq;
+}
+
+CSampleQ15 BpskDemodQ15::process( CSampleQ15 input ) {
+    state_t last_state = state;
+    // forward part of loop, fixed point
+    NCO.rate = CNCOQ15::toPhase( -freq_est );
+    CSampleQ15 wb_sample = cmulQ15( NCO.generate(), input );
+    CSampleQ15 nb_sample = Filter.process( wb_sample );
+    // feedback loop, float
+    CSampleT<float> nb( nb_sample.i, nb_sample.q );
+    CSampleT<float> square = nb * nb;
+    CSampleT<float> rotation = square * std::conj( SquareDelay.process( square ) );
+    // a window ends on this sample, its sums update the loop
+    bool dump = PhaseErrorAcc.current_win_value == PhaseErrorAcc.window_size;
+    CSampleT<float> freq_sum = FreqErrorAcc.process( rotation );
+    CSampleT<float> phase_sum = PhaseErrorAcc.process( square );
+    if ( dump ) {
+        double step = updateLoop( freq_scale*std::arg(freq_sum), 0.5f*std::arg(phase_sum), win_size,
+                                  freq_est, phase_est, freq_lock_threshold, phase_lock_threshold );
+        NCO.phase_acc -= CNCOQ15::toPhase( step );
+    }
+    if ( trace.rec && trace.due( state, last_state ) ) {
+        trace.record( state, last_state, PhaseDetectorBPSK( nb ), freq_scale*std::arg(freq_sum),
+                      0.5f*std::arg(phase_sum), (float)freq_est, (float)phase_est, nb );
+    }
+    return nb_sample;
+}
 
+void BpskDemodQ15::reset() {
+    std::fill( Filter.hist_i.begin(), Filter.hist_i.end(), 0 );
+    std::fill( Filter.hist_q.begin(), Filter.hist_q.end(), 0 );
+    Filter.pos = 0;
+    FreqErrorAcc = CAccumulateAndDumpT<float>( win_size );
+    PhaseErrorAcc = CAccumulateAndDumpT<float>( win_size );
+    SquareDelay = CSampleDelayT<float>( SquareDelay.delay_reg.size()-1 );
+    NCO = CNCOQ15();
+    phase_est = 0;
+    freq_est = 0;
+    state = acq_freq;
+}
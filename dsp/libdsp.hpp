@@ -7,6 +7,7 @@
 #include <cmath>
 #include <algorithm>
 #include <memory>
+#include "trace.hpp"
 
 /////////////////////////////
 // Type definitions
@@ -27,11 +28,22 @@ using Phase        =    double;
 // Amplitude/Magnitude of a signal
 using Magnitude    =    double;
 
+// Sample precision
+// blocks below are templates on the real type R of a sample, and are
+// instantiated for float (c32 captures) and double (c64 captures).
+// The un-suffixed names are the double precision versions.
+
 // Complex Samples
+// define what a complex sample of precision R is
+template <typename R>
+using CSampleT      =    std::complex<R>;
 // define what a complex sample is
-using CSample       =    std::complex<double>;
-// define what a vector of csamples is
-using CSampleVector =    std::vector<CSample>;
+using CSample       =    CSampleT<double>;
+// define what a vector of csamples is (A: arena.hpp's ArenaAllocator for
+// hugepage / NUMA node buffers)
+template <typename R, typename A = std::allocator< CSampleT<R> > >
+using CSampleVectorT =   std::vector< CSampleT<R>, A >;
+using CSampleVector =    CSampleVectorT<double>;
 // CSample Vector Iterator
 using CSampleVectorIter = CSampleVector::iterator;
 // Define what a csample Queue is
@@ -63,46 +75,93 @@ Magnitude getMagnitude( CSample s );
 Phase getPhase( CSample s );
 // convert a mag/phase back into a CSample
 CSample Polar2CSample( Magnitude m, Phase p );
+// wrap a phase into -pi to +pi
+template <typename R>
+R wrapPhase( R p );
 
 // NCO object (Cos wave)
-struct NCO {
+template <typename R>
+struct NCOT {
     // radian rate phase acc increases by every sample
-    RadRate rate;
+    R rate;
     // phase acc
-    Phase phase_acc;
+    R phase_acc;
     // quick constructor
-    NCO( RadRate _r, Phase _p ) : rate(_r), phase_acc(_p)  {}
+    NCOT( R _r, R _p ) : rate(_r), phase_acc(_p)  {}
     // complex next sample, add offset to phase_acc
-    Sample generate( Phase offset=0 );
+    R generate( R offset=0 );
 };
+using NCO = NCOT<double>;
 
 // Complex NCO object (COS)
-struct CNCO {
+template <typename R>
+struct CNCOT {
     // radian rate phase acc inc by every sample
-    RadRate rate;
+    R rate;
     // phase accumulator
-    Phase phase_acc;
+    R phase_acc;
     // simple constructor
-    CNCO( RadRate _r, Phase _p ) : rate(_r), phase_acc(_p) {}
+    CNCOT( R _r, R _p ) : rate(_r), phase_acc(_p) {}
     // generate next sample, add offset to phase_acc
-    CSample generate( Phase offset=0 );
+    CSampleT<R> generate( R offset=0 );
+    // out = NCO * in for a block of planar samples (planar.hpp), the same
+    // phases as count generate() calls, in and out may be the same
+    void mix( const R *in_i, const R *in_q, R *out_i, R *out_q, int count );
 };
+using CNCO = CNCOT<double>;
 
 // FIR Filter for real values
-struct FIRFilter {
-    std::vector<double> coeff;
-    std::vector<Sample> taps;
-    FIRFilter( std::vector<double> _coeff );
-    Sample process(Sample in);
+template <typename R>
+struct FIRFilterT {
+    std::vector<R> coeff;
+    std::vector<R> taps;
+    FIRFilterT( std::vector<R> _coeff );
+    R process(R in);
 };
+using FIRFilter = FIRFilterT<double>;
 
 // FIR Filter for complex values
-struct CFIRFilter {
-    std::vector< std::complex<double> > coeff;
-    std::vector<CSample> taps;
-    CFIRFilter( std::vector< std::complex<double> > _coeff );
-    CSample process(CSample in);
+template <typename R>
+struct CFIRFilterT {
+    std::vector< CSampleT<R> > coeff;
+    std::vector< CSampleT<R> > taps;
+    CFIRFilterT( std::vector< CSampleT<R> > _coeff );
+    CSampleT<R> process(CSampleT<R> in);
+};
+using CFIRFilter = CFIRFilterT<double>;
+
+// Polyphase interpolator for pulse shaping, one symbol in, sps samples
+// out.  The prototype filter (usually computeRRC at the same sps) is split
+// into sps branches of every sps'th tap, so the zeros stuffed between
+// symbols are never multiplied.
+template <typename R>
+struct CInterpolatorT {
+    int sps;
+    std::vector<R> branches;            // [phase*branch_len+k] = proto[k*sps+phase]
+    std::vector< CSampleT<R> > hist;    // symbol history, doubled
+    int branch_len;
+    int pos;
+    CInterpolatorT( int _sps, std::vector<double> proto );
+    // interpolate one symbol, writes sps samples to out
+    void process( CSampleT<R> symbol, CSampleT<R> *out );
+    // interpolate count symbols, writes count*sps samples to out
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+};
+using CInterpolator = CInterpolatorT<double>;
+
+// Radix-2 FFT, size must be a power of 2.  Twiddles and the bit reverse
+// order are computed once at construction, transforms are in place.
+// inverse() is unscaled, inverse(forward(x)) == size*x.
+template <typename R>
+struct FFTT {
+    int size;
+    std::vector<int> bitrev;
+    std::vector< CSampleT<R> > twiddle;  // exp(-j*2pi*k/size), k < size/2
+    FFTT( int _size );
+    void forward( CSampleT<R> *data ) const;
+    void inverse( CSampleT<R> *data ) const;
 };
+using FFT = FFTT<double>;
 
 // compute the coeffs needed for a FIR filter
 // with sps Samples/Symbol (>2) and with rolloff (0-1)
@@ -110,7 +169,8 @@ struct CFIRFilter {
 // Larger domain ranges will give larger filters with better approximiations.
 // Larger number of Samples/Symbol will also cause the filter to become large.
 std::vector<double> computeRRC(double sps, double a, double d);
-// samething returns I,Q the same (symetric filter)
+// samething as complex taps, real valued (Q parts 0) so the filter
+// doesn't rotate what it passes
 std::vector<std::complex<double>> computeCpxRRC(double sps, double a,double d);
 
 // apply a window to a set of double values
@@ -119,64 +179,291 @@ void applyCpxWindowHann( CSampleVector *v );
 
 
 // Accumulate and Dump  (complex and normal)
-struct CAccumulateAndDump {
+template <typename R>
+struct CAccumulateAndDumpT {
     int window_size;
     int current_win_value;
-    CSample accumulator;
-    CSample lastDumpValue;
-    CAccumulateAndDump( int _window_size, CSample init_val=CSample(0,0) );
-    CSample process( CSample input );
+    CSampleT<R> accumulator;
+    CSampleT<R> lastDumpValue;
+    CAccumulateAndDumpT( int _window_size, CSampleT<R> init_val=CSampleT<R>(0,0) );
+    CSampleT<R> process( CSampleT<R> input );
 };
+using CAccumulateAndDump = CAccumulateAndDumpT<double>;
 
-struct AccumulateAndDump {
+template <typename R>
+struct AccumulateAndDumpT {
     int window_size;
     int current_win_value;
-    Sample accumulator;
-    Sample lastDumpValue;
-    AccumulateAndDump( int _window_size, Sample init_val=0 );
-    Sample process( Sample input );
+    R accumulator;
+    R lastDumpValue;
+    AccumulateAndDumpT( int _window_size, R init_val=0 );
+    R process( R input );
 };
+using AccumulateAndDump = AccumulateAndDumpT<double>;
 
-struct SampleDelay {
-    SampleDelay( int delay_cnt );
-    std::vector<Sample> delay_reg;
+template <typename R>
+struct SampleDelayT {
+    SampleDelayT( int delay_cnt );
+    std::vector<R> delay_reg;
     int read_idx;
     int write_idx;
-    Sample process(Sample input );
+    R process(R input );
 };
+using SampleDelay = SampleDelayT<double>;
 
-struct CSampleDelay {
-    CSampleDelay( int delay_cnt );
-    std::vector<CSample> delay_reg;
+template <typename R>
+struct CSampleDelayT {
+    CSampleDelayT( int delay_cnt );
+    std::vector< CSampleT<R> > delay_reg;
     int read_idx;
     int write_idx;
-    CSample process(CSample input );
+    CSampleT<R> process(CSampleT<R> input );
 };
+using CSampleDelay = CSampleDelayT<double>;
 
+// mean power (|x|^2) of a block of samples, 1.0 is a full scale tone
+template <typename R>
+R blockPower( const CSampleT<R> *in, int count );
+// the same for planar samples
+template <typename R>
+R blockPower( const R *in_i, const R *in_q, int count );
+
+// Energy squelch, gates a stream block by block on its mean power.
+// Opens when a block reaches open_db (dBFS) and stays open until the
+// power has been under close_db for more than post_roll samples, so a
+// close_db below open_db gives hysteresis.  pre_roll is how many samples
+// ahead of the opening block the caller should also pass, it is not
+// buffered here (bpsk_demod re-reads them from the capture).
+struct Squelch {
+    double open_level;      // linear power
+    double close_level;     // linear power
+    long pre_roll;
+    long post_roll;
+    bool open;
+    long quiet;             // samples under close_level since the last loud block
+    Squelch( double open_db, double close_db, long _pre_roll, long _post_roll );
+    // feed the power of the next count samples, returns true if they pass
+    bool update( double power, int count );
+};
+
+
+// Automatic gain control, fast attack and slow decay.  Works on blocks:
+// each block's mean power (blockPower) sets where the gain should be, the
+// gain moves there at no more than attack dB/s (getting quieter) or
+// decay dB/s (getting louder), and the change is ramped linearly across
+// the block so there are no steps in the output.  Long calls are split
+// into block sized pieces.
+template <typename R>
+struct AGCT {
+    double target_db;       // output power, dBFS
+    double attack;          // dB per sample the gain may fall
+    double decay;           // dB per sample the gain may rise
+    double max_gain_db;     // gain limit (both ways), so silence isn't amplified forever
+    double gain_db;
+    int block;
+    AGCT( double sample_rate, double _target_db=-6, double attack_db_s=20000, double decay_db_s=2000,
+          int _block=256, double _max_gain_db=60 );
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+};
+using AGC = AGCT<double>;
+
+// adaptive equalizer (equalizer.hpp), optional in the demods
+template <typename R>
+struct EqualizerT;
 
 // measure the phase of the input sample and compute
 // the phase error with respects to the BPSK reference constelation.
-Phase PhaseDetectorBPSK( CSample input );
+template <typename R>
+R PhaseDetectorBPSK( CSampleT<R> input );
+// the same for a block of planar samples, err gets count values
+template <typename R>
+void PhaseDetectorBPSK( const R *in_i, const R *in_q, R *err, int count );
+
+// demodulator lock state, shared by every BPSK demod variant
+struct BpskDemodState {
+    // the frequency error compares squared samples this many symbols
+    // apart: more is less noisy, the capture range is +/- pi/(2*lag*sps)
+    // rads/sample (0.098 at 4 sps)
+    static const int freq_lag = 4;
+    // track is only dropped after this many windows in a row over the
+    // phase threshold, single noisy windows don't count
+    static const int lock_miss_windows = 4;
 
-struct BpskDemod {
     enum state_t {
         acq_freq=0,
         acq_phase=1,
         track=2
     } state;
+    int lock_misses = 0;
+
+    // Loop update, once per averaging window with that window's mean
+    // frequency error (rad/sample) and mean phase error (rad), both
+    // residuals after the NCO.  Acquisition takes the frequency error out
+    // in one step, then a phase loop (proportional on the phase error,
+    // integral into the frequency) pulls in and tracks, window samples
+    // apart.  Returns the phase step taken, the caller turns its NCO
+    // back by it.
+    template <typename E, typename R>
+    E updateLoop( R avg_freq_err, R avg_phase_err, int window, E &freq_est, E &phase_est,
+                  E freq_lock_threshold, E phase_lock_threshold ) {
+        E step = 0;
+        switch (state) {
+            case acq_freq:
+                freq_est += avg_freq_err;
+                if ( std::abs(avg_freq_err) < freq_lock_threshold ) {
+                    state = acq_phase;
+                }
+                break;
+            case acq_phase:
+                step = avg_phase_err;
+                freq_est += E(0.5)*avg_phase_err/window;
+                if ( std::abs(avg_phase_err) < phase_lock_threshold ) {
+                    state = track;
+                    lock_misses = 0;
+                }
+                if ( std::abs(avg_freq_err) > freq_lock_threshold ) {
+                    state = acq_freq;
+                }
+                break;
+            case track:
+                // the phase loop measures frequency better than the
+                // frequency error does, only phase errors drop lock
+                step = E(0.25)*avg_phase_err;
+                freq_est += E(0.1)*avg_phase_err/window;
+                if ( std::abs(avg_phase_err) <= phase_lock_threshold ) {
+                    lock_misses = 0;
+                } else if ( ++lock_misses == lock_miss_windows ) {
+                    state = acq_phase;
+                }
+        }
+        phase_est = wrapPhase( phase_est + step );
+        return step;
+    }
+};
 
+template <typename R>
+struct BpskDemodT : BpskDemodState {
     int win_size;
-    double freq_est;
-    double phase_est;
-    int freq_lock_threshold;
-    int phase_lock_threshold;
-    std::shared_ptr<CFIRFilter> Filter;
-    std::shared_ptr<AccumulateAndDump> FreqErrorAcc;
-    std::shared_ptr<AccumulateAndDump> PhaseErrorAcc;
-    std::shared_ptr<SampleDelay> PhaseDelay;
-    std::shared_ptr<CNCO> NCO;
-    BpskDemod( int sps, double alpha, int winsize );
-    CSample process(CSample input);
+    R freq_scale;           // 1/(2*freq_lag*sps)
+    R freq_est;
+    R phase_est;
+    R freq_lock_threshold;
+    R phase_lock_threshold;
+    std::shared_ptr< CFIRFilterT<R> > Filter;
+    // the loop works on squared samples, which takes the BPSK modulation
+    // off and weights each sample by its power: per window the phase
+    // error is arg(sum x^2)/2 and the frequency error arg(sum x^2 *
+    // conj(x^2 freq_lag symbols back))/(2*freq_lag*sps)
+    std::shared_ptr< CAccumulateAndDumpT<R> > FreqErrorAcc;
+    std::shared_ptr< CAccumulateAndDumpT<R> > PhaseErrorAcc;
+    std::shared_ptr< CSampleDelayT<R> > SquareDelay;
+    std::shared_ptr< CNCOT<R> > NCO;
+    // optional gain control ahead of the mixer and matched filter, only
+    // used by the block process()
+    std::shared_ptr< AGCT<R> > Agc;
+    // optional equalizer between the matched filter and the loop, set
+    // with setEqualizer()
+    std::shared_ptr< EqualizerT<R> > Eq;
+    // loop trace, off until a TraceRecorder is attached
+    TraceTap trace;
+    BpskDemodT( int sps, double alpha, int winsize );
+    // time path equalizers only, an equalize_fft one is a block late for
+    // the loop: returns -1 and Eq stays as it was.  nullptr removes it.
+    int setEqualizer( std::shared_ptr< EqualizerT<R> > eq );
+    CSampleT<R> process(CSampleT<R> input);
+    // demodulate count samples, through the AGC first if there is one
+    void process( const CSampleT<R> *in, CSampleT<R> *out, int count );
+    // back to the just constructed state (filter history, loop and estimates)
+    void reset();
 };
+using BpskDemod = BpskDemodT<double>;
 
 
+/////////////////////////////
+// Fixed point (Q15) path
+///////////////////////////
+//
+// int16 pipeline that runs directly on sc16 samples from the radio.
+// Samples and coefficients are Q15 (-1.0 .. 1.0 == -32768 .. 32767),
+// products accumulate in int32 and results are rounded and saturated back
+// to int16.  Kernels are plain loops over int16 arrays written so the
+// compiler can map them to packed 16 bit multiply-add (pmaddwd etc).
+//
+// Measured against the double path on the same test vector (dsp/tests.cpp,
+// uniform random I/Q peaking at -6 dBFS, RRC sps=4 a=0.35):
+//    CFIRFilterQ15           ~ 75 dB SNR vs CFIRFilter
+//    CNCOQ15 + CFIRFilterQ15 ~ 66 dB SNR vs CNCO + CFIRFilter
+// The mixer loss is dominated by the 4096 entry table's phase resolution.
+
+// sc16 sample, I/Q interleaved int16
+struct CSampleQ15 {
+    int16_t i;
+    int16_t q;
+};
+
+// saturate an int32 to the int16 range
+inline int16_t saturateQ15( int32_t v ) {
+    return (int16_t)( v > 32767 ? 32767 : ( v < -32768 ? -32768 : v ) );
+}
+
+// mean power of a block of sc16 samples, relative to full scale (see blockPower)
+double blockPower( const CSampleQ15 *in, int count );
+
+// quantize coefficients to Q15 after scaling them by gain
+std::vector<int16_t> quantizeQ15( const std::vector<double> &coeff, double gain=1.0 );
+
+// Q15 NCO, 32 bit phase accumulator (2^32 == 2pi) and a 4096 entry
+// cos table.
+struct CNCOQ15 {
+    uint32_t rate;
+    uint32_t phase_acc;
+    CNCOQ15( RadRate _r=0, Phase _p=0 );
+    // convert rads (or rads/sample) to accumulator units
+    static uint32_t toPhase( Phase p );
+    // generate next sample, add offset to phase_acc (like CNCO)
+    CSampleQ15 generate( uint32_t offset=0 );
+    // out = NCO * in, for a block of samples
+    void mix( const CSampleQ15 *in, CSampleQ15 *out, int count );
+};
+
+// Q15 complex FIR filter.  The delay line is kept planar (separate I and Q)
+// and doubled so the taps are always contiguous for the MAC loop.
+struct CFIRFilterQ15 {
+    std::vector<int16_t> coeff_i;
+    std::vector<int16_t> coeff_q;
+    std::vector<int16_t> hist_i;
+    std::vector<int16_t> hist_q;
+    int pos;
+    CFIRFilterQ15( std::vector<int16_t> _coeff_i, std::vector<int16_t> _coeff_q );
+    CSampleQ15 process( CSampleQ15 in );
+    void process( const CSampleQ15 *in, CSampleQ15 *out, int count );
+};
+
+// complex RRC (like computeCpxRRC) quantized to Q15.  Taps are scaled so
+// a full scale input can not overflow the int32 accumulator of
+// CFIRFilterQ15, the scale applied is returned in *gain.
+CFIRFilterQ15 makeCpxRRCQ15( double sps, double a, double d, double *gain );
+
+// BpskDemod variant with a Q15 forward path (mixer and matched filter).
+// The loop (phase detector, averaging and state machine) runs in float.
+struct BpskDemodQ15 : BpskDemodState {
+    using sample_t = CSampleQ15;
+    int win_size;
+    double freq_est;
+    double phase_est;
+    double freq_lock_threshold;
+    double phase_lock_threshold;
+    double filter_gain;
+    CNCOQ15 NCO;
+    CFIRFilterQ15 Filter;
+    float freq_scale;
+    // loop on squared samples, see BpskDemodT
+    CAccumulateAndDumpT<float> FreqErrorAcc;
+    CAccumulateAndDumpT<float> PhaseErrorAcc;
+    CSampleDelayT<float> SquareDelay;
+    TraceTap trace;
+    BpskDemodQ15( int sps, double alpha, int winsize );
+    CSampleQ15 process( CSampleQ15 input );
+    // back to the just constructed state
+    void reset();
+};
@@ -0,0 +1,35 @@
+function trace = loadTrace(filename)
+%  trace = loadTrace(filename)
+%
+% reads a demod loop trace written by TraceRecorder (bpsk_demod -T)
+% 40 byte header, then 40 byte records of
+%   uint64 sample, float phase_err, freq_err, avg_phase_err,
+%   freq_est, phase_est, magnitude, uint32 state, last_state
+% returns a struct of column vectors, one entry per record
+%
+
+% Open File
+fid = fopen(filename,'rb');
+magic = fread(fid,8,'char=>char')';
+if ~strcmp(magic,'DSPTRACE')
+    fclose(fid);
+    error('loadTrace: %s is not a trace file', filename);
+end
+hdr = fread(fid,2,'uint32');
+counts = fread(fid,2,'uint64');
+every = fread(fid,2,'uint32');
+trace.every = every(1);
+trace.dropped = counts(2);
+
+% read all records as bytes, one record per column
+raw = fread(fid,[hdr(2) counts(1)],'uint8=>uint8');
+fclose(fid);
+
+trace.sample = double(typecast(reshape(raw(1:8,:),[],1),'uint64'));
+names = {'phase_err','freq_err','avg_phase_err','freq_est','phase_est','magnitude'};
+for idx = 1:numel(names)
+    off = 8 + (idx-1)*4;
+    trace.(names{idx}) = double(typecast(reshape(raw(off+1:off+4,:),[],1),'single'));
+end
+trace.state = double(typecast(reshape(raw(33:36,:),[],1),'uint32'));
+trace.last_state = double(typecast(reshape(raw(37:40,:),[],1),'uint32'));
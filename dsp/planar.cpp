@@ -0,0 +1,164 @@
+#include "planar.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+template <typename R>
+PlanarSamplesT<R>::PlanarSamplesT( int count, BufferArena *arena )
+    : i( count, R(0), ArenaAllocator<R>( arena ) ), q( count, R(0), ArenaAllocator<R>( arena ) ) {
+}
+
+template <typename R>
+void PlanarSamplesT<R>::resize( int count ) {
+    i.resize( count );
+    q.resize( count );
+}
+
+template <typename R>
+void PlanarSamplesT<R>::load( const CSampleT<R> *in, int count ) {
+    resize( count );
+    deinterleave( in, count, i.data(), q.data() );
+}
+
+template <typename R>
+void PlanarSamplesT<R>::store( CSampleT<R> *out ) const {
+    interleave( i.data(), q.data(), size(), out );
+}
+
+// The SIMD parts do as many samples as fill whole registers and return
+// how many, the plain loops below finish the rest.  Loads and stores are
+// unaligned, callers' buffers need not be.
+
+#if defined(__SSE2__)
+
+static int deinterleaveSimd( const CSampleT<float> *in, int count, float *out_i, float *out_q ) {
+    const float *x = reinterpret_cast<const float*>( in );
+    int n = count & ~3;
+    for ( int k=0; k < n; k += 4 ) {
+        __m128 a = _mm_loadu_ps( x + 2*k );         // i0 q0 i1 q1
+        __m128 b = _mm_loadu_ps( x + 2*k + 4 );     // i2 q2 i3 q3
+        _mm_storeu_ps( out_i + k, _mm_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) ) );
+        _mm_storeu_ps( out_q + k, _mm_shuffle_ps( a, b, _MM_SHUFFLE(3,1,3,1) ) );
+    }
+    return n;
+}
+
+static int deinterleaveSimd( const CSampleT<double> *in, int count, double *out_i, double *out_q ) {
+    const double *x = reinterpret_cast<const double*>( in );
+    int n = count & ~1;
+    for ( int k=0; k < n; k += 2 ) {
+        __m128d a = _mm_loadu_pd( x + 2*k );        // i0 q0
+        __m128d b = _mm_loadu_pd( x + 2*k + 2 );    // i1 q1
+        _mm_storeu_pd( out_i + k, _mm_unpacklo_pd( a, b ) );
+        _mm_storeu_pd( out_q + k, _mm_unpackhi_pd( a, b ) );
+    }
+    return n;
+}
+
+static int interleaveSimd( const float *in_i, const float *in_q, int count, CSampleT<float> *out ) {
+    float *y = reinterpret_cast<float*>( out );
+    int n = count & ~3;
+    for ( int k=0; k < n; k += 4 ) {
+        __m128 a = _mm_loadu_ps( in_i + k );
+        __m128 b = _mm_loadu_ps( in_q + k );
+        _mm_storeu_ps( y + 2*k, _mm_unpacklo_ps( a, b ) );
+        _mm_storeu_ps( y + 2*k + 4, _mm_unpackhi_ps( a, b ) );
+    }
+    return n;
+}
+
+static int interleaveSimd( const double *in_i, const double *in_q, int count, CSampleT<double> *out ) {
+    double *y = reinterpret_cast<double*>( out );
+    int n = count & ~1;
+    for ( int k=0; k < n; k += 2 ) {
+        __m128d a = _mm_loadu_pd( in_i + k );
+        __m128d b = _mm_loadu_pd( in_q + k );
+        _mm_storeu_pd( y + 2*k, _mm_unpacklo_pd( a, b ) );
+        _mm_storeu_pd( y + 2*k + 2, _mm_unpackhi_pd( a, b ) );
+    }
+    return n;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static int deinterleaveSimd( const CSampleT<float> *in, int count, float *out_i, float *out_q ) {
+    const float *x = reinterpret_cast<const float*>( in );
+    int n = count & ~3;
+    for ( int k=0; k < n; k += 4 ) {
+        float32x4x2_t v = vld2q_f32( x + 2*k );
+        vst1q_f32( out_i + k, v.val[0] );
+        vst1q_f32( out_q + k, v.val[1] );
+    }
+    return n;
+}
+
+static int deinterleaveSimd( const CSampleT<double> *in, int count, double *out_i, double *out_q ) {
+    const double *x = reinterpret_cast<const double*>( in );
+    int n = count & ~1;
+    for ( int k=0; k < n; k += 2 ) {
+        float64x2x2_t v = vld2q_f64( x + 2*k );
+        vst1q_f64( out_i + k, v.val[0] );
+        vst1q_f64( out_q + k, v.val[1] );
+    }
+    return n;
+}
+
+static int interleaveSimd( const float *in_i, const float *in_q, int count, CSampleT<float> *out ) {
+    float *y = reinterpret_cast<float*>( out );
+    int n = count & ~3;
+    for ( int k=0; k < n; k += 4 ) {
+        float32x4x2_t v = { { vld1q_f32( in_i + k ), vld1q_f32( in_q + k ) } };
+        vst2q_f32( y + 2*k, v );
+    }
+    return n;
+}
+
+static int interleaveSimd( const double *in_i, const double *in_q, int count, CSampleT<double> *out ) {
+    double *y = reinterpret_cast<double*>( out );
+    int n = count & ~1;
+    for ( int k=0; k < n; k += 2 ) {
+        float64x2x2_t v = { { vld1q_f64( in_i + k ), vld1q_f64( in_q + k ) } };
+        vst2q_f64( y + 2*k, v );
+    }
+    return n;
+}
+
+#else
+
+template <typename R>
+static int deinterleaveSimd( const CSampleT<R> *, int, R *, R * ) {
+    return 0;
+}
+
+template <typename R>
+static int interleaveSimd( const R *, const R *, int, CSampleT<R> * ) {
+    return 0;
+}
+
+#endif
+
+template <typename R>
+void deinterleave( const CSampleT<R> *in, int count, R *out_i, R *out_q ) {
+    for ( int k=deinterleaveSimd( in, count, out_i, out_q ); k < count; ++k ) {
+        out_i[k] = in[k].real();
+        out_q[k] = in[k].imag();
+    }
+}
+
+template <typename R>
+void interleave( const R *in_i, const R *in_q, int count, CSampleT<R> *out ) {
+    for ( int k=interleaveSimd( in_i, in_q, count, out ); k < count; ++k ) {
+        out[k] = CSampleT<R>( in_i[k], in_q[k] );
+    }
+}
+
+// float (c32) and double (c64) precision instantiations
+#define PLANAR_INSTANTIATE(R) \
+    template struct PlanarSamplesT<R>; \
+    template void deinterleave<R>( const CSampleT<R> *in, int count, R *out_i, R *out_q ); \
+    template void interleave<R>( const R *in_i, const R *in_q, int count, CSampleT<R> *out );
+
+PLANAR_INSTANTIATE(float)
+PLANAR_INSTANTIATE(double)
@@ -0,0 +1,52 @@
+#pragma once
+#include "libdsp.hpp"
+#include "arena.hpp"
+
+/////////////////////////////
+// Planar (separate I and Q) sample buffers
+///////////////////////////
+//
+// CSampleVector keeps I and Q interleaved, so a vectorized complex
+// multiply has to shuffle the pairs apart and back together on every
+// step.  PlanarSamplesT keeps them in two arrays, 64 byte aligned (an
+// ArenaAllocator, in an arena if given one), and the blocks with a planar
+// path take the two arrays directly:
+//
+//   BlockFIRT::process( in_i, in_q, out_i, out_q, count )
+//   CNCOT::mix( in_i, in_q, out_i, out_q, count )
+//   PhaseDetectorBPSK( in_i, in_q, err, count )
+//   blockPower( in_i, in_q, count )
+//
+// The shuffles are paid once at the I/O boundary instead, by
+// deinterleave() on the way in and interleave() on the way out.  Those
+// use SSE2 (x86-64) or NEON (aarch64) where the compiler has them, plain
+// loops otherwise.
+//
+//   PlanarSamplesT<float> x( n );
+//   x.load( capture, n );
+//   nco.mix( x.i.data(), x.q.data(), x.i.data(), x.q.data(), n );
+//   fir->process( x.i.data(), x.q.data(), x.i.data(), x.q.data(), n );
+//   x.store( out );
+
+template <typename R>
+struct PlanarSamplesT {
+    using buffer_t = std::vector< R, ArenaAllocator<R> >;
+    buffer_t i;
+    buffer_t q;
+
+    PlanarSamplesT( int count=0, BufferArena *arena=nullptr );
+    int size() const { return i.size(); }
+    void resize( int count );
+    // from interleaved samples, sized to count
+    void load( const CSampleT<R> *in, int count );
+    // to interleaved samples, size() of them
+    void store( CSampleT<R> *out ) const;
+};
+using PlanarSamples = PlanarSamplesT<double>;
+
+// interleaved -> planar, out_i and out_q get count values each
+template <typename R>
+void deinterleave( const CSampleT<R> *in, int count, R *out_i, R *out_q );
+// planar -> interleaved
+template <typename R>
+void interleave( const R *in_i, const R *in_q, int count, CSampleT<R> *out );
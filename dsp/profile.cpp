@@ -0,0 +1,204 @@
+#include "profile.hpp"
+#include <chrono>
+#include <cmath>
+#include <deque>
+
+// registry, deques keep entries in place as they grow
+static std::mutex registry_lock;
+static std::deque<ProfileCounter> counters;
+static std::deque<ProfileGauge> gauges;
+
+static uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// reference points for converting ticks to time
+static const uint64_t start_ticks = profileTicks();
+static const uint64_t start_ns = monotonicNs();
+
+double profileTicksPerNs() {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns = monotonicNs() - start_ns;
+    if ( ns == 0 ) {
+        return 1.0;
+    }
+    return (double)( profileTicks() - start_ticks ) / ns;
+#else
+    return 1.0;
+#endif
+}
+
+int profileThreadSlot() {
+    static std::atomic<int> next_slot(0);
+    thread_local int slot = next_slot++ % ProfileCounter::slot_count;
+    return slot;
+}
+
+ProfileCounter::ProfileCounter( const char *_name ) : name(_name) {
+    for ( auto &s: slot ) {
+        s.ticks = 0;
+        s.samples = 0;
+        s.calls = 0;
+    }
+}
+
+uint64_t ProfileCounter::ticks() const {
+    uint64_t sum = 0;
+    for ( auto &s: slot ) {
+        sum += s.ticks.load( std::memory_order_relaxed );
+    }
+    return sum;
+}
+
+uint64_t ProfileCounter::samples() const {
+    uint64_t sum = 0;
+    for ( auto &s: slot ) {
+        sum += s.samples.load( std::memory_order_relaxed );
+    }
+    return sum;
+}
+
+uint64_t ProfileCounter::calls() const {
+    uint64_t sum = 0;
+    for ( auto &s: slot ) {
+        sum += s.calls.load( std::memory_order_relaxed );
+    }
+    return sum;
+}
+
+ProfileGauge::ProfileGauge( const char *_name ) : name(_name), value(0), max(0) {}
+
+ProfileCounter &profileCounter( const char *name ) {
+    std::lock_guard<std::mutex> guard( registry_lock );
+    for ( auto &c: counters ) {
+        if ( c.name == name ) {
+            return c;
+        }
+    }
+    counters.emplace_back( name );
+    return counters.back();
+}
+
+ProfileGauge &profileGauge( const char *name ) {
+    std::lock_guard<std::mutex> guard( registry_lock );
+    for ( auto &g: gauges ) {
+        if ( g.name == name ) {
+            return g;
+        }
+    }
+    gauges.emplace_back( name );
+    return gauges.back();
+}
+
+std::vector<ProfileCounter*> profileCounters() {
+    std::lock_guard<std::mutex> guard( registry_lock );
+    std::vector<ProfileCounter*> list;
+    for ( auto &c: counters ) {
+        list.push_back( &c );
+    }
+    return list;
+}
+
+std::vector<ProfileGauge*> profileGauges() {
+    std::lock_guard<std::mutex> guard( registry_lock );
+    std::vector<ProfileGauge*> list;
+    for ( auto &g: gauges ) {
+        list.push_back( &g );
+    }
+    return list;
+}
+
+void writeStats( FILE *out, stats_format_t format, double time, const std::vector<StatsField> &fields ) {
+    double ticks_per_ns = profileTicksPerNs();
+    std::vector<ProfileCounter*> stage_list = profileCounters();
+    std::vector<ProfileGauge*> gauge_list = profileGauges();
+    if ( format == stats_csv ) {
+        for ( auto &f: fields ) {
+            fprintf( out, "%.3f,%s,%.17g\n", time, f.name.c_str(), f.value );
+        }
+        for ( auto c: stage_list ) {
+            uint64_t samples = c->samples();
+            double ns = c->ticks() / ticks_per_ns;
+            fprintf( out, "%.3f,%s.calls,%llu\n", time, c->name.c_str(), (unsigned long long)c->calls() );
+            fprintf( out, "%.3f,%s.samples,%llu\n", time, c->name.c_str(), (unsigned long long)samples );
+            fprintf( out, "%.3f,%s.ns,%.0f\n", time, c->name.c_str(), ns );
+            fprintf( out, "%.3f,%s.ns_per_sample,%.3f\n", time, c->name.c_str(), samples ? ns/samples : 0.0 );
+        }
+        for ( auto g: gauge_list ) {
+            fprintf( out, "%.3f,%s.value,%lld\n", time, g->name.c_str(), (long long)g->value.load() );
+            fprintf( out, "%.3f,%s.max,%lld\n", time, g->name.c_str(), (long long)g->max.load() );
+        }
+    } else {
+        fprintf( out, "{\"time\":%.3f", time );
+        for ( auto &f: fields ) {
+            if ( std::isfinite( f.value ) ) {
+                fprintf( out, ",\"%s\":%.17g", f.name.c_str(), f.value );
+            } else {
+                fprintf( out, ",\"%s\":null", f.name.c_str() );
+            }
+        }
+        fprintf( out, ",\"stages\":{" );
+        for ( size_t idx=0; idx < stage_list.size(); ++idx ) {
+            ProfileCounter *c = stage_list[idx];
+            uint64_t samples = c->samples();
+            double ns = c->ticks() / ticks_per_ns;
+            fprintf( out, "%s\"%s\":{\"calls\":%llu,\"samples\":%llu,\"ns\":%.0f,\"ns_per_sample\":%.3f}",
+                     idx ? "," : "", c->name.c_str(), (unsigned long long)c->calls(),
+                     (unsigned long long)samples, ns, samples ? ns/samples : 0.0 );
+        }
+        fprintf( out, "},\"gauges\":{" );
+        for ( size_t idx=0; idx < gauge_list.size(); ++idx ) {
+            ProfileGauge *g = gauge_list[idx];
+            fprintf( out, "%s\"%s\":{\"value\":%lld,\"max\":%lld}", idx ? "," : "", g->name.c_str(),
+                     (long long)g->value.load(), (long long)g->max.load() );
+        }
+        fprintf( out, "}}\n" );
+    }
+    fflush( out );
+}
+
+StatsReporter::StatsReporter( FILE *_out, stats_format_t _format, double _interval, FieldSource _fields ) {
+    out = _out;
+    format = _format;
+    interval = _interval;
+    fields = _fields;
+    start = std::chrono::steady_clock::now();
+    stopping = false;
+    if ( format == stats_csv ) {
+        fprintf( out, "time,metric,value\n" );
+    }
+    worker = std::thread( &StatsReporter::run, this );
+}
+
+StatsReporter::~StatsReporter() {
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+    report();
+}
+
+void StatsReporter::report() {
+    std::vector<StatsField> f;
+    fields( f );
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    writeStats( out, format, t.count(), f );
+}
+
+void StatsReporter::run() {
+    std::unique_lock<std::mutex> guard( lock );
+    auto next = std::chrono::steady_clock::now();
+    while ( !stopping ) {
+        next += std::chrono::microseconds( (long long)( interval*1e6 ) );
+        if ( wake.wait_until( guard, next, [this] { return stopping; } ) ) {
+            break;
+        }
+        guard.unlock();
+        report();
+        guard.lock();
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/////////////////////////////
+// Profiling counters
+///////////////////////////
+//
+// Per stage tick and sample counters, and gauges for queue depths.  The
+// macros compile to nothing unless LIBDSP_PROFILE is defined (cmake
+// -DLIBDSP_PROFILE=ON), so the hot loops carry no cost in normal builds.
+//
+//   DSP_PROFILE_START(t);                      // take a timestamp
+//   ... work ...
+//   DSP_PROFILE_LAP(t, "demod.loop", n);       // charge time since t to a stage
+//   DSP_PROFILE_GAUGE("workpool.queued", depth);
+//
+// Lap once per block, not per sample: a timestamp costs about as much as
+// a cheap stage, and stages must not nest (a lap inside a timed block is
+// charged twice).
+//
+// Counters are registered by name on first use and are shared by every
+// caller using that name.  Each thread adds into its own slot, so worker
+// threads don't fight over a cache line.
+
+// timestamp in ticks, the TSC on x86, nanoseconds elsewhere
+inline uint64_t profileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// ticks per nanosecond, measured against CLOCK_MONOTONIC since start up
+double profileTicksPerNs();
+
+// slot of the calling thread in every counter
+int profileThreadSlot();
+
+// time and samples charged to one stage
+struct ProfileCounter {
+    static const int slot_count = 16;
+    struct Slot {
+        std::atomic<uint64_t> ticks;
+        std::atomic<uint64_t> samples;
+        std::atomic<uint64_t> calls;
+        char pad[64 - 3*sizeof(uint64_t)];
+    };
+    std::string name;
+    Slot slot[slot_count];
+    ProfileCounter( const char *_name );
+    inline void add( uint64_t ticks, uint64_t samples ) {
+        Slot &s = slot[ profileThreadSlot() ];
+        s.ticks.fetch_add( ticks, std::memory_order_relaxed );
+        s.samples.fetch_add( samples, std::memory_order_relaxed );
+        s.calls.fetch_add( 1, std::memory_order_relaxed );
+    }
+    // totals over every thread
+    uint64_t ticks() const;
+    uint64_t samples() const;
+    uint64_t calls() const;
+};
+
+// last and largest value of a level, e.g. a queue depth
+struct ProfileGauge {
+    std::string name;
+    std::atomic<int64_t> value;
+    std::atomic<int64_t> max;
+    ProfileGauge( const char *_name );
+    inline void set( int64_t v ) {
+        value.store( v, std::memory_order_relaxed );
+        int64_t m = max.load( std::memory_order_relaxed );
+        while ( v > m && !max.compare_exchange_weak( m, v, std::memory_order_relaxed ) ) { }
+    }
+};
+
+// find or register a counter/gauge by name
+ProfileCounter &profileCounter( const char *name );
+ProfileGauge &profileGauge( const char *name );
+// every registered counter/gauge
+std::vector<ProfileCounter*> profileCounters();
+std::vector<ProfileGauge*> profileGauges();
+
+#ifdef LIBDSP_PROFILE
+#define DSP_PROFILE_START(t) uint64_t t = profileTicks()
+#define DSP_PROFILE_LAP(t, name, n) do { \
+        static ProfileCounter &_pc = profileCounter(name); \
+        uint64_t _now = profileTicks(); \
+        _pc.add( _now - t, n ); \
+        t = _now; \
+    } while (0)
+#define DSP_PROFILE_GAUGE(name, v) do { \
+        static ProfileGauge &_pg = profileGauge(name); \
+        _pg.set(v); \
+    } while (0)
+#else
+#define DSP_PROFILE_START(t) do { } while (0)
+#define DSP_PROFILE_LAP(t, name, n) do { } while (0)
+#define DSP_PROFILE_GAUGE(name, v) do { } while (0)
+#endif
+
+/////////////////////////////
+// Stats lines
+///////////////////////////
+//
+// Machine readable status for the apps.  A stats line holds the app's
+// own fields followed by every profile counter and gauge (if built with
+// LIBDSP_PROFILE).
+//   json: one object per line
+//     {"time":1.00,"samples":4194304,"stages":{"demod.loop":{"calls":..,
+//      "samples":..,"ns":..,"ns_per_sample":..}},"gauges":{..}}
+//   csv: one "time,metric,value" row per metric, after a header row
+
+enum stats_format_t {
+    stats_json,
+    stats_csv
+};
+
+struct StatsField {
+    std::string name;
+    double value;
+};
+
+// write one stats line (json) or block of rows (csv)
+void writeStats( FILE *out, stats_format_t format, double time, const std::vector<StatsField> &fields );
+
+// Writes a stats line every interval seconds on its own thread, and a
+// last one when destroyed.  fields() is called to collect the app's
+// fields for each line.
+struct StatsReporter {
+    using FieldSource = std::function< void( std::vector<StatsField> & ) >;
+    StatsReporter( FILE *_out, stats_format_t _format, double _interval, FieldSource _fields );
+    ~StatsReporter();
+
+    FILE *out;
+    stats_format_t format;
+    double interval;
+    FieldSource fields;
+    std::chrono::steady_clock::time_point start;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread worker;
+
+    void report();
+    void run();
+};
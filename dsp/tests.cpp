@@ -1,21 +1,77 @@
 #include "libdsp.hpp"
+#include "dspchain.hpp"
+#include "channel.hpp"
+#include "trace.hpp"
+#include "capindex.hpp"
+#include "correlator.hpp"
+#include "decimate.hpp"
+#include "equalizer.hpp"
+#include "firkernel.hpp"
+#include "arena.hpp"
+#include "planar.hpp"
+#include <algorithm>
+#include <chrono>
 #include <complex>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <fcntl.h>
 #include <fstream>
+#include <ftw.h>
+#include <sched.h>
 #include <iostream>
+#include <string>
 #include <unistd.h>
 
 using namespace std;
 
+Xoshiro256 test_rng(std::time(nullptr));
+
 double randval() {
-  return ((((double)std::rand() / (double)RAND_MAX) * 2) - 1);
+  return test_rng.uniform() * 2 - 1;
+}
+
+// SNR (dB) of a Q15 output against the double precision reference,
+// the Q15 output is scaled back by the filter gain it was built with.
+double snrQ15(const std::vector<complex<double>> &ref,
+              const std::vector<CSampleQ15> &q, double gain) {
+  double sig = 0, err = 0;
+  for (size_t i = 0; i < ref.size(); ++i) {
+    complex<double> v(q[i].i / (32768.0 * gain), q[i].q / (32768.0 * gain));
+    sig += std::norm(ref[i]);
+    err += std::norm(ref[i] - v);
+  }
+  return 10 * std::log10(sig / err);
+}
+
+// scratch directory for the files the tests write, under $TMPDIR (or
+// /tmp), removed with everything in it when main returns
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+  return remove(path);
 }
 
+struct TestDir {
+  std::string path;
+  TestDir() {
+    const char *tmp = getenv("TMPDIR");
+    std::string tmpl = std::string(tmp && tmp[0] ? tmp : "/tmp") + "/dsp_tests.XXXXXX";
+    if (mkdtemp(&tmpl[0]))
+      path = tmpl;
+  }
+  ~TestDir() {
+    if (path.length())
+      nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  std::string file(const char *name) const { return path + "/" + name; }
+};
+
 int main() {
-  std::srand(std::time(nullptr));
   cout << "starting..\n";
+  TestDir scratch;
+  if (scratch.path.empty()) {
+    cout << "FAIL: could not make a scratch directory\n";
+    return -1;
+  }
   vector<complex<double>> coeff = computeCpxRRC(4, 0.35, 4);
   cout << "coeff count: " << coeff.size() << endl;
   for (auto &c : coeff)
@@ -37,12 +93,828 @@ int main() {
               << "  output: " << (*outputvec)[i] << std::endl;
   }
 
-  int fh = open("samples.c64", O_CREAT | O_TRUNC | O_WRONLY, 0666);
+  int fh = open(scratch.file("samples.c64").c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0666);
   if (fh > 1) {
     write(fh, outputvec->data(), outputvec->size() * sizeof((*outputvec)[0]));
   }
   close(fh);
-  std::cout << "Written sample sim to samples.c64\n";
+  std::cout << "Written sample sim to " << scratch.file("samples.c64") << "\n";
+
+  // BpskDemod vs the compile time chain version, same input must give
+  // the same output, and time both.
+  cout << "Comparing BpskDemod with ChainBpskDemod..\n";
+  std::vector<complex<double>> demod_in(1 << 20);
+  for (auto &s : demod_in)
+    s = std::complex<double>(randval(), randval());
+  std::vector<complex<double>> ref_out(demod_in.size());
+  std::vector<complex<double>> chain_out(demod_in.size());
+  BpskDemod ref_demod(4, 0.35, 256);
+  ChainBpskDemod<> chain_demod(0.35, 256);
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < demod_in.size(); ++i)
+    ref_out[i] = ref_demod.process(demod_in[i]);
+  auto t1 = std::chrono::steady_clock::now();
+  chain_demod.process_block(demod_in.data(), chain_out.data(), demod_in.size());
+  auto t2 = std::chrono::steady_clock::now();
+  std::chrono::duration<double> ref_t = t1 - t0;
+  std::chrono::duration<double> chain_t = t2 - t1;
+  cout << "BpskDemod      : " << demod_in.size() / ref_t.count() / 1e6 << " Msps\n";
+  cout << "ChainBpskDemod : " << demod_in.size() / chain_t.count() / 1e6 << " Msps\n";
+  if (ref_out != chain_out) {
+    cout << "FAIL: ChainBpskDemod output differs from BpskDemod\n";
+    return -1;
+  }
+  cout << "ChainBpskDemod output matches BpskDemod\n";
+
+  // single precision instantiations
+  std::vector<complex<float>> demod_in32(demod_in.begin(), demod_in.end());
+  std::vector<complex<float>> ref_out32(demod_in32.size());
+  std::vector<complex<float>> chain_out32(demod_in32.size());
+  BpskDemodT<float> ref_demod32(4, 0.35, 256);
+  ChainBpskDemod<complex<float>> chain_demod32(0.35, 256);
+  t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < demod_in32.size(); ++i)
+    ref_out32[i] = ref_demod32.process(demod_in32[i]);
+  t1 = std::chrono::steady_clock::now();
+  chain_demod32.process_block(demod_in32.data(), chain_out32.data(), demod_in32.size());
+  t2 = std::chrono::steady_clock::now();
+  ref_t = t1 - t0;
+  chain_t = t2 - t1;
+  cout << "BpskDemodT<float>      : " << demod_in32.size() / ref_t.count() / 1e6 << " Msps\n";
+  cout << "ChainBpskDemod<float>  : " << demod_in32.size() / chain_t.count() / 1e6 << " Msps\n";
+  if (ref_out32 != chain_out32) {
+    cout << "FAIL: float ChainBpskDemod output differs from BpskDemodT<float>\n";
+    return -1;
+  }
+  cout << "float ChainBpskDemod output matches BpskDemodT<float>\n";
+
+  // Q15 path vs double path on the same (sc16 quantized) test vector
+  cout << "Measuring Q15 path SNR against double path..\n";
+  std::vector<CSampleQ15> q15_in(1 << 16);
+  std::vector<complex<double>> dbl_in(q15_in.size());
+  for (size_t i = 0; i < q15_in.size(); ++i) {
+    q15_in[i].i = (int16_t)(0.5 * randval() * 32767);
+    q15_in[i].q = (int16_t)(0.5 * randval() * 32767);
+    dbl_in[i] = complex<double>(q15_in[i].i / 32768.0, q15_in[i].q / 32768.0);
+  }
+  double q15_gain;
+  CFIRFilterQ15 q15_filter = makeCpxRRCQ15(4, 0.35, 4, &q15_gain);
+  CFIRFilter dbl_filter(computeCpxRRC(4, 0.35, 4));
+  std::vector<CSampleQ15> q15_out(q15_in.size());
+  std::vector<complex<double>> dbl_out(q15_in.size());
+  q15_filter.process(q15_in.data(), q15_out.data(), q15_in.size());
+  for (size_t i = 0; i < dbl_in.size(); ++i)
+    dbl_out[i] = dbl_filter.process(dbl_in[i]);
+  double fir_snr = snrQ15(dbl_out, q15_out, q15_gain);
+  cout << "CFIRFilterQ15 SNR            : " << fir_snr << " dB\n";
+
+  CNCOQ15 q15_nco(0.05, 0);
+  CNCO dbl_nco(0.05, 0);
+  CFIRFilterQ15 q15_filter2 = makeCpxRRCQ15(4, 0.35, 4, &q15_gain);
+  CFIRFilter dbl_filter2(computeCpxRRC(4, 0.35, 4));
+  std::vector<CSampleQ15> q15_mix(q15_in.size());
+  q15_nco.mix(q15_in.data(), q15_mix.data(), q15_in.size());
+  q15_filter2.process(q15_mix.data(), q15_out.data(), q15_mix.size());
+  for (size_t i = 0; i < dbl_in.size(); ++i)
+    dbl_out[i] = dbl_filter2.process(dbl_nco.generate() * dbl_in[i]);
+  double mix_snr = snrQ15(dbl_out, q15_out, q15_gain);
+  cout << "CNCOQ15 + CFIRFilterQ15 SNR  : " << mix_snr << " dB\n";
+  if (fir_snr < 50 || mix_snr < 50) {
+    cout << "FAIL: Q15 path SNR below 50 dB\n";
+    return -1;
+  }
+
+  // channel blocks
+  cout << "Checking channel blocks..\n";
+  const int nch = 1 << 18;
+  std::vector<complex<float>> zeros(nch), noise_a(nch), noise_b(nch);
+  AWGNT<float> awgn_a(0.5f, 42, 0), awgn_b(0.5f, 42, 0), awgn_c(0.5f, 42, 1);
+  t0 = std::chrono::steady_clock::now();
+  awgn_a.process(zeros.data(), noise_a.data(), nch);
+  t1 = std::chrono::steady_clock::now();
+  awgn_b.process(zeros.data(), noise_b.data(), nch);
+  ref_t = t1 - t0;
+  cout << "AWGNT<float>           : " << nch / ref_t.count() / 1e6 << " Msps\n";
+  if (noise_a != noise_b) {
+    cout << "FAIL: AWGN not reproducible from its seed\n";
+    return -1;
+  }
+  double mean = 0, var = 0;
+  for (auto &n : noise_a) {
+    mean += n.real() + n.imag();
+    var += std::norm(n);
+  }
+  mean /= 2 * nch;
+  var /= 2 * nch;
+  cout << "AWGN mean " << mean << " variance " << var << " (want 0, 0.25)\n";
+  if (std::abs(mean) > 0.01 || std::abs(var - 0.25) > 0.01) {
+    cout << "FAIL: AWGN statistics off\n";
+    return -1;
+  }
+  awgn_c.process(zeros.data(), noise_b.data(), nch);
+  if (noise_a == noise_b) {
+    cout << "FAIL: AWGN streams 0 and 1 are the same\n";
+    return -1;
+  }
+
+  // a unit path and a pure carrier offset leave the power alone
+  std::vector<complex<double>> tone(nch), chan(nch);
+  for (size_t i = 0; i < tone.size(); ++i)
+    tone[i] = std::polar(1.0, 0.01 * i);
+  Multipath unit_path(CSampleVector{CSample(0, 0), CSample(1, 0)});
+  unit_path.process(tone.data(), chan.data(), nch);
+  if (chan[0] != CSample(0, 0) || chan[nch - 1] != tone[nch - 2]) {
+    cout << "FAIL: Multipath delay tap\n";
+    return -1;
+  }
+  CarrierOffset cfo(-0.01, 0, 0);
+  cfo.process(tone.data(), chan.data(), nch);
+  if (std::abs(chan[nch - 1] - CSample(1, 0)) > 1e-6) {
+    cout << "FAIL: CarrierOffset did not cancel the tone\n";
+    return -1;
+  }
+
+  // clock drift: 100 ppm fast gives 100 ppm fewer samples, and the
+  // interpolated tone stays on the tone
+  ClockDrift clk(100);
+  CSampleVector resampled;
+  clk.process(tone.data(), nch, &resampled);
+  double want = nch / (1 + 100e-6);
+  double worst = 0;
+  for (size_t i = 4; i < resampled.size(); ++i) {
+    CSample expect = std::polar(1.0, 0.01 * (i * (1 + 100e-6) - 2));
+    worst = std::max(worst, std::abs(resampled[i] - expect));
+  }
+  cout << "ClockDrift outputs " << resampled.size() << " (want " << want << "), max error " << worst << "\n";
+  if (std::abs(resampled.size() - want) > 2 || worst > 1e-6) {
+    cout << "FAIL: ClockDrift\n";
+    return -1;
+  }
+
+  // the carrier loop on a clean loopback signal: RRC shaped BPSK with a
+  // carrier offset at 10 dB Eb/N0.  Every demod variant has to reach
+  // track within 32k samples and stay there, and the symbols come out
+  // right (either polarity, the loop has a 180 degree ambiguity).
+  cout << "Checking the demods reach track on a loopback signal..\n";
+  const int lb_syms = 1 << 16;
+  std::vector<double> lb_rrc = computeRRC(4, 0.35, 4);
+  CInterpolator lb_shaper(4, lb_rrc);
+  CSampleVector lb_symbols(lb_syms);
+  CSampleVector lb_samples(lb_syms * 4);
+  for (auto &s : lb_symbols)
+    s = CSample(test_rng.uniform() < 0.5 ? -1.0 : 1.0, 0);
+  lb_shaper.process(lb_symbols.data(), lb_samples.data(), lb_syms);
+  CarrierOffset lb_cfo(0.002, 0, 1.0);
+  lb_cfo.process(lb_samples.data(), lb_samples.data(), lb_samples.size());
+  AWGN lb_awgn(AWGN::sigmaFromEbN0(10), 7, 0);
+  lb_awgn.process(lb_samples.data(), lb_samples.data(), lb_samples.size());
+  std::vector<CSampleQ15> lb_q15(lb_samples.size());
+  for (size_t i = 0; i < lb_samples.size(); ++i) {
+    lb_q15[i].i = (int16_t)std::lround(lb_samples[i].real() * 8192);
+    lb_q15[i].q = (int16_t)std::lround(lb_samples[i].imag() * 8192);
+  }
+  BpskDemod lb_demod(4, 0.35, 256);
+  ChainBpskDemod<complex<float>> lb_chain(0.35, 256);
+  BpskDemodQ15 lb_q15_demod(4, 0.35, 256);
+  const char *lb_names[] = {"BpskDemod", "ChainBpskDemod<float>", "BpskDemodQ15"};
+  long lb_delay = lb_rrc.size() - 1;
+  for (int v = 0; v < 3; ++v) {
+    long first_track = -1, tracking = 0, errors = 0, inverted = 0, checked = 0;
+    for (size_t i = 0; i < lb_samples.size(); ++i) {
+      CSample out;
+      BpskDemodState::state_t st;
+      if (v == 0) {
+        out = lb_demod.process(lb_samples[i]);
+        st = lb_demod.state;
+      } else if (v == 1) {
+        complex<float> o = lb_chain.process(complex<float>(lb_samples[i]));
+        out = CSample(o.real(), o.imag());
+        st = lb_chain.state;
+      } else {
+        CSampleQ15 o = lb_q15_demod.process(lb_q15[i]);
+        out = CSample(o.i, o.q);
+        st = lb_q15_demod.state;
+      }
+      if (st == BpskDemodState::track && first_track < 0)
+        first_track = i;
+      if (i < lb_samples.size() / 2)
+        continue;
+      tracking += st == BpskDemodState::track;
+      if ((long)i >= lb_delay && (i - lb_delay) % 4 == 0) {
+        bool bit = out.real() < 0;
+        bool sent = lb_symbols[(i - lb_delay) / 4].real() < 0;
+        errors += bit != sent;
+        inverted += bit == sent;
+        checked++;
+      }
+    }
+    double track_pct = 100.0 * tracking / (lb_samples.size() / 2);
+    long bad = std::min(errors, inverted);
+    cout << lb_names[v] << ": track from sample " << first_track << ", " << track_pct << "% in track, "
+         << bad << " of " << checked << " symbols wrong\n";
+    if (first_track < 0 || first_track > 32768 || track_pct < 95 || bad > checked / 1000) {
+      cout << "FAIL: " << lb_names[v] << " did not lock to the loopback signal\n";
+      return -1;
+    }
+  }
+  if (std::abs(lb_demod.freq_est - 0.002) > 2e-4) {
+    cout << "FAIL: BpskDemod freq_est " << lb_demod.freq_est << " (want 0.002)\n";
+    return -1;
+  }
+
+  // loop trace: records every 256 samples plus every state change, and
+  // costs little next to the demod itself
+  cout << "Checking loop trace..\n";
+  BpskDemod plain_demod(4, 0.35, 256);
+  BpskDemod traced_demod(4, 0.35, 256);
+  TraceRecorder recorder;
+  if (recorder.open(scratch.file("trace.bin"), 256) < 0) {
+    cout << "FAIL: could not open trace.bin\n";
+    return -1;
+  }
+  traced_demod.trace.attach(&recorder);
+  std::vector<int> states(demod_in.size());
+  t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < demod_in.size(); ++i)
+    ref_out[i] = plain_demod.process(demod_in[i]);
+  t1 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < demod_in.size(); ++i) {
+    chain_out[i] = traced_demod.process(demod_in[i]);
+    states[i] = traced_demod.state;
+  }
+  t2 = std::chrono::steady_clock::now();
+  recorder.close();
+  ref_t = t1 - t0;
+  chain_t = t2 - t1;
+  cout << "BpskDemod          : " << demod_in.size() / ref_t.count() / 1e6 << " Msps\n";
+  cout << "BpskDemod + trace  : " << demod_in.size() / chain_t.count() / 1e6 << " Msps\n";
+  TraceHeader hdr;
+  std::vector<TraceRecord> records;
+  if (ref_out != chain_out || loadTrace(scratch.file("trace.bin"), &hdr, &records) < 0) {
+    cout << "FAIL: trace changed the demod output or could not be read back\n";
+    return -1;
+  }
+  size_t transitions = 0;
+  for (size_t i = 1; i < states.size(); ++i)
+    transitions += states[i] != states[i - 1];
+  cout << "trace records " << records.size() << ", dropped " << hdr.dropped << ", state changes "
+       << transitions << "\n";
+  bool trace_ok = hdr.dropped == 0 && records.size() >= demod_in.size() / 256 &&
+                  records.size() <= demod_in.size() / 256 + transitions + 1;
+  for (auto &r : records)
+    trace_ok = trace_ok && r.sample < states.size() && (int)r.state == states[r.sample];
+  if (!trace_ok) {
+    cout << "FAIL: trace records don't match the demod\n";
+    return -1;
+  }
+  // an attached trace costs a few percent, the loop variables are only
+  // worked out for recorded samples.  Timed in short alternating pieces,
+  // the median ratio over them keeps a busy machine from failing it.
+  {
+    BpskDemod timed_plain(4, 0.35, 256), timed_traced(4, 0.35, 256);
+    TraceRecorder timed_rec;
+    if (timed_rec.open(scratch.file("trace.bin"), 256) < 0) {
+      cout << "FAIL: could not open trace.bin\n";
+      return -1;
+    }
+    timed_traced.trace.attach(&timed_rec);
+    const size_t piece = 8192;
+    std::vector<double> ratios;
+    for (size_t at = 0; at + piece <= demod_in.size(); at += piece) {
+      t0 = std::chrono::steady_clock::now();
+      for (size_t i = at; i < at + piece; ++i)
+        ref_out[i] = timed_plain.process(demod_in[i]);
+      t1 = std::chrono::steady_clock::now();
+      for (size_t i = at; i < at + piece; ++i)
+        chain_out[i] = timed_traced.process(demod_in[i]);
+      t2 = std::chrono::steady_clock::now();
+      ratios.push_back(std::chrono::duration<double>(t2 - t1).count() /
+                       std::chrono::duration<double>(t1 - t0).count());
+    }
+    timed_rec.close();
+    std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+    double overhead = ratios[ratios.size() / 2] - 1;
+    cout << "trace overhead " << 100 * overhead << "%\n";
+    if (overhead > 0.1) {
+      cout << "FAIL: an attached trace slows the demod by more than 10%\n";
+      return -1;
+    }
+  }
+
+  // squelch: hysteresis and post-roll, and demod reset() around gaps
+  cout << "Checking squelch and demod reset..\n";
+  std::vector<complex<double>> quiet(1024, complex<double>(0.01, 0)), loud(1024, complex<double>(0.5, 0.5));
+  double quiet_db = 10 * std::log10(blockPower(quiet.data(), quiet.size()));
+  double loud_db = 10 * std::log10(blockPower(loud.data(), loud.size()));
+  Squelch squelch(-20, -30, 0, 2048);
+  bool gate_ok = std::abs(quiet_db + 40) < 1e-9 && std::abs(loud_db + 3.0103) < 1e-3;
+  // opens on loud, holds through two quiet blocks (post-roll), closes on the third
+  const bool gate_want[] = {false, true, true, true, false, false};
+  const double gate_power[] = {0.0001, 0.5, 0.0001, 0.0001, 0.0001, 0.005};
+  for (int i = 0; i < 6; ++i)
+    gate_ok = gate_ok && squelch.update(gate_power[i], 1024) == gate_want[i];
+  // -23 dB is under open but over close, it only keeps an open gate open
+  Squelch hyst(-20, -30, 0, 0);
+  gate_ok = gate_ok && !hyst.update(0.005, 1024) && hyst.update(0.5, 1024) && hyst.update(0.005, 1024);
+  std::vector<CSampleQ15> q15_loud(1024);
+  for (auto &q : q15_loud)
+    q = {16384, 16384};
+  gate_ok = gate_ok && std::abs(blockPower(q15_loud.data(), q15_loud.size()) - 0.5) < 1e-9;
+  // after reset() a demod must repeat a fresh demod sample for sample
+  BpskDemod reset_demod(4, 0.35, 256);
+  ChainBpskDemod<> reset_chain(0.35, 256);
+  BpskDemodQ15 reset_q15(4, 0.35, 256);
+  for (size_t i = 0; i < 10000; ++i) {
+    reset_demod.process(demod_in[i]);
+    reset_chain.process(demod_in[i]);
+    reset_q15.process(q15_in[i]);
+  }
+  reset_demod.reset();
+  reset_chain.reset();
+  reset_q15.reset();
+  BpskDemod fresh_demod(4, 0.35, 256);
+  BpskDemodQ15 fresh_q15(4, 0.35, 256);
+  for (size_t i = 0; i < 10000; ++i) {
+    complex<double> f = fresh_demod.process(demod_in[i]);
+    gate_ok = gate_ok && reset_demod.process(demod_in[i]) == f && reset_chain.process(demod_in[i]) == f;
+    CSampleQ15 fq = fresh_q15.process(q15_in[i]);
+    CSampleQ15 rq = reset_q15.process(q15_in[i]);
+    gate_ok = gate_ok && fq.i == rq.i && fq.q == rq.q;
+  }
+  if (!gate_ok) {
+    cout << "FAIL: squelch gating or demod reset\n";
+    return -1;
+  }
+
+  // capture index: write, map back and pick out regions by flag
+  cout << "Checking capture index..\n";
+  std::vector<IndexEntry> entries(10);
+  const uint16_t entry_flags[] = {0, 1, 3, 3, 0, 1, 1, 0, 3, 1};
+  for (size_t i = 0; i < entries.size(); ++i) {
+    entries[i] = IndexEntry();
+    entries[i].byte_offset = i * 1024 * 16;
+    entries[i].flags = entry_flags[i];
+  }
+  CaptureIndex cap_index;
+  if (writeCaptureIndex(scratch.file("index.bin"), 1024, 16, entries) < 0 ||
+      cap_index.open(scratch.file("index.bin")) < 0) {
+    cout << "FAIL: could not write or map index.bin\n";
+    return -1;
+  }
+  std::vector<SampleRegion> active = cap_index.regions(index_active, 9 * 1024 + 100);
+  std::vector<SampleRegion> locked = cap_index.regions(index_active | index_locked, 9 * 1024 + 100);
+  bool index_ok = cap_index.size() == 10 && cap_index[9].byte_offset == 9 * 1024 * 16 && active.size() == 3 &&
+                  active[0].first == 1024 && active[0].count == 3 * 1024 && active[1].first == 5 * 1024 &&
+                  active[2].first == 8 * 1024 && active[2].count == 1024 + 100 && locked.size() == 2 &&
+                  locked[0].first == 2 * 1024 && locked[0].count == 2 * 1024;
+  if (!index_ok) {
+    cout << "FAIL: capture index regions\n";
+    return -1;
+  }
+
+  // FFT against a direct DFT, and the inverse round trip
+  cout << "Checking FFT and correlator..\n";
+  const int nfft = 64;
+  FFT fft(nfft);
+  std::vector<complex<double>> fft_in(nfft), fft_out(nfft);
+  for (auto &x : fft_in)
+    x = complex<double>(randval(), randval());
+  fft_out = fft_in;
+  fft.forward(fft_out.data());
+  double fft_err = 0;
+  for (int k = 0; k < nfft; ++k) {
+    complex<double> sum = 0;
+    for (int n = 0; n < nfft; ++n)
+      sum += fft_in[n] * std::polar(1.0, -2 * M_PI * k * n / nfft);
+    fft_err = std::max(fft_err, std::abs(sum - fft_out[k]));
+  }
+  fft.inverse(fft_out.data());
+  for (int n = 0; n < nfft; ++n)
+    fft_err = std::max(fft_err, std::abs(fft_out[n] / double(nfft) - fft_in[n]));
+  cout << "FFT max error " << fft_err << "\n";
+  if (fft_err > 1e-9) {
+    cout << "FAIL: FFT\n";
+    return -1;
+  }
+
+  // references buried in noise at known offsets, with a phase and
+  // frequency offset, fed in odd sized blocks
+  const uint64_t sync_at[] = {1000, 7777, 15000};
+  const double sync_phase = 0.7, sync_freq = 0.005;
+  for (int len : {31, 255}) {
+    std::vector<complex<float>> sync_ref(len), sync_in(20000);
+    // a random reference, redrawn until no autocorrelation sidelobe is
+    // near the 0.5 threshold (short ones often have one)
+    float sidelobe;
+    do {
+      for (auto &r : sync_ref)
+        r = test_rng.uniform() < 0.5 ? 1.0f : -1.0f;
+      sidelobe = 0;
+      for (int lag = 1; lag < len; ++lag) {
+        complex<float> acc = 0;
+        for (int k = lag; k < len; ++k)
+          acc += sync_ref[k] * std::conj(sync_ref[k - lag]);
+        sidelobe = std::max(sidelobe, std::abs(acc) / len);
+      }
+    } while (sidelobe > 0.3f);
+    GaussianT<float> sync_noise(3);
+    std::vector<float> sync_n(2 * sync_in.size());
+    sync_noise.fill(sync_n.data(), sync_n.size(), 0.2f);
+    for (size_t i = 0; i < sync_in.size(); ++i)
+      sync_in[i] = complex<float>(sync_n[2 * i], sync_n[2 * i + 1]);
+    for (uint64_t at : sync_at)
+      for (int k = 0; k < len; ++k)
+        sync_in[at + k] += sync_ref[k] * std::polar(1.0f, float(sync_phase + sync_freq * k));
+    for (correlator_method_t method : {correlate_direct, correlate_fft}) {
+      CorrelatorT<float> sync(sync_ref, 0.5, method);
+      std::vector<CorrelatorHit> hits;
+      for (size_t i = 0; i < sync_in.size(); i += 777)
+        sync.process(&sync_in[i], std::min<size_t>(777, sync_in.size() - i), &hits);
+      bool sync_ok = hits.size() == 3;
+      for (size_t h = 0; sync_ok && h < hits.size(); ++h) {
+        double want_phase = sync_phase + sync_freq * (len - 1) / 2;
+        // the frequency comes from half a reference, so short ones are coarse
+        sync_ok = hits[h].offset == sync_at[h] && std::abs(std::remainder(hits[h].phase - want_phase, 2 * M_PI)) < 0.25 &&
+                  std::abs(hits[h].freq - sync_freq) < 0.5 / (len / 2) && hits[h].metric > 0.7;
+      }
+      cout << "Correlator len " << len << (method == correlate_fft ? " fft" : " direct") << ": " << hits.size()
+           << " hits";
+      for (auto &h : hits)
+        cout << " @" << h.offset << " m=" << h.metric << " ph=" << h.phase << " f=" << h.freq;
+      cout << "\n";
+      if (!sync_ok) {
+        cout << "FAIL: correlator hits\n";
+        return -1;
+      }
+    }
+  }
+
+  // the Hann helpers window their argument in place
+  std::vector<double> hann(9, 1.0);
+  CSampleVector cpx_hann(9, complex<double>(1, 1));
+  applyWindowHann(&hann);
+  applyCpxWindowHann(&cpx_hann);
+  if (hann[0] != 0 || std::abs(hann[4] - 1) > 1e-12 || std::abs(hann[2] - 0.5) > 1e-12 ||
+      cpx_hann[2] != complex<double>(hann[2], hann[2])) {
+    cout << "FAIL: Hann window\n";
+    return -1;
+  }
+
+  // AGC: -40 dBFS tone, step up to 0 dBFS, back down to -40.  The gain
+  // should follow a step up within the attack time (40 dB at 20000 dB/s
+  // is 2 ms) and a step down only at the decay rate (2000 dB/s, 20 ms).
+  cout << "Checking AGC..\n";
+  std::vector<complex<float>> agc_in(200000), agc_out(agc_in.size());
+  for (size_t i = 0; i < agc_in.size(); ++i) {
+    float amp = (i >= 50000 && i < 100000) ? 1.0f : 0.01f;
+    agc_in[i] = std::polar(amp, 0.05f * (i % 1000));
+  }
+  AGCT<float> agc(1e6, -6, 20000, 2000);
+  for (size_t i = 0; i < agc_in.size(); i += 1000)
+    agc.process(&agc_in[i], &agc_out[i], 1000);
+  auto agc_db = [&](size_t from, size_t to) {
+    return 10 * std::log10(blockPower(&agc_out[from], to - from));
+  };
+  double settled_low = agc_db(40000, 50000), after_up = agc_db(53000, 60000);
+  double during_decay = agc_db(102000, 104000), after_down = agc_db(125000, 150000);
+  cout << "AGC output dBFS: settled " << settled_low << ", after step up " << after_up << ", during decay "
+       << during_decay << ", after step down " << after_down << "\n";
+  bool agc_ok = std::abs(settled_low + 6) < 0.5 && std::abs(after_up + 6) < 0.5 && during_decay < -30 &&
+                std::abs(after_down + 6) < 0.5;
+  // ahead of the demod, input level no longer shows in the output level
+  double demod_db[2];
+  for (int l = 0; l < 2; ++l) {
+    BpskDemod agc_demod(4, 0.35, 256);
+    agc_demod.Agc = std::make_shared<AGC>(1e6);
+    std::vector<complex<double>> level_in(demod_in.begin(), demod_in.begin() + 100000), level_out(100000);
+    for (auto &x : level_in)
+      x *= l ? 1.0 : 1e-3;
+    agc_demod.process(level_in.data(), level_out.data(), level_in.size());
+    demod_db[l] = 10 * std::log10(blockPower(&level_out[50000], 50000));
+  }
+  cout << "Demod output dBFS with AGC, input at -60 dB: " << demod_db[0] << ", at 0 dB: " << demod_db[1] << "\n";
+  agc_ok = agc_ok && std::abs(demod_db[0] - demod_db[1]) < 0.5;
+  // and the loop locks as fast on the loopback signal at either level:
+  // the mean time to track over 8 pieces of it within two loop windows
+  double lock_at[2];
+  const int lock_piece = 32768;
+  for (int l = 0; l < 2; ++l) {
+    lock_at[l] = 0;
+    for (int piece = 0; piece < 8; ++piece) {
+      BpskDemod agc_demod(4, 0.35, 256);
+      agc_demod.Agc = std::make_shared<AGC>(1e6);
+      CSampleVector level_in(lb_samples.begin() + piece * lock_piece, lb_samples.begin() + (piece + 1) * lock_piece);
+      CSampleVector level_out(lock_piece);
+      for (auto &x : level_in)
+        x *= l ? 1.0 : 1e-3;
+      long at = 0;
+      for (; at < lock_piece && agc_demod.state != BpskDemodState::track; at += 64)
+        agc_demod.process(&level_in[at], &level_out[at], 64);
+      if (agc_demod.state != BpskDemodState::track) {
+        cout << "FAIL: demod with AGC did not reach track at " << (l ? "0" : "-60") << " dB\n";
+        return -1;
+      }
+      lock_at[l] += at / 8.0;
+    }
+  }
+  cout << "Demod with AGC reaches track after " << lock_at[0] << " samples at -60 dB, " << lock_at[1]
+       << " at 0 dB (mean of 8)\n";
+  agc_ok = agc_ok && std::abs(lock_at[0] - lock_at[1]) <= 512;
+  if (!agc_ok) {
+    cout << "FAIL: AGC levels\n";
+    return -1;
+  }
+
+  // Decimation: the planner's splits, then a /16 cascade passing an
+  // in-band tone flat (CIC droop compensated) and stopping a tone that
+  // would alias onto the passband.
+  cout << "Checking decimation..\n";
+  const int plan_factors[] = {1, 2, 8, 16, 6, 5, 64};
+  const char *plan_want[] = {"none", "half-band 19 taps", "half-band 15 taps, half-band 15 taps, half-band 19 taps",
+                             "CIC 4x/4, comp 15 taps/2, half-band 19 taps", "CIC 4x/3, comp 19 taps/2",
+                             "CIC 4x/5, comp 19 taps/1", "CIC 4x/16, comp 15 taps/2, half-band 19 taps"};
+  for (int k = 0; k < 7; ++k) {
+    DecimPlan plan;
+    if (planDecimation(plan_factors[k], &plan) < 0 || describeDecimation(plan) != plan_want[k]) {
+      cout << "FAIL: decimation plan for " << plan_factors[k] << ": " << describeDecimation(plan) << "\n";
+      return -1;
+    }
+  }
+  DecimPlan big_plan;
+  if (planDecimation(1 << 20, &big_plan) == 0) {
+    cout << "FAIL: decimation plan past the CIC's range\n";
+    return -1;
+  }
+  DecimPlan plan16;
+  planDecimation(16, &plan16);
+  auto decimTone = [&](double freq) {
+    // freq in cycles per output sample, power of the settled output in dB
+    std::vector<complex<float>> x(16 * 4096);
+    for (size_t i = 0; i < x.size(); ++i)
+      x[i] = std::polar(0.9f, float(2 * M_PI * freq / 16 * i));
+    DecimatorT<float> dec(plan16);
+    // uneven pieces, the state has to carry across calls
+    int n = 0;
+    for (size_t at = 0; at < x.size(); at += 1001)
+      n += dec.process(&x[at], std::min<size_t>(1001, x.size() - at), &x[n]);
+    if (n != 4096)
+      return 1000.0;
+    return 10 * std::log10(blockPower(&x[1024], 3072) / 0.81);
+  };
+  double pass_db = decimTone(0.15), dc_db = decimTone(0), alias_db = decimTone(0.9);
+  cout << "Decimate /16: DC " << dc_db << " dB, 0.15 " << pass_db << " dB, alias from 0.9 " << alias_db << " dB\n";
+  if (std::abs(dc_db) > 0.01 || std::abs(pass_db) > 0.1 || alias_db > -60) {
+    cout << "FAIL: decimation response\n";
+    return -1;
+  }
+  // the half-band skipping its zero taps matches a plain FIR decimator
+  std::vector<double> hb_taps = computeHalfBand(19);
+  CHalfBand hb(hb_taps);
+  CFIRDecimator hb_ref(hb_taps, 2);
+  std::vector<complex<double>> hb_in(1000), hb_out(500), hb_ref_out(500);
+  for (auto &x : hb_in)
+    x = complex<double>(randval(), randval());
+  int hb_n = hb.process(hb_in.data(), hb_in.size(), hb_out.data());
+  int hb_ref_n = hb_ref.process(hb_in.data(), hb_in.size(), hb_ref_out.data());
+  double hb_err = 0;
+  for (int i = 0; i < hb_n; ++i)
+    hb_err = std::max(hb_err, std::abs(hb_out[i] - hb_ref_out[i]));
+  if (hb_n != 500 || hb_ref_n != 500 || hb_err > 1e-12) {
+    cout << "FAIL: half-band against the full FIR, error " << hb_err << "\n";
+    return -1;
+  }
+
+  // Equalizer: RRC BPSK at 4 sps through echoes at 1 and 2 symbols and a
+  // matched filter.  Both variants have to find their way from blind
+  // startup to decision directed and open the eye.
+  cout << "Checking equalizer..\n";
+  const int eq_syms = 20000;
+  CInterpolator eq_tx(4, computeRRC(4, 0.35, 4));
+  std::vector<double> eq_rrc = computeRRC(4, 0.35, 4);
+  CFIRFilter eq_mf(CSampleVector(eq_rrc.begin(), eq_rrc.end()));
+  std::vector<complex<double>> eq_chan(9);
+  eq_chan[0] = 1;
+  eq_chan[4] = complex<double>(0.4, 0.2);
+  eq_chan[8] = complex<double>(0, -0.2);
+  std::vector<complex<double>> eq_sig(eq_syms * 4), eq_rx(eq_syms * 4);
+  for (int i = 0; i < eq_syms; ++i)
+    eq_tx.process(complex<double>(test_rng.uniform() < 0.5 ? -1 : 1, 0), &eq_sig[4 * i]);
+  for (size_t n = 0; n < eq_sig.size(); ++n) {
+    complex<double> acc(0.05 * randval(), 0.05 * randval());
+    for (size_t k = 0; k < eq_chan.size() && k <= n; ++k)
+      acc += eq_chan[k] * eq_sig[n - k];
+    eq_rx[n] = eq_mf.process(0.01 * acc);
+  }
+  for (int m = 0; m < 2; ++m) {
+    EqualizerT<float> eq(32, 4, m ? equalize_fft : equalize_time);
+    for (auto &x : eq_rx)
+      eq.process(complex<float>(x));
+    cout << (m ? "fft " : "time") << " equalizer: decision directed " << eq.dd << ", mse " << eq.mse << "\n";
+    // the time path settles up to ~0.09 on some noise draws
+    if (!eq.dd || eq.mse > 0.15) {
+      cout << "FAIL: equalizer did not converge\n";
+      return -1;
+    }
+  }
+  // and in the demod loop, between the matched filter and the detector
+  BpskDemod eq_demod(4, 0.35, 256);
+  if (eq_demod.setEqualizer(std::make_shared<Equalizer>(32, 4)) < 0) {
+    cout << "FAIL: time equalizer refused by the demod\n";
+    return -1;
+  }
+  std::vector<complex<double>> eq_out(50000);
+  eq_demod.process(demod_in.data(), eq_out.data(), eq_out.size());
+  bool eq_finite = true;
+  for (auto &x : eq_out)
+    eq_finite = eq_finite && std::isfinite(x.real()) && std::isfinite(x.imag());
+  if (!eq_finite || !eq_demod.Eq->primed) {
+    cout << "FAIL: equalizer in the demod\n";
+    return -1;
+  }
+  // the chain's equalizer stage gives the same output
+  ChainBpskDemod<complex<double>, 4, 64, EqStage<complex<double>>> eq_chain(0.35, 256);
+  eq_chain.Eq = EqStage<complex<double>>(32, 4);
+  std::vector<complex<double>> eq_chain_out(eq_out.size());
+  eq_chain.process_block(demod_in.data(), eq_chain_out.data(), eq_chain_out.size());
+  if (eq_chain_out != eq_out) {
+    cout << "FAIL: ChainBpskDemod equalizer stage differs from BpskDemod's equalizer\n";
+    return -1;
+  }
+  // an fft equalizer is too late for the loop, the demod refuses it
+  BpskDemod fft_eq_demod(4, 0.35, 256);
+  if (fft_eq_demod.setEqualizer(std::make_shared<Equalizer>(32, 4, equalize_fft)) == 0 || fft_eq_demod.Eq) {
+    cout << "FAIL: fft equalizer accepted by the demod\n";
+    return -1;
+  }
+
+  // Block FIR kernels: every variant matches CFIRFilter, fed in uneven
+  // pieces and in place, on symmetric (RRC) and asymmetric taps.
+  cout << "Checking block FIR kernels..\n";
+  std::vector<CSampleVector> fir_sets = {computeCpxRRC(4, 0.35, 4), CSampleVector(20)};
+  for (auto &c : fir_sets[1])
+    c = complex<double>(randval(), randval());
+  std::vector<complex<double>> fir_in(5000);
+  for (auto &x : fir_in)
+    x = complex<double>(randval(), randval());
+  const int fir_pieces[] = {1, 7, 300, 1000, 33, 2000, 1659};
+  for (auto &taps : fir_sets) {
+    CFIRFilter fir_ref(taps);
+    std::vector<complex<double>> want_out(fir_in.size());
+    for (size_t i = 0; i < fir_in.size(); ++i)
+      want_out[i] = fir_ref.process(fir_in[i]);
+    for (int k = 0; k < fir_kernel_count; ++k) {
+      FirTuning t;
+      t.kernel = (fir_kernel_t)k;
+      t.param = k == fir_fft ? 64 : 256;
+      BlockFIR fir(taps, t);
+      std::vector<complex<double>> got(fir_in);
+      size_t at = 0;
+      for (int n : fir_pieces) {
+        fir.process(&got[at], &got[at], n);
+        at += n;
+      }
+      double fir_err = 0;
+      for (size_t i = 0; i < got.size(); ++i)
+        fir_err = std::max(fir_err, std::abs(got[i] - want_out[i]));
+      if (fir_err > 1e-9) {
+        cout << "FAIL: " << firKernelName(fir.tuning.kernel) << " kernel on " << taps.size() << " taps, error "
+             << fir_err << "\n";
+        return -1;
+      }
+    }
+  }
+  // the tuner: times once, then reads the cache file, and the override
+  setenv("LIBDSP_CACHE_DIR", scratch.file("fir_cache").c_str(), 1);
+  unsetenv("LIBDSP_FIR_KERNEL");
+  resetFirTuning();
+  FirTuning tuned = tuneBlockFIR<double>(fir_sets[0], 4096);
+  resetFirTuning();
+  FirTuning cached = tuneBlockFIR<double>(fir_sets[0], 4096);
+  setenv("LIBDSP_FIR_KERNEL", "fft:256", 1);
+  FirTuning forced = tuneBlockFIR<double>(fir_sets[0], 4096);
+  unsetenv("LIBDSP_FIR_KERNEL");
+  cout << "FIR tuning for 33 taps: " << firKernelName(tuned.kernel) << "/" << tuned.param << " (" << tuned.source
+       << "), then " << firKernelName(cached.kernel) << "/" << cached.param << " (" << cached.source << ")\n";
+  if (std::string(tuned.source) != "tuned" || std::string(cached.source) != "cached" ||
+      cached.kernel != tuned.kernel || cached.param != tuned.param || std::string(forced.source) != "forced" ||
+      forced.kernel != fir_fft || forced.param != 256) {
+    cout << "FAIL: FIR tuning cache/override\n";
+    return -1;
+  }
+
+  // Buffer arena: aligned blocks that come back after a free, big blocks
+  // on their own pages, vectors growing in it, and the cpu pinning.
+  cout << "Checking buffer arena..\n";
+  BufferArena arena(0);
+  std::vector<void *> blocks;
+  for (size_t bytes : {1, 64, 100, 4096, 65536, 3000000})
+    blocks.push_back(arena.allocate(bytes));
+  for (auto p : blocks) {
+    if (p == nullptr || (uintptr_t)p % arena_align != 0) {
+      cout << "FAIL: arena block " << p << " is not " << arena_align << " byte aligned\n";
+      return -1;
+    }
+  }
+  memset(blocks[5], 1, 3000000);
+  arena.deallocate(blocks[3], 4096);
+  arena.deallocate(blocks[5], 3000000);
+  if (arena.allocate(4000) != blocks[3] || arena.large.size() != 0) {
+    cout << "FAIL: arena free list\n";
+    return -1;
+  }
+  ArenaAllocator<CSampleT<float>> arena_alloc(&arena);
+  ArenaCSampleVectorT<float> arena_vec(arena_alloc);
+  for (int i = 0; i < 100000; ++i)
+    arena_vec.push_back(CSampleT<float>(i, -i));
+  if (arena_vec[99999] != CSampleT<float>(99999, -99999) || (uintptr_t)arena_vec.data() % arena_align != 0) {
+    cout << "FAIL: vector in the arena\n";
+    return -1;
+  }
+  cout << "Arena: " << arena.describe() << "\n";
+  std::vector<int> cpu_list;
+  if (parseCpuList("0-3,8,10-11", &cpu_list) < 0 || cpu_list != std::vector<int>{0, 1, 2, 3, 8, 10, 11} ||
+      parseCpuList("3-1", &cpu_list) == 0) {
+    cout << "FAIL: cpu list parse\n";
+    return -1;
+  }
+  std::vector<int> allowed = threadCpus();
+  std::vector<int> node_cpus = nodeCpus(0);
+  int pin_cpu = -1;
+  for (int c : node_cpus)
+    if (pin_cpu < 0 && std::find(allowed.begin(), allowed.end(), c) != allowed.end())
+      pin_cpu = c;
+  if (pin_cpu < 0 || pinThisThread({pin_cpu}) < 0 || threadCpus() != std::vector<int>{pin_cpu} ||
+      sched_getcpu() != pin_cpu) {
+    cout << "FAIL: pinning to cpu " << pin_cpu << " of node 0\n";
+    return -1;
+  }
+  pinThisThread(allowed);
+
+  // Planar samples: the converters round trip exactly at odd counts and
+  // offsets, and the planar mixer, detector, power and FIR match their
+  // interleaved versions.
+  cout << "Checking planar samples..\n";
+  std::vector<CSampleT<float>> il_f(1003);
+  for (auto &x : il_f)
+    x = CSampleT<float>(randval(), randval());
+  PlanarSamplesT<float> pl_f;
+  pl_f.load(il_f.data() + 1, 1001);
+  std::vector<CSampleT<float>> back_f(1002);
+  pl_f.store(back_f.data() + 1);
+  if ((uintptr_t)pl_f.i.data() % arena_align != 0 || (uintptr_t)pl_f.q.data() % arena_align != 0 ||
+      !std::equal(back_f.begin() + 1, back_f.end(), il_f.begin() + 1) || pl_f.q[1000] != il_f[1001].imag()) {
+    cout << "FAIL: float interleave/deinterleave\n";
+    return -1;
+  }
+  PlanarSamples pl(fir_in.size() - 1);
+  deinterleave(fir_in.data() + 1, pl.size(), pl.i.data(), pl.q.data());
+  std::vector<complex<double>> back(pl.size());
+  interleave(pl.i.data(), pl.q.data(), pl.size(), back.data());
+  if (!std::equal(back.begin(), back.end(), fir_in.begin() + 1)) {
+    cout << "FAIL: double interleave/deinterleave\n";
+    return -1;
+  }
+  CNCO mix_ref(0.3, 2.5);
+  CNCO mix_planar(0.3, 2.5);
+  PlanarSamples mixed(pl.size());
+  mix_planar.mix(pl.i.data(), pl.q.data(), mixed.i.data(), mixed.q.data(), pl.size());
+  double mix_err = 0;
+  for (int i = 0; i < pl.size(); ++i)
+    mix_err = std::max(mix_err, std::abs(mix_ref.generate() * back[i] - complex<double>(mixed.i[i], mixed.q[i])));
+  std::vector<double> det(pl.size());
+  PhaseDetectorBPSK(pl.i.data(), pl.q.data(), det.data(), pl.size());
+  double det_err = 0;
+  for (int i = 0; i < pl.size(); ++i)
+    det_err = std::max(det_err, std::abs(det[i] - PhaseDetectorBPSK(back[i])));
+  double power_err = std::abs(blockPower(pl.i.data(), pl.q.data(), pl.size()) - blockPower(back.data(), pl.size()));
+  cout << "Planar mixer error " << mix_err << ", phase " << std::abs(mix_planar.phase_acc - mix_ref.phase_acc) << "\n";
+  if (mix_err > 1e-9 || std::abs(mix_planar.phase_acc - mix_ref.phase_acc) > 1e-9 || det_err != 0 ||
+      power_err > 1e-12) {
+    cout << "FAIL: planar mixer/detector/power\n";
+    return -1;
+  }
+  for (int k = 0; k < fir_kernel_count; ++k) {
+    FirTuning t;
+    t.kernel = (fir_kernel_t)k;
+    t.param = k == fir_fft ? 64 : 256;
+    BlockFIR fir(fir_sets[1], t);
+    CFIRFilter fir_ref(fir_sets[1]);
+    PlanarSamples got = pl;
+    // planar and interleaved calls on the one filter
+    fir.process(got.i.data(), got.q.data(), got.i.data(), got.q.data(), 2000);
+    std::vector<complex<double>> mid(back.begin() + 2000, back.begin() + 3000);
+    fir.process(mid.data(), mid.data(), mid.size());
+    fir.process(&got.i[3000], &got.q[3000], &got.i[3000], &got.q[3000], got.size() - 3000);
+    double fir_err = 0;
+    for (int i = 0; i < got.size(); ++i) {
+      complex<double> y = i >= 2000 && i < 3000 ? mid[i - 2000] : complex<double>(got.i[i], got.q[i]);
+      fir_err = std::max(fir_err, std::abs(y - fir_ref.process(back[i])));
+    }
+    if (fir_err > 1e-9) {
+      cout << "FAIL: planar " << firKernelName(fir.tuning.kernel) << " FIR, error " << fir_err << "\n";
+      return -1;
+    }
+  }
   return 0;
 }
 
@@ -0,0 +1,118 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char trace_magic[8] = { 'D', 'S', 'P', 'T', 'R', 'A', 'C', 'E' };
+
+TraceRecorder::TraceRecorder() : mask(0), write_idx(0), read_idx(0), dropped(0), written(0),
+                                 every(1), fd(-1), stopping(false) {}
+
+TraceRecorder::~TraceRecorder() {
+    close();
+}
+
+int TraceRecorder::open( const std::string &path, uint32_t _every, size_t capacity ) {
+    size_t size = 1;
+    while ( size < capacity ) {
+        size <<= 1;
+    }
+    ring.resize( size );
+    mask = size - 1;
+    every = _every > 0 ? _every : 1;
+    write_idx = 0;
+    read_idx = 0;
+    dropped = 0;
+    written = 0;
+    fd = ::open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fd < 0 ) {
+        std::cout << "Failed to open trace file : " << path << std::endl;
+        return -1;
+    }
+    // header is rewritten with the final counts by close()
+    TraceHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    if ( write( fd, &hdr, sizeof(hdr) ) != sizeof(hdr) ) {
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    stopping = false;
+    flusher = std::thread( &TraceRecorder::flushLoop, this );
+    return 0;
+}
+
+// write out everything between read_idx and write_idx
+void TraceRecorder::flushPending() {
+    uint64_t r = read_idx.load( std::memory_order_relaxed );
+    uint64_t w = write_idx.load( std::memory_order_acquire );
+    while ( r < w ) {
+        // contiguous run up to the end of the ring
+        uint64_t n = std::min( w - r, ring.size() - ( r & mask ) );
+        size_t len = n * sizeof(TraceRecord);
+        if ( write( fd, &ring[ r & mask ], len ) != (ssize_t)len ) {
+            std::cout << "Trace file write failed\n";
+        }
+        written += n;
+        r += n;
+        read_idx.store( r, std::memory_order_release );
+    }
+}
+
+void TraceRecorder::flushLoop() {
+    while ( !stopping.load( std::memory_order_acquire ) ) {
+        flushPending();
+        std::this_thread::sleep_for( std::chrono::milliseconds(5) );
+    }
+}
+
+void TraceRecorder::close() {
+    if ( fd < 0 ) {
+        return;
+    }
+    stopping = true;
+    flusher.join();
+    flushPending();
+    TraceHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.magic, trace_magic, sizeof(hdr.magic) );
+    hdr.version = 1;
+    hdr.record_size = sizeof(TraceRecord);
+    hdr.records = written;
+    hdr.dropped = dropped;
+    hdr.every = every;
+    pwrite( fd, &hdr, sizeof(hdr), 0 );
+    ::close(fd);
+    fd = -1;
+}
+
+int loadTrace( const std::string &path, TraceHeader *header, std::vector<TraceRecord> *records ) {
+    int fd = ::open( path.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        return -1;
+    }
+    TraceHeader hdr;
+    if ( read( fd, &hdr, sizeof(hdr) ) != sizeof(hdr) || memcmp( hdr.magic, trace_magic, sizeof(hdr.magic) ) != 0 ||
+         hdr.record_size != sizeof(TraceRecord) ) {
+        ::close(fd);
+        return -1;
+    }
+    records->resize( hdr.records );
+    char *p = (char*)records->data();
+    size_t left = hdr.records * sizeof(TraceRecord);
+    while ( left > 0 ) {
+        ssize_t got = read( fd, p, left );
+        if ( got <= 0 ) {
+            ::close(fd);
+            return -1;
+        }
+        p += got;
+        left -= got;
+    }
+    ::close(fd);
+    *header = hdr;
+    return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////////////////////
+// Loop trace recorder
+///////////////////////////
+//
+// Records carrier loop variables into a preallocated ring buffer that a
+// background thread flushes to a binary file, so the demod thread never
+// blocks on I/O.  If the flusher falls behind, records are dropped (and
+// counted) instead of stalling the demod.
+//
+// File layout: one TraceHeader, then TraceHeader::records TraceRecords,
+// little endian as written by the host.  Load with loadTrace() or
+// dsp/loadTrace.m.
+
+// one record, 40 bytes
+struct TraceRecord {
+    uint64_t sample;        // input sample number
+    float phase_err;        // phase detector output
+    float freq_err;         // averaged frequency error (loop window)
+    float avg_phase_err;    // averaged phase error (loop window)
+    float freq_est;         // NCO rate estimate
+    float phase_est;        // NCO phase offset estimate
+    float magnitude;        // matched filter output magnitude
+    uint32_t state;         // demod state after this sample
+    uint32_t last_state;    // state before this sample, differs on a transition
+};
+
+struct TraceHeader {
+    char magic[8];          // "DSPTRACE"
+    uint32_t version;
+    uint32_t record_size;   // sizeof(TraceRecord)
+    uint64_t records;       // records in the file
+    uint64_t dropped;       // records lost to a full ring
+    uint32_t every;         // samples between records (transitions are always kept)
+    uint32_t reserved;
+};
+
+struct TraceRecorder {
+    TraceRecorder();
+    ~TraceRecorder();
+    // create the trace file and start the flush thread, capacity is
+    // rounded up to a power of 2 records.  returns -1 on failure.
+    int open( const std::string &path, uint32_t every, size_t capacity=1<<16 );
+    // flush everything recorded and finish the file
+    void close();
+    // add a record (demod thread only)
+    inline void push( const TraceRecord &r ) {
+        uint64_t w = write_idx.load( std::memory_order_relaxed );
+        if ( w - read_idx.load( std::memory_order_acquire ) >= ring.size() ) {
+            dropped.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        ring[ w & mask ] = r;
+        write_idx.store( w+1, std::memory_order_release );
+    }
+
+    std::vector<TraceRecord> ring;
+    uint64_t mask;
+    std::atomic<uint64_t> write_idx;
+    std::atomic<uint64_t> read_idx;
+    std::atomic<uint64_t> dropped;
+    uint64_t written;
+    uint32_t every;
+    int fd;
+    std::atomic<bool> stopping;
+    std::thread flusher;
+
+    void flushPending();
+    void flushLoop();
+};
+
+// Per demod hook, decides which samples get a record.  Costs one branch
+// per sample while no recorder is attached.  With one, due() counts the
+// sample and the demod works out the loop variables for record() only
+// when it says so:
+//
+//   if ( trace.rec && trace.due( state, last_state ) ) {
+//       trace.record( state, last_state, PhaseDetectorBPSK( y ), .. );
+//   }
+struct TraceTap {
+    TraceRecorder *rec = nullptr;
+    uint32_t every = 1;
+    uint32_t count = 0;
+    uint64_t sample = 0;
+    // attach a recorder (nullptr detaches)
+    void attach( TraceRecorder *_rec ) {
+        rec = _rec;
+        every = rec ? rec->every : 1;
+        count = 0;
+    }
+    // count a sample, true if it gets a record (every'th sample and every
+    // state transition)
+    inline bool due( int state, int last_state ) {
+        sample++;
+        if ( ++count < every && state == last_state ) {
+            return false;
+        }
+        count = 0;
+        return true;
+    }
+    // record the sample due() just passed
+    template <typename R, typename S>
+    void record( int state, int last_state, R phase_err, R freq_err, R avg_phase_err,
+                 R freq_est, R phase_est, S out ) {
+        TraceRecord r;
+        r.sample = sample-1;
+        r.phase_err = phase_err;
+        r.freq_err = freq_err;
+        r.avg_phase_err = avg_phase_err;
+        r.freq_est = freq_est;
+        r.phase_est = phase_est;
+        r.magnitude = std::abs( out );
+        r.state = state;
+        r.last_state = last_state;
+        rec->push( r );
+    }
+};
+
+// read a trace file, returns -1 if it can't be read
+int loadTrace( const std::string &path, TraceHeader *header, std::vector<TraceRecord> *records );
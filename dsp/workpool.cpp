@@ -0,0 +1,107 @@
+#include "workpool.hpp"
+#include "profile.hpp"
+#include "arena.hpp"
+
+// pool size for WorkPool( threads, node )
+static int poolSize( int threads, const std::vector<int> &cpus ) {
+    if ( threads > 0 ) {
+        return threads;
+    }
+    if ( cpus.size() ) {
+        return cpus.size();
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+WorkPool::WorkPool( int threads, int node ) {
+    std::vector<int> cpus;
+    if ( node >= 0 ) {
+        cpus = nodeCpus( node );
+    }
+    queues = std::vector<JobQueue>( poolSize( threads, cpus ) );
+    next_queue = 0;
+    queued = 0;
+    pending = 0;
+    stopping = false;
+    for ( int idx=0; idx < (int)queues.size(); ++idx ) {
+        workers.push_back( std::thread( &WorkPool::workerLoop, this, idx ) );
+        if ( cpus.size() ) {
+            pinThread( workers.back(), { cpus[ idx % cpus.size() ] } );
+        }
+    }
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for ( auto &w : workers ) {
+        w.join();
+    }
+}
+
+void WorkPool::submit( Job job ) {
+    int q = next_queue++ % (int)queues.size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> guard(queues[q].lock);
+        queues[q].jobs.push_back( std::move(job) );
+    }
+    {
+        // take idle_lock so a worker about to sleep can't miss the wake up
+        std::lock_guard<std::mutex> guard(idle_lock);
+        queued++;
+    }
+    DSP_PROFILE_GAUGE("workpool.queued", queued);
+    work_ready.notify_one();
+}
+
+void WorkPool::wait() {
+    std::unique_lock<std::mutex> guard(idle_lock);
+    all_done.wait( guard, [this] { return pending == 0; } );
+}
+
+// pop from our own queue first, then steal from the back of the others.
+bool WorkPool::takeJob( int worker, Job &job ) {
+    int count = (int)queues.size();
+    for ( int idx=0; idx < count; ++idx ) {
+        JobQueue &q = queues[ (worker+idx) % count ];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if ( q.jobs.empty() ) {
+            continue;
+        }
+        if ( idx == 0 ) {
+            job = std::move( q.jobs.front() );
+            q.jobs.pop_front();
+        } else {
+            job = std::move( q.jobs.back() );
+            q.jobs.pop_back();
+        }
+        queued--;
+        DSP_PROFILE_GAUGE("workpool.queued", queued);
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::workerLoop( int worker ) {
+    Job job;
+    while (1) {
+        if ( takeJob( worker, job ) ) {
+            job();
+            job = nullptr;
+            if ( --pending == 0 ) {
+                std::lock_guard<std::mutex> guard(idle_lock);
+                all_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(idle_lock);
+        work_ready.wait( guard, [this] { return stopping || queued > 0; } );
+        if ( stopping && queued == 0 ) {
+            return;
+        }
+    }
+}
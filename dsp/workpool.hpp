@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <vector>
+
+// Fixed size pool of worker threads for running independent jobs.
+// Every worker owns a job queue; it takes work from the front of its own
+// queue and, when that runs dry, steals from the back of the other
+// workers' queues, so a few long jobs don't leave the rest of the pool idle.
+struct WorkPool {
+    using Job = std::function<void()>;
+
+    // threads=0 sizes the pool to the machine (hardware_concurrency), or
+    // to the node's cores with a node, workers are then pinned one per
+    // core of the node (arena.hpp)
+    WorkPool( int threads=0, int node=-1 );
+    ~WorkPool();
+    // queue a job, jobs are spread round robin across the workers
+    void submit( Job job );
+    // block until every submitted job has finished
+    void wait();
+    // number of worker threads
+    int size() const { return (int)workers.size(); }
+
+    struct JobQueue {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<JobQueue> queues;
+    std::atomic<int> next_queue;
+    std::atomic<long> queued;       // sitting in a queue, not yet taken
+    std::atomic<long> pending;      // submitted but not yet finished
+    bool stopping;
+    std::mutex idle_lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+
+    bool takeJob( int worker, Job &job );
+    void workerLoop( int worker );
+};